@@ -73,9 +73,18 @@ gate_OR(garble_circuit *gc, garble_context *ctxt, int input0, int input1,
 void
 gate_NOT(garble_circuit *gc, garble_context *ctxt, int input0, int output)
 {
+    gc->nxors++;
     _gate(gc, ctxt, input0, input0, output, GARBLE_GATE_NOT);
 }
 
+void
+gate_XNOR(garble_circuit *gc, garble_context *ctxt, int input0, int input1,
+          int output)
+{
+    gc->nxors++;
+    _gate(gc, ctxt, input0, input1, output, GARBLE_GATE_XNOR);
+}
+
 int
 wire_zero(garble_circuit *gc)
 {
@@ -33,6 +33,9 @@ gate_XOR(garble_circuit *gc, garble_context *ctxt, int input0,
          int input1, int output);
 void
 gate_NOT(garble_circuit *gc, garble_context *ctxt, int input0, int output);
+void
+gate_XNOR(garble_circuit *gc, garble_context *ctxt, int input0,
+          int input1, int output);
 int
 wire_zero(garble_circuit *gc);
 int
@@ -0,0 +1,237 @@
+/*
+ * On-disk cache of built circuit topologies.
+ *
+ * A cache entry holds the gate list, outputs and sizes of a circuit as
+ * produced by a builder function.  Entries are named after the SHA-1 of the
+ * caller's key (the builder function and its parameters) and the garbling
+ * type, and are laid out so that a hit only needs to map the file: 'gc->gates'
+ * and 'gc->outputs' point into a private mapping that is faulted in lazily.
+ */
+
+#define _GNU_SOURCE
+
+#include <garble.h>
+#include "circuit_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#define CACHE_MAGIC "GARBLEK2"
+#define CACHE_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    unsigned char key[SHA_DIGEST_LENGTH];
+    uint32_t pad;
+    uint64_t n, m, q, r, nxors, type;
+    /* file offsets of the sections, and total file size */
+    uint64_t gates, outputs, size;
+} cache_header;
+
+static inline uint64_t
+align_up(uint64_t x)
+{
+    return (x + CACHE_ALIGN - 1) & ~(uint64_t) (CACHE_ALIGN - 1);
+}
+
+static void
+layout(const garble_circuit *gc, cache_header *h)
+{
+    h->n = gc->n;
+    h->m = gc->m;
+    h->q = gc->q;
+    h->r = gc->r;
+    h->nxors = gc->nxors;
+    h->type = gc->type;
+    h->gates = align_up(sizeof(cache_header));
+    h->outputs = align_up(h->gates + sizeof(garble_gate) * gc->q);
+    h->size = h->outputs + sizeof(int) * gc->m;
+}
+
+static void
+fingerprint(const char *key, garble_type_e type,
+            unsigned char digest[SHA_DIGEST_LENGTH])
+{
+    SHA_CTX c;
+    const uint32_t t = type;
+
+    (void) SHA1_Init(&c);
+    (void) SHA1_Update(&c, key, strlen(key));
+    (void) SHA1_Update(&c, &t, sizeof t);
+    (void) SHA1_Final(digest, &c);
+}
+
+static int
+entry_path(char *path, size_t len, const char *dir,
+           const unsigned char digest[SHA_DIGEST_LENGTH])
+{
+    char hex[2 * SHA_DIGEST_LENGTH + 1];
+    int res;
+
+    for (size_t i = 0; i < SHA_DIGEST_LENGTH; ++i)
+        (void) sprintf(hex + 2 * i, "%02x", digest[i]);
+    res = snprintf(path, len, "%s/%s.gck", dir, hex);
+    return res < 0 || (size_t) res >= len ? GARBLE_ERR : GARBLE_OK;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return GARBLE_ERR;
+        p += n;
+        len -= n;
+    }
+    return GARBLE_OK;
+}
+
+/* Gate types and wire indices of an entry, which garbling trusts */
+static int
+check_wires(const garble_circuit *gc)
+{
+    if (gc->r < gc->n + 2)
+        return GARBLE_ERR;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        if (g->type > GARBLE_GATE_XNOR || g->input0 >= gc->r
+            || g->input1 >= gc->r || g->output >= gc->r
+            || g->output < gc->n + 2)
+            return GARBLE_ERR;
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        if (gc->outputs[i] < 0 || (size_t) gc->outputs[i] >= gc->r)
+            return GARBLE_ERR;
+    return GARBLE_OK;
+}
+
+static int
+load_entry(garble_circuit *gc, const char *path,
+           const unsigned char digest[SHA_DIGEST_LENGTH])
+{
+    garble_circuit tmp;
+    cache_header h, expect;
+    struct stat st;
+    char *p;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return GARBLE_ERR;
+    if (fstat(fd, &st) == -1 || (uint64_t) st.st_size < sizeof(cache_header)) {
+        (void) close(fd);
+        return GARBLE_ERR;
+    }
+    /* Writable private mapping, so callers may still rewrite gates in place */
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (p == MAP_FAILED)
+        return GARBLE_ERR;
+    memcpy(&h, p, sizeof h);
+
+    memset(&tmp, '\0', sizeof tmp);
+    tmp.n = h.n;
+    tmp.m = h.m;
+    tmp.q = h.q;
+    tmp.r = h.r;
+    tmp.nxors = h.nxors;
+    tmp.type = h.type;
+    if (memcmp(h.magic, CACHE_MAGIC, sizeof h.magic) != 0
+        || memcmp(h.key, digest, SHA_DIGEST_LENGTH) != 0
+        || h.q < h.nxors || h.type > GARBLE_TYPE_PRIVACY_FREE
+        || h.q > (uint64_t) st.st_size / sizeof(garble_gate)
+        || h.m > (uint64_t) st.st_size / sizeof(int))
+        goto error;
+    layout(&tmp, &expect);
+    if (h.gates != expect.gates || h.outputs != expect.outputs
+        || h.size != expect.size || h.size != (uint64_t) st.st_size)
+        goto error;
+
+    tmp.gates = (garble_gate *) (p + h.gates);
+    tmp.outputs = (int *) (p + h.outputs);
+    /* A damaged entry is dropped, and rebuilt by the caller */
+    if (check_wires(&tmp) == GARBLE_ERR)
+        goto error;
+    tmp.mapping = p;
+    tmp.mapping_size = st.st_size;
+    *gc = tmp;
+    return GARBLE_OK;
+error:
+    (void) munmap(p, st.st_size);
+    return GARBLE_ERR;
+}
+
+/* Write the entry to a temporary file and rename it into place, so
+ * concurrent readers never see a partial entry.  The temporary file is
+ * unique, so concurrent writers of one key, in any thread or process, never
+ * write to the same file. */
+static int
+store_entry(const garble_circuit *gc, const char *path,
+            const unsigned char digest[SHA_DIGEST_LENGTH])
+{
+    static const char zeros[CACHE_ALIGN];
+    char tmp[4096];
+    cache_header h;
+    int fd, res = GARBLE_ERR;
+
+    if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= (int) sizeof tmp)
+        return GARBLE_ERR;
+    if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1)
+        return GARBLE_ERR;
+    /* mkostemp creates the file readable by its owner only */
+    (void) fchmod(fd, 0644);
+    memset(&h, '\0', sizeof h);
+    memcpy(h.magic, CACHE_MAGIC, sizeof h.magic);
+    memcpy(h.key, digest, SHA_DIGEST_LENGTH);
+    layout(gc, &h);
+    if (write_all(fd, &h, sizeof h) == GARBLE_OK
+        && write_all(fd, zeros, h.gates - sizeof h) == GARBLE_OK
+        && write_all(fd, gc->gates, sizeof(garble_gate) * gc->q) == GARBLE_OK
+        && write_all(fd, zeros, h.outputs - h.gates
+                     - sizeof(garble_gate) * gc->q) == GARBLE_OK
+        && write_all(fd, gc->outputs, sizeof(int) * gc->m) == GARBLE_OK)
+        res = GARBLE_OK;
+    if (close(fd) == -1)
+        res = GARBLE_ERR;
+    if (res == GARBLE_OK && rename(tmp, path) == -1)
+        res = GARBLE_ERR;
+    if (res == GARBLE_ERR)
+        (void) unlink(tmp);
+    return res;
+}
+
+int
+builder_cache_build(garble_circuit *gc, const char *dir, const char *key,
+                    garble_type_e type, builder_build_fn build, bool *hit)
+{
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    char path[4096];
+
+    if (gc == NULL || dir == NULL || key == NULL || build == NULL)
+        return GARBLE_ERR;
+    fingerprint(key, type, digest);
+    if (entry_path(path, sizeof path, dir, digest) == GARBLE_ERR)
+        return GARBLE_ERR;
+    if (hit)
+        *hit = false;
+    if (load_entry(gc, path, digest) == GARBLE_OK) {
+        if (hit)
+            *hit = true;
+        return GARBLE_OK;
+    }
+    /* Miss (or an unreadable entry): build, and store on a best-effort basis */
+    build(gc, type);
+    (void) store_entry(gc, path, digest);
+    return GARBLE_OK;
+}
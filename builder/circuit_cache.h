@@ -0,0 +1,18 @@
+#ifndef LIBGARBLEC_CIRCUIT_CACHE_H
+#define LIBGARBLEC_CIRCUIT_CACHE_H
+
+#include "garble.h"
+
+/* Builds a circuit of the given type into 'gc', as build_aes_circuit does */
+typedef void (*builder_build_fn)(garble_circuit *gc, garble_type_e type);
+
+/* Loads the circuit cached in directory 'dir' under 'key' and 'type', or
+   builds it with 'build' and adds it to the cache.  'key' must identify the
+   builder function and all of its parameters.  On a hit, 'gc->gates' and
+   'gc->outputs' point into a private mapping of the cache entry, released by
+   garble_delete.  '*hit', if not NULL, tells whether the cache was used. */
+int
+builder_cache_build(garble_circuit *gc, const char *dir, const char *key,
+                    garble_type_e type, builder_build_fn build, bool *hit);
+
+#endif
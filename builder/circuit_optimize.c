@@ -0,0 +1,1186 @@
+/*
+ * Circuit optimizer.
+ *
+ * A forward pass maps every wire of the input circuit to a literal: a wire
+ * of the output circuit plus a complement bit.  Constants are the literals
+ * of the fixed zero wire, so folding is a matter of comparing literals, and
+ * complements travel through XOR gates; where a complement must be
+ * materialized it costs a (free) NOT or XNOR gate, and never a longer path.
+ * Gates whose inputs do not fold are hash-consed on (type, inputs), which
+ * merges structurally identical gates.  A backward pass then drops the gates
+ * no output depends on and renumbers the wires densely.
+ *
+ * builder_minimize_ands rewrites the circuit as an XOR-AND graph.  Every AND
+ * node is matched against its cuts of up to three leaves; when the function
+ * of a cut has an implementation with fewer AND gates than the cone it would
+ * free, the node is rebuilt from that implementation.  Every function of
+ * three variables needs at most two AND gates, and the minimum-AND
+ * implementations are found by enumeration once per call.
+ *
+ * builder_balance collapses chains of one associative gate type, whose inner
+ * gates feed nothing but the next gate of the chain, into a single n-ary
+ * node and re-emits it as a tree combining the two earliest available
+ * operands first.  The tree has as many gates as the chain.
+ *
+ * builder_localize keeps the gates but runs each one as soon as the last of
+ * its inputs is computed, so that labels are read shortly after they are
+ * written, and numbers the wires in that order.  The new order is kept only
+ * if it lowers the reuse distances of the label accesses.
+ */
+
+#include <garble.h>
+#include "circuit_optimize.h"
+
+#include <string.h>
+
+typedef uint64_t lit;
+
+#define LIT(w, neg) (((lit) (w) << 1) | (neg))
+#define WIRE(l) ((size_t) ((l) >> 1))
+#define NEG(l) ((int) ((l) & 1))
+
+typedef struct {
+    uint64_t key;               /* 0 means empty */
+    size_t wire;
+} entry;
+
+typedef struct {
+    size_t n;                   /* index of the fixed zero wire */
+    garble_gate *gates;
+    size_t q, cap;
+    entry *table;
+    size_t mask, count;
+} optimizer;
+
+static uint64_t
+key_of(garble_gate_type_e type, size_t a, size_t b)
+{
+    if (a > b) {
+        size_t t = a;
+        a = b;
+        b = t;
+    }
+    /* Wire indices are below 2^30 in practice; mix them into one word */
+    return ((uint64_t) type << 60) ^ ((uint64_t) a << 30) ^ b ^ ((uint64_t) 1 << 63);
+}
+
+static inline size_t
+slot_of(const optimizer *o, uint64_t key)
+{
+    return (key * 0x9e3779b97f4a7c15ULL) >> 20 & o->mask;
+}
+
+/* Double the hash table once it is half full */
+static int
+grow(optimizer *o)
+{
+    const size_t size = 2 * (o->mask + 1);
+    entry *table = calloc(size, sizeof(entry)), *old = o->table;
+
+    if (table == NULL)
+        return GARBLE_ERR;
+    o->table = table;
+    o->mask = size - 1;
+    for (size_t j = 0; j < size / 2; ++j) {
+        if (old[j].key != 0) {
+            size_t i = slot_of(o, old[j].key);
+            while (table[i].key != 0)
+                i = (i + 1) & o->mask;
+            table[i] = old[j];
+        }
+    }
+    free(old);
+    return GARBLE_OK;
+}
+
+static entry *
+lookup(optimizer *o, garble_gate_type_e type, size_t a, size_t b)
+{
+    const uint64_t key = key_of(type, a, b);
+    size_t i;
+
+    if (2 * (o->count + 1) > o->mask + 1 && grow(o) == GARBLE_ERR)
+        return NULL;
+    i = slot_of(o, key);
+    while (o->table[i].key != 0) {
+        if (o->table[i].key == key) {
+            const garble_gate *g = &o->gates[o->table[i].wire - o->n - 2];
+            /* Guard against collisions of the mixed key */
+            if (g->type == type && ((g->input0 == a && g->input1 == b)
+                                    || (g->input0 == b && g->input1 == a)))
+                return &o->table[i];
+        }
+        i = (i + 1) & o->mask;
+    }
+    o->table[i].key = key;
+    o->count++;
+    return &o->table[i];
+}
+
+/* The output wire of gate (type, a, b), emitting the gate unless an
+ * identical one exists */
+static int
+emit(optimizer *o, garble_gate_type_e type, size_t a, size_t b, size_t *out)
+{
+    entry *e = lookup(o, type, a, b);
+    garble_gate *g;
+
+    if (e == NULL)
+        return GARBLE_ERR;
+    if (e->wire != 0) {
+        *out = e->wire;
+        return GARBLE_OK;
+    }
+    if (o->q == o->cap) {
+        garble_gate *gates = realloc(o->gates, 2 * o->cap * sizeof(garble_gate));
+        if (gates == NULL)
+            return GARBLE_ERR;
+        o->gates = gates;
+        o->cap *= 2;
+    }
+    g = &o->gates[o->q];
+    g->type = type;
+    g->input0 = a;
+    g->input1 = b;
+    g->output = o->n + 2 + o->q++;
+    e->wire = g->output;
+    *out = g->output;
+    return GARBLE_OK;
+}
+
+/* A wire carrying literal 'l'.  The complement of an XOR is emitted as the
+ * XNOR of its inputs, at the same depth; any other complement was a gate of
+ * its own in the input circuit, so the NOT gate emitted for it adds no depth
+ * either. */
+static int
+materialize(optimizer *o, lit l, size_t *out)
+{
+    const size_t w = WIRE(l);
+
+    if (!NEG(l)) {
+        *out = w;
+        return GARBLE_OK;
+    }
+    if (w == o->n) {
+        *out = o->n + 1;
+        return GARBLE_OK;
+    }
+    if (w >= o->n + 2 && o->gates[w - o->n - 2].type == GARBLE_GATE_XOR) {
+        const garble_gate *g = &o->gates[w - o->n - 2];
+        return emit(o, GARBLE_GATE_XNOR, g->input0, g->input1, out);
+    }
+    return emit(o, GARBLE_GATE_NOT, w, w, out);
+}
+
+/* Literal of gate 'g' given the literals of its inputs */
+static int
+fold(optimizer *o, garble_gate_type_e type, lit a, lit b, lit *out)
+{
+    const lit zero = LIT(o->n, 0), one = LIT(o->n, 1);
+    size_t wa, wb, w;
+
+    switch (type) {
+    case GARBLE_GATE_ZERO:
+        *out = zero;
+        return GARBLE_OK;
+    case GARBLE_GATE_ONE:
+        *out = one;
+        return GARBLE_OK;
+    case GARBLE_GATE_NOT:
+        *out = a ^ 1;
+        return GARBLE_OK;
+    case GARBLE_GATE_XNOR:
+        b ^= 1;
+        /* fall through */
+    case GARBLE_GATE_XOR:
+        if (WIRE(a) == WIRE(b)) {
+            *out = LIT(o->n, NEG(a) ^ NEG(b));
+        } else if (WIRE(a) == o->n) {
+            *out = b ^ NEG(a);
+        } else if (WIRE(b) == o->n) {
+            *out = a ^ NEG(b);
+        } else {
+            if (emit(o, GARBLE_GATE_XOR, WIRE(a), WIRE(b), &w) == GARBLE_ERR)
+                return GARBLE_ERR;
+            *out = LIT(w, NEG(a) ^ NEG(b));
+        }
+        return GARBLE_OK;
+    case GARBLE_GATE_AND:
+    case GARBLE_GATE_OR: {
+        /* OR is AND with the roles of zero and one swapped */
+        const lit absorb = type == GARBLE_GATE_AND ? zero : one;
+        if (a == absorb || b == absorb || a == (b ^ 1)) {
+            *out = absorb;
+        } else if (a == (absorb ^ 1) || a == b) {
+            *out = b;
+        } else if (b == (absorb ^ 1)) {
+            *out = a;
+        } else {
+            if (materialize(o, a, &wa) == GARBLE_ERR
+                || materialize(o, b, &wb) == GARBLE_ERR
+                || emit(o, type, wa, wb, &w) == GARBLE_ERR)
+                return GARBLE_ERR;
+            *out = LIT(w, 0);
+        }
+        return GARBLE_OK;
+    }
+    default:
+        return GARBLE_ERR;
+    }
+}
+
+/* Gates of a cached circuit live in its file mapping */
+static void
+free_gates(garble_circuit *gc)
+{
+    if (gc->mapping == NULL || (char *) gc->gates < (char *) gc->mapping
+        || (char *) gc->gates >= (char *) gc->mapping + gc->mapping_size)
+        free(gc->gates);
+    gc->gates = NULL;
+}
+
+/* Drop the gates no output depends on and renumber the wires densely */
+static int
+sweep(optimizer *o, garble_circuit *gc, const size_t *outputs)
+{
+    const size_t base = o->n + 2;
+    size_t *map, q = 0, nxors = 0;
+
+    if ((map = calloc(base + o->q, sizeof(size_t))) == NULL)
+        return GARBLE_ERR;
+    for (size_t i = 0; i < gc->m; ++i)
+        map[outputs[i]] = 1;
+    for (size_t i = o->q; i-- > 0;) {
+        const garble_gate *g = &o->gates[i];
+        if (map[g->output]) {
+            map[g->input0] = 1;
+            map[g->input1] = 1;
+        }
+    }
+    for (size_t w = 0; w < base; ++w)
+        map[w] = w;
+    for (size_t i = 0; i < o->q; ++i) {
+        garble_gate g = o->gates[i];
+        if (!map[g.output])
+            continue;
+        g.input0 = map[g.input0];
+        g.input1 = map[g.input1];
+        g.output = map[g.output] = base + q;
+        nxors += garble_gate_is_free(g.type);
+        o->gates[q++] = g;
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        gc->outputs[i] = map[outputs[i]];
+    free(map);
+
+    free_gates(gc);
+    gc->gates = o->gates;
+    gc->q = q;
+    gc->nxors = nxors;
+    gc->r = base + q;
+    o->gates = NULL;
+    return GARBLE_OK;
+}
+
+static int
+optimizer_new(optimizer *o, const garble_circuit *gc)
+{
+    size_t size = 16;
+
+    while (size < 2 * (gc->q + gc->m))
+        size *= 2;
+    memset(o, '\0', sizeof(optimizer));
+    o->n = gc->n;
+    o->cap = gc->q ? gc->q : 1;
+    o->mask = size - 1;
+    o->gates = malloc(o->cap * sizeof(garble_gate));
+    o->table = calloc(size, sizeof(entry));
+    return o->gates && o->table ? GARBLE_OK : GARBLE_ERR;
+}
+
+static void
+optimizer_delete(optimizer *o)
+{
+    free(o->gates);
+    free(o->table);
+}
+
+int
+builder_optimize(garble_circuit *gc)
+{
+    optimizer o;
+    lit *lits = NULL;
+    size_t *outputs = NULL;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL || gc->table != NULL || gc->wires != NULL)
+        return GARBLE_ERR;
+    lits = malloc(gc->r * sizeof(lit));
+    outputs = malloc((gc->m ? gc->m : 1) * sizeof(size_t));
+    if (optimizer_new(&o, gc) == GARBLE_ERR || lits == NULL || outputs == NULL)
+        goto cleanup;
+
+    for (size_t w = 0; w < gc->r; ++w)
+        lits[w] = LIT(w, 0);
+    lits[gc->n + 1] = LIT(gc->n, 1);
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        if (g->input0 >= gc->r || g->input1 >= gc->r || g->output >= gc->r
+            || g->output < gc->n + 2)
+            goto cleanup;
+        if (fold(&o, g->type, lits[g->input0], lits[g->input1],
+                 &lits[g->output]) == GARBLE_ERR)
+            goto cleanup;
+    }
+    for (size_t i = 0; i < gc->m; ++i) {
+        if ((size_t) gc->outputs[i] >= gc->r
+            || materialize(&o, lits[gc->outputs[i]], &outputs[i]) == GARBLE_ERR)
+            goto cleanup;
+    }
+    res = sweep(&o, gc, outputs);
+
+cleanup:
+    optimizer_delete(&o);
+    free(lits);
+    free(outputs);
+    return res;
+}
+
+/*
+ * AND-count minimization
+ */
+
+/* Affine forms in the minimum-AND implementations: bits 0-2 select the cut
+ * leaves, bit 3 the first AND of the implementation, bit 4 the constant */
+#define AFF_G 0x8
+#define AFF_ONE 0x10
+
+/* f = (nands == 2 ? m1 & m2 : 0) ^ m3, where g = l1 & l2 if nands > 0 */
+typedef struct {
+    uint8_t nands, l1, l2, m1, m2, m3;
+} recipe;
+
+#define NO_RECIPE 3
+
+static uint8_t
+affine_tt(unsigned int mask, uint8_t g)
+{
+    static const uint8_t vars[3] = { 0xaa, 0xcc, 0xf0 };
+    uint8_t tt = mask & AFF_ONE ? 0xff : 0;
+
+    for (int i = 0; i < 3; ++i)
+        if (mask & (1 << i))
+            tt ^= vars[i];
+    return mask & AFF_G ? tt ^ g : tt;
+}
+
+/* Minimum-AND implementation of every function of three variables */
+static void
+recipes_init(recipe *table)
+{
+    for (int f = 0; f < 256; ++f)
+        table[f].nands = NO_RECIPE;
+    for (unsigned int m3 = 0; m3 < 32; m3 += m3 == 7 ? 9 : 1) {
+        recipe *r = &table[affine_tt(m3, 0)];
+        if (r->nands == NO_RECIPE)
+            *r = (recipe) { 0, 0, 0, 0, 0, m3 };
+    }
+    for (unsigned int l1 = 0; l1 < 32; l1 += l1 == 7 ? 9 : 1) {
+        for (unsigned int l2 = l1; l2 < 32; l2 += l2 == 7 ? 9 : 1) {
+            const uint8_t g = affine_tt(l1, 0) & affine_tt(l2, 0);
+            for (unsigned int m3 = 0; m3 < 32; ++m3) {
+                recipe *r = &table[affine_tt(m3, g)];
+                if (r->nands == NO_RECIPE)
+                    *r = (recipe) { 1, l1, l2, 0, 0, m3 };
+            }
+        }
+    }
+    for (unsigned int l1 = 0; l1 < 32; l1 += l1 == 7 ? 9 : 1) {
+        for (unsigned int l2 = l1; l2 < 32; l2 += l2 == 7 ? 9 : 1) {
+            const uint8_t g = affine_tt(l1, 0) & affine_tt(l2, 0);
+            for (unsigned int m1 = 0; m1 < 32; ++m1) {
+                for (unsigned int m2 = m1; m2 < 32; ++m2) {
+                    const uint8_t h = affine_tt(m1, g) & affine_tt(m2, g);
+                    for (unsigned int m3 = 0; m3 < 32; ++m3) {
+                        recipe *r = &table[h ^ affine_tt(m3, g)];
+                        if (r->nands == NO_RECIPE)
+                            *r = (recipe) { 2, l1, l2, m1, m2, m3 };
+                    }
+                }
+            }
+        }
+    }
+}
+
+#define CUT_LEAVES 3
+#define CUTS 8
+
+typedef struct {
+    size_t leaves[CUT_LEAVES];
+    uint8_t nleaves;
+    uint8_t tt;                 /* over the leaves, leaf i being 0xaa, 0xcc, 0xf0 */
+} cut;
+
+enum { NODE_NONE, NODE_AND, NODE_XOR };
+
+/* XOR-AND graph of a circuit, one node per AND, OR and XOR gate */
+typedef struct {
+    size_t r;
+    uint8_t *kind;
+    lit *fanin;                 /* two literals per node */
+    lit *alias;                 /* the literal each wire of the circuit carries */
+    size_t *refs;
+    cut *cuts;                  /* CUTS per node, the trivial cut first */
+    uint8_t *ncuts;
+} xag;
+
+/* Truth table of 'tt' over the leaves 'from' re-expressed over 'to' */
+static uint8_t
+cut_expand(uint8_t tt, const size_t *from, size_t nfrom, const size_t *to)
+{
+    int pos[CUT_LEAVES];
+    uint8_t out = 0;
+
+    for (size_t i = 0, j = 0; i < nfrom; ++i) {
+        while (to[j] != from[i])
+            ++j;
+        pos[i] = (int) j;
+    }
+    for (int x = 0; x < 8; ++x) {
+        int y = 0;
+        for (size_t i = 0; i < nfrom; ++i)
+            y |= ((x >> pos[i]) & 1) << i;
+        out |= ((tt >> y) & 1) << x;
+    }
+    return out;
+}
+
+static int
+cut_merge(const cut *a, const cut *b, cut *out)
+{
+    size_t i = 0, j = 0, k = 0;
+
+    while (i < a->nleaves || j < b->nleaves) {
+        size_t w;
+        if (j == b->nleaves || (i < a->nleaves && a->leaves[i] < b->leaves[j]))
+            w = a->leaves[i++];
+        else if (i == a->nleaves || b->leaves[j] < a->leaves[i])
+            w = b->leaves[j++];
+        else
+            w = a->leaves[i++], j++;
+        if (k == CUT_LEAVES)
+            return 0;
+        out->leaves[k++] = w;
+    }
+    out->nleaves = (uint8_t) k;
+    return 1;
+}
+
+static void
+xag_cuts(xag *x, size_t w)
+{
+    cut *cuts = &x->cuts[w * CUTS];
+    const lit f0 = x->fanin[2 * w], f1 = x->fanin[2 * w + 1];
+    const cut *c0 = &x->cuts[WIRE(f0) * CUTS], *c1 = &x->cuts[WIRE(f1) * CUTS];
+
+    cuts[0].leaves[0] = w;
+    cuts[0].nleaves = 1;
+    cuts[0].tt = 0xaa;
+    x->ncuts[w] = 1;
+    if (x->kind[w] == NODE_NONE)
+        return;
+    for (uint8_t i = 0; i < x->ncuts[WIRE(f0)]; ++i) {
+        for (uint8_t j = 0; j < x->ncuts[WIRE(f1)]; ++j) {
+            cut c;
+            uint8_t t0, t1, k;
+
+            if (x->ncuts[w] == CUTS)
+                return;
+            if (!cut_merge(&c0[i], &c1[j], &c))
+                continue;
+            for (k = 1; k < x->ncuts[w]; ++k)
+                if (cuts[k].nleaves == c.nleaves
+                    && memcmp(cuts[k].leaves, c.leaves,
+                              c.nleaves * sizeof(size_t)) == 0)
+                    break;
+            if (k < x->ncuts[w])
+                continue;
+            t0 = cut_expand(c0[i].tt, c0[i].leaves, c0[i].nleaves, c.leaves)
+                ^ (NEG(f0) ? 0xff : 0);
+            t1 = cut_expand(c1[j].tt, c1[j].leaves, c1[j].nleaves, c.leaves)
+                ^ (NEG(f1) ? 0xff : 0);
+            c.tt = x->kind[w] == NODE_AND ? t0 & t1 : t0 ^ t1;
+            cuts[x->ncuts[w]++] = c;
+        }
+    }
+}
+
+static int
+xag_new(xag *x, const garble_circuit *gc)
+{
+    memset(x, '\0', sizeof(xag));
+    x->r = gc->r;
+    x->kind = calloc(gc->r, sizeof(uint8_t));
+    x->fanin = calloc(2 * gc->r, sizeof(lit));
+    x->alias = malloc(gc->r * sizeof(lit));
+    x->refs = calloc(gc->r, sizeof(size_t));
+    x->cuts = malloc(gc->r * CUTS * sizeof(cut));
+    x->ncuts = calloc(gc->r, sizeof(uint8_t));
+    if (!x->kind || !x->fanin || !x->alias || !x->refs || !x->cuts
+        || !x->ncuts)
+        return GARBLE_ERR;
+
+    for (size_t w = 0; w < gc->n + 2; ++w) {
+        x->alias[w] = LIT(w, 0);
+        xag_cuts(x, w);
+    }
+    x->alias[gc->n + 1] = LIT(gc->n, 1);
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        const size_t w = g->output;
+        lit a = x->alias[g->input0], b = x->alias[g->input1];
+
+        switch (g->type) {
+        case GARBLE_GATE_NOT:
+            x->alias[w] = a ^ 1;
+            continue;
+        case GARBLE_GATE_XOR:
+        case GARBLE_GATE_XNOR:
+            x->kind[w] = NODE_XOR;
+            x->alias[w] = LIT(w, NEG(a) ^ NEG(b)
+                              ^ (g->type == GARBLE_GATE_XNOR));
+            a = LIT(WIRE(a), 0);
+            b = LIT(WIRE(b), 0);
+            break;
+        case GARBLE_GATE_AND:
+            x->kind[w] = NODE_AND;
+            x->alias[w] = LIT(w, 0);
+            break;
+        case GARBLE_GATE_OR:
+            /* a | b = ~(~a & ~b) */
+            x->kind[w] = NODE_AND;
+            x->alias[w] = LIT(w, 1);
+            a ^= 1;
+            b ^= 1;
+            break;
+        default:
+            /* Constants were folded away by builder_optimize */
+            return GARBLE_ERR;
+        }
+        x->fanin[2 * w] = a;
+        x->fanin[2 * w + 1] = b;
+        x->refs[WIRE(a)]++;
+        x->refs[WIRE(b)]++;
+        xag_cuts(x, w);
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        x->refs[WIRE(x->alias[gc->outputs[i]])]++;
+    return GARBLE_OK;
+}
+
+static void
+xag_delete(xag *x)
+{
+    free(x->kind);
+    free(x->fanin);
+    free(x->alias);
+    free(x->refs);
+    free(x->cuts);
+    free(x->ncuts);
+}
+
+static int
+cut_has(const cut *c, size_t w)
+{
+    for (uint8_t i = 0; i < c->nleaves; ++i)
+        if (c->leaves[i] == w)
+            return 1;
+    return 0;
+}
+
+/* AND nodes freed by removing node 'w' down to the leaves of 'c'; with
+ * 'delta' of +1 the reference counts are restored */
+static size_t
+xag_mffc(xag *x, size_t w, const cut *c, int delta)
+{
+    size_t count = x->kind[w] == NODE_AND;
+
+    for (int k = 0; k < 2; ++k) {
+        const size_t v = WIRE(x->fanin[2 * w + k]);
+        if (x->kind[v] == NODE_NONE || cut_has(c, v))
+            continue;
+        if (delta < 0 ? --x->refs[v] == 0 : x->refs[v]++ == 0)
+            count += xag_mffc(x, v, c, delta);
+    }
+    return count;
+}
+
+/* Literal of the affine form 'mask' over 'leaves' and 'g' */
+static int
+build_affine(optimizer *o, unsigned int mask, const lit *leaves, lit g,
+             lit *out)
+{
+    lit acc = LIT(o->n, (mask & AFF_ONE) != 0);
+
+    for (int i = 0; i < CUT_LEAVES; ++i)
+        if ((mask & (1 << i))
+            && fold(o, GARBLE_GATE_XOR, acc, leaves[i], &acc) == GARBLE_ERR)
+            return GARBLE_ERR;
+    if ((mask & AFF_G) && fold(o, GARBLE_GATE_XOR, acc, g, &acc) == GARBLE_ERR)
+        return GARBLE_ERR;
+    *out = acc;
+    return GARBLE_OK;
+}
+
+static int
+build_recipe(optimizer *o, const recipe *r, const lit *leaves, lit *out)
+{
+    lit a, b, g = LIT(o->n, 0), h = LIT(o->n, 0), m3;
+
+    if (r->nands > 0
+        && (build_affine(o, r->l1, leaves, g, &a) == GARBLE_ERR
+            || build_affine(o, r->l2, leaves, g, &b) == GARBLE_ERR
+            || fold(o, GARBLE_GATE_AND, a, b, &g) == GARBLE_ERR))
+        return GARBLE_ERR;
+    if (r->nands > 1
+        && (build_affine(o, r->m1, leaves, g, &a) == GARBLE_ERR
+            || build_affine(o, r->m2, leaves, g, &b) == GARBLE_ERR
+            || fold(o, GARBLE_GATE_AND, a, b, &h) == GARBLE_ERR))
+        return GARBLE_ERR;
+    if (build_affine(o, r->m3, leaves, g, &m3) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return fold(o, GARBLE_GATE_XOR, h, m3, out);
+}
+
+static size_t
+nonfree(const garble_circuit *gc)
+{
+    return gc->q - gc->nxors;
+}
+
+/* One round of cut rewriting; 'gc' is replaced only if it improved */
+static int
+minimize_round(garble_circuit *gc, const recipe *recipes, bool *improved)
+{
+    optimizer o;
+    xag x;
+    garble_circuit tmp;
+    lit *lits = NULL;
+    int8_t *choice = NULL;
+    size_t *outputs = NULL;
+    int res = GARBLE_ERR;
+
+    *improved = false;
+    memset(&o, '\0', sizeof o);
+    memset(&tmp, '\0', sizeof tmp);
+    if (xag_new(&x, gc) == GARBLE_ERR)
+        goto cleanup;
+    lits = malloc(gc->r * sizeof(lit));
+    choice = malloc(gc->r * sizeof(int8_t));
+    outputs = malloc((gc->m ? gc->m : 1) * sizeof(size_t));
+    if (lits == NULL || choice == NULL || outputs == NULL
+        || optimizer_new(&o, gc) == GARBLE_ERR)
+        goto cleanup;
+
+    /* Pick the cut saving the most AND gates at every node */
+    for (size_t w = 0; w < gc->r; ++w) {
+        int best = 0;
+
+        choice[w] = -1;
+        if (x.kind[w] == NODE_NONE || x.refs[w] == 0)
+            continue;
+        for (uint8_t k = 1; k < x.ncuts[w]; ++k) {
+            const cut *c = &x.cuts[w * CUTS + k];
+            size_t freed;
+            int gain;
+
+            if (recipes[c->tt].nands == NO_RECIPE)
+                continue;
+            freed = xag_mffc(&x, w, c, -1);
+            (void) xag_mffc(&x, w, c, +1);
+            gain = (int) freed - recipes[c->tt].nands;
+            if (gain > best) {
+                best = gain;
+                choice[w] = (int8_t) k;
+            }
+        }
+    }
+
+    /* Rebuild, the chosen nodes from their implementations */
+    for (size_t w = 0; w < gc->n + 2; ++w)
+        lits[w] = LIT(w, 0);
+    for (size_t w = gc->n + 2; w < gc->r; ++w) {
+        const lit f0 = x.fanin[2 * w], f1 = x.fanin[2 * w + 1];
+
+        if (x.kind[w] == NODE_NONE)
+            continue;
+        if (choice[w] >= 0) {
+            const cut *c = &x.cuts[w * CUTS + choice[w]];
+            lit leaves[CUT_LEAVES];
+
+            /* Missing leaves are don't-cares */
+            for (int i = 0; i < CUT_LEAVES; ++i)
+                leaves[i] = i < c->nleaves ? lits[c->leaves[i]] : LIT(gc->n, 0);
+            if (build_recipe(&o, &recipes[c->tt], leaves, &lits[w]) == GARBLE_ERR)
+                goto cleanup;
+        } else if (fold(&o, x.kind[w] == NODE_AND ? GARBLE_GATE_AND
+                                                  : GARBLE_GATE_XOR,
+                        lits[WIRE(f0)] ^ NEG(f0), lits[WIRE(f1)] ^ NEG(f1),
+                        &lits[w]) == GARBLE_ERR) {
+            goto cleanup;
+        }
+    }
+    for (size_t i = 0; i < gc->m; ++i) {
+        const lit l = x.alias[gc->outputs[i]];
+        if (materialize(&o, lits[WIRE(l)] ^ NEG(l), &outputs[i]) == GARBLE_ERR)
+            goto cleanup;
+    }
+
+    tmp = *gc;
+    tmp.gates = NULL;
+    tmp.mapping = NULL;
+    if ((tmp.outputs = malloc((gc->m ? gc->m : 1) * sizeof(int))) == NULL
+        || sweep(&o, &tmp, outputs) == GARBLE_ERR)
+        goto cleanup;
+    if (nonfree(&tmp) < nonfree(gc)) {
+        free_gates(gc);
+        gc->gates = tmp.gates;
+        memcpy(gc->outputs, tmp.outputs, gc->m * sizeof(int));
+        gc->q = tmp.q;
+        gc->nxors = tmp.nxors;
+        gc->r = tmp.r;
+        tmp.gates = NULL;
+        *improved = true;
+    }
+    res = GARBLE_OK;
+
+cleanup:
+    free(tmp.gates);
+    free(tmp.outputs);
+    optimizer_delete(&o);
+    xag_delete(&x);
+    free(lits);
+    free(choice);
+    free(outputs);
+    return res;
+}
+
+int
+builder_minimize_ands(garble_circuit *gc, builder_and_stats *stats)
+{
+    recipe recipes[256];
+    bool improved = true;
+
+    if (gc == NULL || gc->table != NULL || gc->wires != NULL)
+        return GARBLE_ERR;
+    if (stats) {
+        stats->ands_before = nonfree(gc);
+        stats->table_before = nonfree(gc) * garble_table_size(gc);
+    }
+    if (builder_optimize(gc) == GARBLE_ERR)
+        return GARBLE_ERR;
+    recipes_init(recipes);
+    for (int round = 0; improved && round < BUILDER_MINIMIZE_ROUNDS; ++round) {
+        if (minimize_round(gc, recipes, &improved) == GARBLE_ERR)
+            return GARBLE_ERR;
+    }
+    if (stats) {
+        stats->ands_after = nonfree(gc);
+        stats->table_after = nonfree(gc) * garble_table_size(gc);
+    }
+    return GARBLE_OK;
+}
+
+/*
+ * Depth rebalancing
+ */
+
+/* Longest path through the circuit, counting every gate or only the non-free
+ * ones */
+static size_t
+critical_path(const garble_circuit *gc, bool nonfree_only)
+{
+    size_t *depth = calloc(gc->r, sizeof(size_t)), max = 0;
+
+    if (depth == NULL)
+        return 0;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        size_t d = depth[g->input0] > depth[g->input1]
+            ? depth[g->input0] : depth[g->input1];
+        d += !nonfree_only || !garble_gate_is_free(g->type);
+        depth[g->output] = d;
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        if (depth[gc->outputs[i]] > max)
+            max = depth[gc->outputs[i]];
+    free(depth);
+    return max;
+}
+
+typedef struct {
+    size_t depth;
+    size_t wire;
+} operand;
+
+static int
+operand_cmp(const void *a, const void *b)
+{
+    const operand *x = a, *y = b;
+
+    if (x->depth != y->depth)
+        return x->depth < y->depth ? -1 : 1;
+    return x->wire < y->wire ? -1 : x->wire > y->wire;
+}
+
+static inline bool
+associative(garble_gate_type_e type)
+{
+    return type == GARBLE_GATE_AND || type == GARBLE_GATE_OR
+        || type == GARBLE_GATE_XOR;
+}
+
+/* Emits the tree of 'type' gates over 'ops', sorted by depth, combining the
+ * two shallowest operands first.  Combined operands come out in increasing
+ * depth, so a queue of them merged with 'ops' replaces a heap. */
+static int
+emit_tree(optimizer *o, garble_gate_type_e type, operand *ops, size_t nops,
+          operand *queue, size_t *depth, size_t *out)
+{
+    size_t i = 0, head = 0, tail = 0;
+
+    for (size_t k = 1; k < nops; ++k) {
+        operand pair[2];
+        size_t w;
+
+        for (int j = 0; j < 2; ++j) {
+            if (head == tail || (i < nops && ops[i].depth <= queue[head].depth))
+                pair[j] = ops[i++];
+            else
+                pair[j] = queue[head++];
+        }
+        if (emit(o, type, pair[0].wire, pair[1].wire, &w) == GARBLE_ERR)
+            return GARBLE_ERR;
+        depth[w] = (pair[0].depth > pair[1].depth
+                    ? pair[0].depth : pair[1].depth) + 1;
+        queue[tail++] = (operand) { depth[w], w };
+    }
+    *out = head < tail ? queue[head].wire : ops[0].wire;
+    return GARBLE_OK;
+}
+
+int
+builder_balance(garble_circuit *gc, builder_depth_stats *stats)
+{
+    optimizer o;
+    size_t *refs = NULL, *consumer = NULL, *map = NULL, *depth = NULL,
+        *stack = NULL, *outputs = NULL;
+    operand *ops = NULL, *queue = NULL;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL || gc->table != NULL || gc->wires != NULL)
+        return GARBLE_ERR;
+    if (stats) {
+        stats->depth_before = critical_path(gc, false);
+        stats->and_depth_before = critical_path(gc, true);
+    }
+    if (builder_optimize(gc) == GARBLE_ERR)
+        return GARBLE_ERR;
+
+    memset(&o, '\0', sizeof o);
+    refs = calloc(gc->r, sizeof(size_t));
+    consumer = calloc(gc->r, sizeof(size_t));
+    map = malloc(gc->r * sizeof(size_t));
+    depth = calloc(gc->r, sizeof(size_t));
+    stack = malloc(gc->r * sizeof(size_t));
+    outputs = malloc((gc->m ? gc->m : 1) * sizeof(size_t));
+    ops = malloc(gc->r * sizeof(operand));
+    queue = malloc(gc->r * sizeof(operand));
+    if (!refs || !consumer || !map || !depth || !stack || !outputs || !ops
+        || !queue || optimizer_new(&o, gc) == GARBLE_ERR)
+        goto cleanup;
+
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        refs[g->input0]++;
+        consumer[g->input0] = i;
+        if (g->input1 != g->input0) {
+            refs[g->input1]++;
+            consumer[g->input1] = i;
+        }
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        refs[gc->outputs[i]] += 2;
+
+    for (size_t w = 0; w < gc->n + 2; ++w)
+        map[w] = w;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        size_t nops = 0, top = 0;
+
+        if (!associative(g->type)) {
+            if (emit(&o, g->type, map[g->input0], map[g->input1],
+                     &map[g->output]) == GARBLE_ERR)
+                goto cleanup;
+            depth[map[g->output]] = (depth[map[g->input0]] > depth[map[g->input1]]
+                                     ? depth[map[g->input0]]
+                                     : depth[map[g->input1]]) + 1;
+            continue;
+        }
+        /* Inner gates of a chain are emitted with its root */
+        if (refs[g->output] == 1
+            && gc->gates[consumer[g->output]].type == g->type)
+            continue;
+        stack[top++] = i;
+        while (top > 0) {
+            const garble_gate *h = &gc->gates[stack[--top]];
+            const size_t in[2] = { h->input0, h->input1 };
+            for (int k = 0; k < 2; ++k) {
+                const size_t w = in[k];
+                if (w >= gc->n + 2 && refs[w] == 1
+                    && gc->gates[w - gc->n - 2].type == g->type) {
+                    stack[top++] = w - gc->n - 2;
+                } else {
+                    ops[nops].wire = map[w];
+                    ops[nops++].depth = depth[map[w]];
+                }
+            }
+        }
+        qsort(ops, nops, sizeof(operand), operand_cmp);
+        if (emit_tree(&o, g->type, ops, nops, queue, depth,
+                      &map[g->output]) == GARBLE_ERR)
+            goto cleanup;
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        outputs[i] = map[gc->outputs[i]];
+    res = sweep(&o, gc, outputs);
+    if (res == GARBLE_OK && stats) {
+        stats->depth_after = critical_path(gc, false);
+        stats->and_depth_after = critical_path(gc, true);
+    }
+
+cleanup:
+    optimizer_delete(&o);
+    free(refs);
+    free(consumer);
+    free(map);
+    free(depth);
+    free(stack);
+    free(outputs);
+    free(ops);
+    free(queue);
+    return res;
+}
+
+/*
+ * Locality
+ */
+
+/* Fenwick tree over access times */
+static void
+fenwick_add(int32_t *tree, size_t size, size_t i, int32_t v)
+{
+    for (++i; i <= size; i += i & -i)
+        tree[i - 1] += v;
+}
+
+static int64_t
+fenwick_sum(const int32_t *tree, size_t i)
+{
+    int64_t sum = 0;
+
+    for (; i > 0; i -= i & -i)
+        sum += tree[i - 1];
+    return sum;
+}
+
+static int
+reuse_histogram(const garble_gate *gates, size_t q, size_t r,
+                size_t wires_per_line, size_t hist[BUILDER_REUSE_BINS])
+{
+    const size_t naccesses = 3 * q;
+    const size_t nlines = r / (wires_per_line ? wires_per_line : 1) + 1;
+    size_t *last = NULL;
+    int32_t *tree = NULL;
+    size_t t = 0;
+    int res = GARBLE_ERR;
+
+    if (wires_per_line == 0)
+        return GARBLE_ERR;
+    memset(hist, '\0', BUILDER_REUSE_BINS * sizeof(size_t));
+    last = malloc(nlines * sizeof(size_t));
+    tree = calloc(naccesses ? naccesses : 1, sizeof(int32_t));
+    if (last == NULL || tree == NULL)
+        goto cleanup;
+    for (size_t l = 0; l < nlines; ++l)
+        last[l] = SIZE_MAX;
+
+    for (size_t i = 0; i < q; ++i) {
+        const garble_gate *g = &gates[i];
+        const size_t wires[3] = { g->input0, g->input1, g->output };
+
+        for (int j = 0; j < 3; ++j, ++t) {
+            size_t line;
+
+            if (wires[j] >= r)
+                goto cleanup;
+            line = wires[j] / wires_per_line;
+            if (last[line] != SIZE_MAX) {
+                /* Distinct lines touched since the last access of this one */
+                const size_t d = (size_t) (fenwick_sum(tree, t)
+                                           - fenwick_sum(tree, last[line] + 1));
+                size_t bin = 0;
+                while (bin < BUILDER_REUSE_BINS - 1 && ((size_t) 1 << bin) <= d)
+                    ++bin;
+                hist[bin]++;
+                fenwick_add(tree, naccesses, last[line], -1);
+            }
+            fenwick_add(tree, naccesses, t, 1);
+            last[line] = t;
+        }
+    }
+    res = GARBLE_OK;
+
+cleanup:
+    free(last);
+    free(tree);
+    return res;
+}
+
+/* Sum of the logarithms of the reuse distances in 64-byte lines of
+ * evaluator labels */
+static int
+reuse_cost(const garble_gate *gates, size_t q, size_t r, size_t *cost)
+{
+    size_t hist[BUILDER_REUSE_BINS];
+
+    if (reuse_histogram(gates, q, r, 64 / sizeof(block), hist) == GARBLE_ERR)
+        return GARBLE_ERR;
+    *cost = 0;
+    for (size_t k = 1; k < BUILDER_REUSE_BINS; ++k)
+        *cost += k * hist[k];
+    return GARBLE_OK;
+}
+
+int
+builder_localize(garble_circuit *gc)
+{
+    const size_t base = gc ? gc->n + 2 : 0;
+    size_t *start = NULL, *consumers = NULL, *pending = NULL, *stack = NULL,
+        *order = NULL, *map = NULL;
+    garble_gate *gates = NULL;
+    size_t top = 0, k = 0;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL || gc->table != NULL || gc->wires != NULL)
+        return GARBLE_ERR;
+    start = calloc(gc->r + 1, sizeof(size_t));
+    consumers = malloc(2 * (gc->q ? gc->q : 1) * sizeof(size_t));
+    pending = calloc(gc->q ? gc->q : 1, sizeof(size_t));
+    stack = malloc((gc->q ? gc->q : 1) * sizeof(size_t));
+    order = malloc((gc->q ? gc->q : 1) * sizeof(size_t));
+    map = malloc(gc->r * sizeof(size_t));
+    gates = malloc((gc->q ? gc->q : 1) * sizeof(garble_gate));
+    if (!start || !consumers || !pending || !stack || !order || !map
+        || !gates)
+        goto cleanup;
+
+    /* Consumers of every wire, and the inputs each gate waits on */
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        if (g->input0 >= gc->r || g->input1 >= gc->r || g->output < base
+            || g->output >= gc->r)
+            goto cleanup;
+        start[g->input0 + 1]++;
+        if (g->input1 != g->input0)
+            start[g->input1 + 1]++;
+    }
+    for (size_t w = 0; w < gc->r; ++w)
+        start[w + 1] += start[w];
+    memcpy(map, start, gc->r * sizeof(size_t));
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        consumers[map[g->input0]++] = i;
+        pending[i] += g->input0 >= base;
+        if (g->input1 != g->input0) {
+            consumers[map[g->input1]++] = i;
+            pending[i] += g->input1 >= base;
+        }
+    }
+
+    /* Run a gate as soon as the last of its inputs is computed, so the
+     * labels it reads are still hot */
+    for (size_t i = gc->q; i-- > 0;)
+        if (pending[i] == 0)
+            stack[top++] = i;
+    while (top > 0) {
+        const size_t j = stack[--top], w = gc->gates[j].output;
+
+        order[k++] = j;
+        for (size_t c = start[w + 1]; c-- > start[w];)
+            if (--pending[consumers[c]] == 0)
+                stack[top++] = consumers[c];
+    }
+    /* Some gate reads a wire no gate computes, or a wire computed twice */
+    if (k != gc->q)
+        goto cleanup;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t cost, cost0;
+
+        for (size_t w = 0; w < gc->r; ++w)
+            map[w] = w < base ? w : SIZE_MAX;
+        for (k = 0; k < gc->q; ++k) {
+            garble_gate g = gc->gates[order[k]];
+            if (map[g.output] != SIZE_MAX || map[g.input0] == SIZE_MAX
+                || map[g.input1] == SIZE_MAX)
+                goto cleanup;
+            g.input0 = map[g.input0];
+            g.input1 = map[g.input1];
+            g.output = map[g.output] = base + k;
+            gates[k] = g;
+        }
+        if (pass == 1)
+            break;
+        /* Circuits built in a good order already, as the AES circuit is,
+         * keep it and only have their wires renumbered */
+        if (reuse_cost(gates, gc->q, base + gc->q, &cost) == GARBLE_ERR
+            || reuse_cost(gc->gates, gc->q, gc->r, &cost0) == GARBLE_ERR)
+            goto cleanup;
+        if (cost < cost0)
+            break;
+        for (k = 0; k < gc->q; ++k)
+            order[k] = k;
+    }
+    for (size_t i = 0; i < gc->m; ++i) {
+        if ((size_t) gc->outputs[i] >= gc->r
+            || map[gc->outputs[i]] == SIZE_MAX)
+            goto cleanup;
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        gc->outputs[i] = map[gc->outputs[i]];
+    free_gates(gc);
+    gc->gates = gates;
+    gc->r = base + gc->q;
+    gates = NULL;
+    res = GARBLE_OK;
+
+cleanup:
+    free(start);
+    free(consumers);
+    free(pending);
+    free(stack);
+    free(order);
+    free(map);
+    free(gates);
+    return res;
+}
+
+int
+builder_reuse_histogram(const garble_circuit *gc, size_t wires_per_line,
+                        size_t hist[BUILDER_REUSE_BINS])
+{
+    if (gc == NULL)
+        return GARBLE_ERR;
+    return reuse_histogram(gc->gates, gc->q, gc->r, wires_per_line, hist);
+}
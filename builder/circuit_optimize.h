@@ -0,0 +1,67 @@
+#ifndef LIBGARBLEC_CIRCUIT_OPTIMIZE_H
+#define LIBGARBLEC_CIRCUIT_OPTIMIZE_H
+
+#include "garble.h"
+
+/* Rewrites the gates of the (not yet garbled) circuit 'gc' in place:
+   constants are folded through the fixed zero/one wires, NOT gates are
+   pushed into XORs where possible, structurally identical gates are merged,
+   and gates outside the cone of every output are removed.  Wires are
+   renumbered densely and 'q', 'r' and 'nxors' recomputed; inputs, the fixed
+   wires and the function computed on the outputs are unchanged, and no path
+   gets longer. */
+int
+builder_optimize(garble_circuit *gc);
+
+/* Upper bound on the rewriting rounds of builder_minimize_ands */
+#define BUILDER_MINIMIZE_ROUNDS 4
+
+typedef struct {
+    size_t ands_before, ands_after;     /* non-free gates */
+    size_t table_before, table_after;   /* garbled table bytes */
+} builder_and_stats;
+
+/* Runs builder_optimize on 'gc' and then rewrites it to use fewer non-free
+   gates: every AND gate is matched against the functions of its cuts of up
+   to three wires, and a cut whose minimum-AND implementation needs fewer AND
+   gates than the logic it replaces is rebuilt from that implementation.
+   Rounds are repeated while they save gates.  'stats', if not NULL, receives
+   the counts before and after. */
+int
+builder_minimize_ands(garble_circuit *gc, builder_and_stats *stats);
+
+typedef struct {
+    size_t depth_before, depth_after;         /* longest path, in gates */
+    size_t and_depth_before, and_depth_after; /* in non-free gates */
+} builder_depth_stats;
+
+/* Runs builder_optimize on 'gc' and then rebuilds every chain of AND, OR or
+   XOR gates, whose inner gates have no other use, as a tree of the same
+   number of gates and minimal depth given when its operands become
+   available.  Neither the number of non-free gates nor the critical path
+   grows over that of the circuit passed in.  'stats', if not NULL, receives
+   the critical path before and after. */
+int
+builder_balance(garble_circuit *gc, builder_depth_stats *stats);
+
+/* Reorders the gates of 'gc', each gate run as soon as its inputs are
+   computed, if that lowers the reuse distances of the label accesses (see
+   builder_reuse_histogram), and renumbers the wires in gate order so that
+   labels live at the same time sit close together.  The gates themselves,
+   and so the function and every count, are unchanged. */
+int
+builder_localize(garble_circuit *gc);
+
+#define BUILDER_REUSE_BINS 32
+
+/* Reuse-distance histogram of the label accesses (two reads and a write per
+   gate) made when evaluating 'gc', the labels grouped 'wires_per_line' to a
+   cache line.  The distance of an access is the number of distinct lines
+   touched since the previous access to its line; 'hist[0]' counts distance
+   zero and 'hist[k]' distances in [2^(k-1), 2^k), the last bin everything
+   beyond.  First accesses are not counted. */
+int
+builder_reuse_histogram(const garble_circuit *gc, size_t wires_per_line,
+                        size_t hist[BUILDER_REUSE_BINS]);
+
+#endif
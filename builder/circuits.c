@@ -25,7 +25,7 @@ void
 circuit_or(garble_circuit *gc, garble_context *ctxt, uint64_t n,
            const int *inputs, int *outputs)
 {
-    assert(n == 2);
+    assert(n >= 2);
 
     int a = builder_next_wire(ctxt);
     gate_NOT(gc, ctxt, inputs[0], a);
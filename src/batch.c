@@ -0,0 +1,243 @@
+/*
+ * Batched garbling and evaluation of many small independent circuits.
+ *
+ * Instances are handed out to worker threads in groups of BATCH_GRAIN through
+ * a shared atomic index.  All per-instance arrays live in one pool allocated
+ * by garble_batch_new, and each evaluation thread reuses a single label buffer
+ * sized for the largest instance, so the steady state allocates nothing.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Instances claimed per atomic update */
+#define BATCH_GRAIN 16
+
+/* Round 'size' bytes up to a whole number of blocks */
+static size_t
+block_align(size_t size)
+{
+    return (size + sizeof(block) - 1) / sizeof(block) * sizeof(block);
+}
+
+int
+garble_batch_new(garble_batch *batch, garble_circuit *gcs, size_t count)
+{
+    size_t size = 0;
+    char *p;
+
+    if (batch == NULL || (gcs == NULL && count > 0))
+        return GARBLE_ERR;
+
+    memset(batch, '\0', sizeof(garble_batch));
+    batch->gcs = gcs;
+    batch->count = count;
+    for (size_t i = 0; i < count; ++i) {
+        const garble_circuit *gc = &gcs[i];
+        if (gc->r > batch->max_r)
+            batch->max_r = gc->r;
+        if (gc->wires == NULL)
+            size += 2 * gc->r * sizeof(block);
+        if (gc->table == NULL)
+            size += (gc->q - gc->nxors) * garble_table_size(gc);
+        if (gc->output_perms == NULL)
+            size += block_align(gc->m * sizeof(bool));
+    }
+    if (size == 0)
+        return GARBLE_OK;
+    if ((batch->pool = garble_allocate_blocks(size / sizeof(block))) == NULL)
+        return GARBLE_ERR;
+    batch->pool_size = size;
+
+    p = batch->pool;
+    for (size_t i = 0; i < count; ++i) {
+        garble_circuit *gc = &gcs[i];
+        if (gc->wires == NULL) {
+            gc->wires = (block *) p;
+            p += 2 * gc->r * sizeof(block);
+        }
+        if (gc->table == NULL) {
+            gc->table = (block *) p;
+            p += (gc->q - gc->nxors) * garble_table_size(gc);
+        }
+        if (gc->output_perms == NULL) {
+            gc->output_perms = (bool *) p;
+            p += block_align(gc->m * sizeof(bool));
+        }
+    }
+    return GARBLE_OK;
+}
+
+static bool
+in_pool(const garble_batch *batch, const void *p)
+{
+    const char *start = batch->pool;
+    return p != NULL && start != NULL && (const char *) p >= start
+        && (const char *) p < start + batch->pool_size;
+}
+
+void
+garble_batch_delete(garble_batch *batch)
+{
+    if (batch == NULL)
+        return;
+    for (size_t i = 0; i < batch->count; ++i) {
+        garble_circuit *gc = &batch->gcs[i];
+        if (in_pool(batch, gc->wires))
+            gc->wires = NULL;
+        if (in_pool(batch, gc->table))
+            gc->table = NULL;
+        if (in_pool(batch, gc->output_perms))
+            gc->output_perms = NULL;
+    }
+    free(batch->pool);
+    memset(batch, '\0', sizeof(garble_batch));
+}
+
+typedef struct {
+    const garble_batch *batch;
+    const block *const *input_labels;
+    block *const *output_labels;
+    bool *const *outputs;
+    _Alignas(64) _Atomic size_t next;
+    _Atomic int failed;
+} batch_job;
+
+typedef int (*batch_fn)(batch_job *job, size_t i, block *scratch);
+
+typedef struct {
+    batch_job *job;
+    batch_fn fn;
+    bool scratch;
+} batch_worker;
+
+static void *
+batch_loop(void *arg)
+{
+    batch_worker *w = arg;
+    batch_job *job = w->job;
+    block *scratch = NULL;
+    size_t i;
+
+    if (w->scratch && job->batch->max_r > 0) {
+        if ((scratch = garble_allocate_blocks(job->batch->max_r)) == NULL) {
+            atomic_store(&job->failed, 1);
+            return NULL;
+        }
+    }
+    while ((i = atomic_fetch_add_explicit(&job->next, BATCH_GRAIN,
+                                          memory_order_relaxed))
+           < job->batch->count) {
+        const size_t end = i + BATCH_GRAIN < job->batch->count
+            ? i + BATCH_GRAIN : job->batch->count;
+        for (; i < end; ++i) {
+            if (w->fn(job, i, scratch) == GARBLE_ERR)
+                atomic_store(&job->failed, 1);
+        }
+    }
+    free(scratch);
+    return NULL;
+}
+
+/* Run 'fn' over every instance of the batch on 'nthreads' threads, the
+ * calling thread included */
+static int
+batch_run(batch_job *job, batch_fn fn, bool scratch, size_t nthreads)
+{
+    pthread_t *threads;
+    batch_worker w = { job, fn, scratch };
+    size_t nstarted;
+
+    atomic_init(&job->next, 0);
+    atomic_init(&job->failed, 0);
+    if (nthreads == 0)
+        nthreads = 1;
+    if (nthreads > (job->batch->count + BATCH_GRAIN - 1) / BATCH_GRAIN)
+        nthreads = (job->batch->count + BATCH_GRAIN - 1) / BATCH_GRAIN;
+    if (nthreads <= 1) {
+        (void) batch_loop(&w);
+        return atomic_load(&job->failed) ? GARBLE_ERR : GARBLE_OK;
+    }
+
+    if ((threads = calloc(nthreads, sizeof(pthread_t))) == NULL)
+        return GARBLE_ERR;
+    /* If thread creation fails, the started threads and the caller pick up
+     * the remaining instances */
+    for (nstarted = 1; nstarted < nthreads; ++nstarted) {
+        if (pthread_create(&threads[nstarted], NULL, batch_loop, &w) != 0)
+            break;
+    }
+    (void) batch_loop(&w);
+    for (size_t t = 1; t < nstarted; ++t)
+        (void) pthread_join(threads[t], NULL);
+    free(threads);
+    return atomic_load(&job->failed) ? GARBLE_ERR : GARBLE_OK;
+}
+
+static int
+garble_one(batch_job *job, size_t i, block *scratch)
+{
+    garble_circuit *gc = &job->batch->gcs[i];
+    AES_KEY key;
+    block delta;
+
+    (void) scratch;
+    if (_garble_init(gc, job->input_labels ? job->input_labels[i] : NULL,
+                     &key, &delta, true) == GARBLE_ERR)
+        return GARBLE_ERR;
+    _garble_gates(gc, &key, delta, 0, gc->q, gc->table);
+    _garble_finish(gc, job->output_labels ? job->output_labels[i] : NULL);
+    return GARBLE_OK;
+}
+
+int
+garble_batch_garble(garble_batch *batch, const block *const *input_labels,
+                    block *const *output_labels, size_t nthreads)
+{
+    batch_job job;
+
+    if (batch == NULL)
+        return GARBLE_ERR;
+    memset(&job, '\0', sizeof job);
+    job.batch = batch;
+    job.input_labels = input_labels;
+    job.output_labels = output_labels;
+    return batch_run(&job, garble_one, false, nthreads);
+}
+
+static int
+eval_one(batch_job *job, size_t i, block *labels)
+{
+    const garble_circuit *gc = &job->batch->gcs[i];
+    AES_KEY key;
+
+    if (gc->table == NULL && gc->q > gc->nxors)
+        return GARBLE_ERR;
+    _eval_init(gc, job->input_labels[i], labels, &key);
+    _eval_gates(gc, labels, &key, 0, gc->q, gc->table);
+    _eval_finish(gc, labels, job->output_labels ? job->output_labels[i] : NULL,
+                 job->outputs ? job->outputs[i] : NULL);
+    return GARBLE_OK;
+}
+
+int
+garble_batch_eval(const garble_batch *batch, const block *const *input_labels,
+                  block *const *output_labels, bool *const *outputs,
+                  size_t nthreads)
+{
+    batch_job job;
+
+    if (batch == NULL || (input_labels == NULL && batch->count > 0))
+        return GARBLE_ERR;
+    memset(&job, '\0', sizeof job);
+    job.batch = batch;
+    job.input_labels = input_labels;
+    job.output_labels = output_labels;
+    job.outputs = outputs;
+    return batch_run(&job, eval_one, true, nthreads);
+}
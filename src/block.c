@@ -1,19 +1,22 @@
 #include "garble/block.h"
 #include "garble/aes.h"
+#include "garble_internal.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 #include <openssl/rand.h>
 
 static AES_KEY rand_aes_key;
-static uint64_t current_rand_index;
+/* Atomic so that independent circuits can be garbled concurrently */
+static _Atomic uint64_t current_rand_index;
 
 block
 garble_seed(block *seed)
 {
     block cur_seed;
-    current_rand_index = 0;
+    atomic_store(&current_rand_index, 0);
     if (seed) {
         cur_seed = *seed;
     } else {
@@ -30,16 +33,39 @@ inline block
 garble_random_block(void)
 {
     block out;
-    uint64_t *val;
-    int i;
-
-    out = garble_zero_block();
-    val = (uint64_t *) &out;
-    val[0] = current_rand_index++;
-    out = _mm_xor_si128(out, rand_aes_key.rd_key[0]);
-    for (i = 1; i < 10; ++i)
-        out = _mm_aesenc_si128(out, rand_aes_key.rd_key[i]);
-    return _mm_aesenclast_si128(out, rand_aes_key.rd_key[i]);
+
+    _garble_random_fill(&out, 1, 1, _garble_random_reserve(1));
+    return out;
+}
+
+void
+garble_random_blocks(block *blocks, size_t nblocks)
+{
+    _garble_random_fill(blocks, nblocks, 1, _garble_random_reserve(nblocks));
+}
+
+uint64_t
+_garble_random_reserve(size_t nblocks)
+{
+    return atomic_fetch_add_explicit(&current_rand_index, nblocks,
+                                     memory_order_relaxed);
+}
+
+void
+_garble_random_fill(block *blocks, size_t nblocks, size_t stride,
+                    uint64_t index)
+{
+    block tmp[8];
+
+    /* Encrypt eight counters at a time to keep the AES pipeline full */
+    for (size_t i = 0; i < nblocks; i += 8) {
+        const size_t n = nblocks - i < 8 ? nblocks - i : 8;
+        for (size_t j = 0; j < n; ++j)
+            tmp[j] = _mm_set_epi64x(0, index + i + j);
+        AES_ecb_encrypt_blks(tmp, n, &rand_aes_key);
+        for (size_t j = 0; j < n; ++j)
+            blocks[(i + j) * stride] = tmp[j];
+    }
 }
 
 block *
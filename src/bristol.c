@@ -0,0 +1,228 @@
+/*
+ * Bristol Fashion netlist importer.
+ *
+ * The file is parsed in a single pass through a fixed-size read buffer, and
+ * each gate line is written straight into the preallocated gate array, so
+ * memory is bounded by the circuit itself.  Bristol wires 0 .. n-1 are the
+ * inputs, as in libgarble; the remaining wires are shifted up by two to make
+ * room for the fixed zero and one wires.  INV becomes a NOT gate, EQ and EQW
+ * become free XOR gates against the fixed wires, and MAND is split into
+ * AND gates.
+ */
+
+#include "garble.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define BRISTOL_BUFFER (1 << 20)
+#define BRISTOL_WORD 8
+
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t pos, len;
+} reader;
+
+static int
+refill(reader *rd)
+{
+    rd->len = fread(rd->buf, sizeof(char), BRISTOL_BUFFER, rd->f);
+    rd->pos = 0;
+    return rd->len ? (unsigned char) rd->buf[rd->pos++] : EOF;
+}
+
+static inline int
+next_char(reader *rd)
+{
+    if (rd->pos < rd->len)
+        return (unsigned char) rd->buf[rd->pos++];
+    return refill(rd);
+}
+
+static inline int
+skip_space(reader *rd)
+{
+    int c;
+    do {
+        c = next_char(rd);
+    } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    return c;
+}
+
+static inline int
+get_uint(reader *rd, uint64_t *x)
+{
+    int c = skip_space(rd);
+    uint64_t v = 0;
+
+    if (c < '0' || c > '9')
+        return GARBLE_ERR;
+    do {
+        v = 10 * v + (c - '0');
+        c = next_char(rd);
+    } while (c >= '0' && c <= '9');
+    /* The character after a number is always whitespace, so it is consumed */
+    *x = v;
+    return GARBLE_OK;
+}
+
+static int
+get_word(reader *rd, char word[BRISTOL_WORD])
+{
+    int c = skip_space(rd);
+    size_t len = 0;
+
+    while (c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+        if (len == BRISTOL_WORD - 1)
+            return GARBLE_ERR;
+        word[len++] = c;
+        c = next_char(rd);
+    }
+    word[len] = '\0';
+    return len ? GARBLE_OK : GARBLE_ERR;
+}
+
+/* Sum of a line "<count> <size_1> ... <size_count>" */
+static int
+get_sizes(reader *rd, uint64_t *total)
+{
+    uint64_t count, size;
+
+    *total = 0;
+    if (get_uint(rd, &count))
+        return GARBLE_ERR;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (get_uint(rd, &size))
+            return GARBLE_ERR;
+        *total += size;
+    }
+    return GARBLE_OK;
+}
+
+static inline garble_gate *
+add_gate(garble_circuit *gc, size_t *cap)
+{
+    if (gc->q == *cap) {
+        garble_gate *gates = realloc(gc->gates, 2 * *cap * sizeof(garble_gate));
+        if (gates == NULL)
+            return NULL;
+        gc->gates = gates;
+        *cap *= 2;
+    }
+    return &gc->gates[gc->q++];
+}
+
+int
+garble_load_bristol(garble_circuit *gc, FILE *f, garble_type_e type)
+{
+    reader rd = { f, NULL, 0, 0 };
+    uint64_t ngates, nwires, n, m, wires[4];
+    uint64_t *mwires = NULL;
+    size_t cap, mcap = 0;
+    char word[BRISTOL_WORD];
+
+    if (gc == NULL || f == NULL)
+        return GARBLE_ERR;
+    memset(gc, '\0', sizeof(garble_circuit));
+    if ((rd.buf = malloc(BRISTOL_BUFFER)) == NULL)
+        return GARBLE_ERR;
+    if (get_uint(&rd, &ngates) || get_uint(&rd, &nwires)
+        || get_sizes(&rd, &n) || get_sizes(&rd, &m) || n + m > nwires
+        || n > INT_MAX || nwires > INT_MAX - 2)
+        goto error;
+
+    gc->n = n;
+    gc->m = m;
+    gc->r = nwires + 2;
+    gc->type = type;
+    cap = ngates ? ngates : 1;
+    gc->gates = malloc(cap * sizeof(garble_gate));
+    gc->outputs = malloc((m ? m : 1) * sizeof(int));
+    if (gc->gates == NULL || gc->outputs == NULL)
+        goto error;
+
+#define WIRE(w) ((w) < n ? (w) : (w) + 2)
+
+    for (uint64_t i = 0; i < ngates; ++i) {
+        uint64_t nin, nout;
+        garble_gate *g;
+
+        if (get_uint(&rd, &nin) || get_uint(&rd, &nout))
+            goto error;
+        if (nin <= 2 && nout == 1) {
+            for (uint64_t j = 0; j < nin + nout; ++j) {
+                if (get_uint(&rd, &wires[j]))
+                    goto error;
+            }
+            if (get_word(&rd, word) || (g = add_gate(gc, &cap)) == NULL)
+                goto error;
+            if (strcmp(word, "EQ") == 0 && nin == 1 && wires[0] <= 1) {
+                /* Constant: zero ^ zero or one ^ zero */
+                g->type = GARBLE_GATE_XOR;
+                g->input0 = gc->n + wires[0];
+                g->input1 = gc->n;
+            } else if (wires[0] >= nwires || (nin == 2 && wires[1] >= nwires)) {
+                goto error;
+            } else if (strcmp(word, "XOR") == 0 && nin == 2) {
+                g->type = GARBLE_GATE_XOR;
+                g->input0 = WIRE(wires[0]);
+                g->input1 = WIRE(wires[1]);
+            } else if (strcmp(word, "AND") == 0 && nin == 2) {
+                g->type = GARBLE_GATE_AND;
+                g->input0 = WIRE(wires[0]);
+                g->input1 = WIRE(wires[1]);
+            } else if (strcmp(word, "INV") == 0 && nin == 1) {
+                g->type = GARBLE_GATE_NOT;
+                g->input0 = g->input1 = WIRE(wires[0]);
+            } else if (strcmp(word, "EQW") == 0 && nin == 1) {
+                g->type = GARBLE_GATE_XOR;
+                g->input0 = WIRE(wires[0]);
+                g->input1 = gc->n;
+            } else {
+                goto error;
+            }
+            if (wires[nin] >= nwires)
+                goto error;
+            g->output = WIRE(wires[nin]);
+            gc->nxors += garble_gate_is_free(g->type) ? 1 : 0;
+        } else {
+            /* MAND: 2k inputs, k outputs, k AND gates */
+            if (nin != 2 * nout)
+                goto error;
+            if (nin + nout > mcap) {
+                free(mwires);
+                mcap = nin + nout;
+                if ((mwires = malloc(mcap * sizeof(uint64_t))) == NULL)
+                    goto error;
+            }
+            for (uint64_t j = 0; j < nin + nout; ++j) {
+                if (get_uint(&rd, &mwires[j]) || mwires[j] >= nwires)
+                    goto error;
+            }
+            if (get_word(&rd, word) || strcmp(word, "MAND") != 0)
+                goto error;
+            for (uint64_t j = 0; j < nout; ++j) {
+                if ((g = add_gate(gc, &cap)) == NULL)
+                    goto error;
+                g->type = GARBLE_GATE_AND;
+                g->input0 = WIRE(mwires[j]);
+                g->input1 = WIRE(mwires[nout + j]);
+                g->output = WIRE(mwires[nin + j]);
+            }
+        }
+    }
+    /* Outputs are the last 'm' wires */
+    for (uint64_t i = 0; i < m; ++i)
+        gc->outputs[i] = WIRE(nwires - m + i);
+#undef WIRE
+
+    free(mwires);
+    free(rd.buf);
+    return GARBLE_OK;
+error:
+    free(mwires);
+    free(rd.buf);
+    garble_delete(gc);
+    return GARBLE_ERR;
+}
@@ -0,0 +1,266 @@
+/*
+ * Garbler-to-evaluator channel.
+ *
+ * A channel is a stream socket (or any other fd) carrying one garbled circuit
+ * per garble_channel_garble/garble_channel_eval pair: the fixed label and
+ * global key, then the table in garble_stream chunks, then the output
+ * permutation bits.  The garbler sends each chunk as soon as it is garbled and
+ * keeps garbling while the kernel socket buffer drains; the evaluator
+ * evaluates each gate as soon as its row arrives.  The permutation bits are
+ * only known once garbling is done, so the evaluator decodes its outputs
+ * after the table.
+ *
+ * Circuits garbled ahead of time and saved with garble_save are served
+ * straight from the file with sendfile (or splice), so bulk transfers of
+ * pre-garbled tables are never copied through user memory.
+ */
+
+#define _GNU_SOURCE
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void
+garble_channel_open(garble_channel *ch, int fd)
+{
+    ch->fd = fd;
+    ch->sent = 0;
+    ch->received = 0;
+}
+
+int
+garble_channel_pair(garble_channel *garbler, garble_channel *evaluator)
+{
+    const int size = GARBLE_CHANNEL_BUFFER;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        return GARBLE_ERR;
+    /* Best effort: the kernel may cap the buffer sizes */
+    (void) setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof size);
+    (void) setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+    garble_channel_open(garbler, fds[0]);
+    garble_channel_open(evaluator, fds[1]);
+    return GARBLE_OK;
+}
+
+void
+garble_channel_close(garble_channel *ch)
+{
+    if (ch->fd != -1)
+        (void) close(ch->fd);
+    ch->fd = -1;
+}
+
+int
+garble_channel_send(garble_channel *ch, const void *buf, size_t len)
+{
+    if (_garble_write_all(ch->fd, buf, len) == GARBLE_ERR)
+        return GARBLE_ERR;
+    ch->sent += len;
+    return GARBLE_OK;
+}
+
+ssize_t
+garble_channel_recv_some(garble_channel *ch, void *buf, size_t len)
+{
+    ssize_t res;
+
+    do {
+        res = read(ch->fd, buf, len);
+    } while (res == -1 && errno == EINTR);
+    if (res > 0)
+        ch->received += res;
+    return res;
+}
+
+int
+garble_channel_recv(garble_channel *ch, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t res = garble_channel_recv_some(ch, p, len);
+        if (res <= 0)
+            return GARBLE_ERR;
+        p += res;
+        len -= res;
+    }
+    return GARBLE_OK;
+}
+
+/* Move 'len' bytes from 'fd' to the channel through a pipe with splice */
+static int
+splice_all(garble_channel *ch, int fd, off_t offset, size_t len)
+{
+    int p[2], res = GARBLE_ERR;
+
+    if (pipe2(p, O_CLOEXEC) == -1)
+        return GARBLE_ERR;
+    while (len > 0) {
+        ssize_t in, out;
+
+        do {
+            in = splice(fd, &offset, p[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } while (in == -1 && errno == EINTR);
+        if (in <= 0)
+            goto cleanup;
+        len -= in;
+        while (in > 0) {
+            do {
+                out = splice(p[0], NULL, ch->fd, NULL, in,
+                             SPLICE_F_MOVE | (len ? SPLICE_F_MORE : 0));
+            } while (out == -1 && errno == EINTR);
+            if (out <= 0)
+                goto cleanup;
+            in -= out;
+            ch->sent += out;
+        }
+    }
+    res = GARBLE_OK;
+cleanup:
+    (void) close(p[0]);
+    (void) close(p[1]);
+    return res;
+}
+
+int
+garble_channel_sendfile(garble_channel *ch, int fd, off_t offset, size_t len)
+{
+    while (len > 0) {
+        ssize_t res = sendfile(ch->fd, fd, &offset, len);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1 && (errno == EINVAL || errno == ENOSYS))
+            return splice_all(ch, fd, offset, len);
+        if (res <= 0)
+            return GARBLE_ERR;
+        len -= res;
+        ch->sent += res;
+    }
+    return GARBLE_OK;
+}
+
+int
+garble_channel_send_saved(garble_channel *ch, int fd)
+{
+    size_t total;
+
+    if (ch == NULL || garble_saved_table(fd, NULL, NULL, &total) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return garble_channel_sendfile(ch, fd, 0, total);
+}
+
+int
+garble_channel_send_table(garble_channel *ch, int fd)
+{
+    off_t offset;
+    size_t len;
+
+    if (ch == NULL || garble_saved_table(fd, &offset, &len, NULL) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return garble_channel_sendfile(ch, fd, offset, len);
+}
+
+int
+garble_channel_recv_saved(garble_channel *ch, garble_circuit *gc,
+                          bool table_only, bool wires)
+{
+    if (ch == NULL || garble_load_fd(gc, ch->fd, table_only, wires) == GARBLE_ERR)
+        return GARBLE_ERR;
+    ch->received += sizeof(size_t) + garble_size(gc, table_only, wires);
+    return GARBLE_OK;
+}
+
+typedef struct {
+    garble_channel *ch;
+    const garble_circuit *gc;
+    bool started;
+} sender;
+
+static int
+send_header(sender *s)
+{
+    s->started = true;
+    if (garble_channel_send(s->ch, &s->gc->fixed_label, sizeof(block)) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return garble_channel_send(s->ch, &s->gc->global_key, sizeof(block));
+}
+
+static int
+send_chunk(void *arg, const void *buf, size_t len)
+{
+    sender *s = arg;
+
+    /* The fixed label and global key are set before the first chunk */
+    if (!s->started && send_header(s) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return garble_channel_send(s->ch, buf, len);
+}
+
+int
+garble_channel_garble(garble_channel *ch, garble_stream *stream,
+                      garble_circuit *gc, const block *input_labels,
+                      block *output_labels)
+{
+    sender s = { ch, gc, false };
+
+    if (ch == NULL)
+        return GARBLE_ERR;
+    if (garble_stream_garble(stream, gc, input_labels, output_labels,
+                             send_chunk, &s) == GARBLE_ERR)
+        return GARBLE_ERR;
+    if (!s.started && send_header(&s) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return garble_channel_send(ch, gc->output_perms, gc->m * sizeof(bool));
+}
+
+static ssize_t
+recv_chunk(void *arg, void *buf, size_t len)
+{
+    return garble_channel_recv_some(arg, buf, len);
+}
+
+int
+garble_channel_eval(garble_channel *ch, garble_stream *stream,
+                    garble_circuit *gc, const block *input_labels,
+                    block *output_labels, bool *outputs)
+{
+    block *labels = output_labels;
+    int res = GARBLE_ERR;
+
+    if (ch == NULL || gc == NULL)
+        return GARBLE_ERR;
+    if (gc->output_perms == NULL
+        && (gc->output_perms = calloc(gc->m, sizeof(bool))) == NULL)
+        return GARBLE_ERR;
+    if (labels == NULL && outputs != NULL
+        && (labels = garble_allocate_blocks(gc->m)) == NULL)
+        return GARBLE_ERR;
+
+    if (garble_channel_recv(ch, &gc->fixed_label, sizeof(block)) == GARBLE_ERR
+        || garble_channel_recv(ch, &gc->global_key, sizeof(block)) == GARBLE_ERR)
+        goto cleanup;
+    if (garble_stream_eval(stream, gc, input_labels, labels, NULL,
+                           recv_chunk, ch) == GARBLE_ERR)
+        goto cleanup;
+    if (garble_channel_recv(ch, gc->output_perms, gc->m * sizeof(bool)) == GARBLE_ERR)
+        goto cleanup;
+    if (outputs) {
+        for (size_t i = 0; i < gc->m; ++i)
+            outputs[i] = (*((const char *) &labels[i]) & 0x1) ^ gc->output_perms[i];
+    }
+    res = GARBLE_OK;
+
+cleanup:
+    if (labels != output_labels)
+        free(labels);
+    return res;
+}
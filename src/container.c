@@ -0,0 +1,391 @@
+/*
+ * Sectioned container format.
+ *
+ * A header and a section directory, followed by sections aligned to
+ * GARBLE_CONTAINER_ALIGN bytes: gates, outputs, output permutation bits, the
+ * table split into segments of consecutive gates, and optionally the chunk
+ * schedule of a garble_dag.  Every section carries a CRC-32C, and the header
+ * carries one over itself and the directory.  Readers open the container by
+ * reading only the header and directory, then pread(2) the sections they
+ * need, so several threads or processes can fetch table segments
+ * concurrently.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <errno.h>
+#include <nmmintrin.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CONTAINER_MAGIC "GARBLEC\0"
+
+typedef struct {
+    char magic[8];
+    uint32_t version, nsections;
+    uint64_t n, m, q, r, nxors, type;
+    block fixed_label, global_key;
+    /* CRC-32C of the header (with this field zero) and the directory */
+    uint32_t checksum;
+    uint32_t pad[3];
+} container_header;
+
+static uint32_t
+crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint64_t c = ~crc;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t x;
+        memcpy(&x, p, sizeof x);
+        c = _mm_crc32_u64(c, x);
+    }
+    for (; len > 0; ++p, --len)
+        c = _mm_crc32_u8((uint32_t) c, *p);
+    return ~(uint32_t) c;
+}
+
+static inline uint64_t
+align_up(uint64_t x)
+{
+    return (x + GARBLE_CONTAINER_ALIGN - 1)
+        & ~(uint64_t) (GARBLE_CONTAINER_ALIGN - 1);
+}
+
+/* Flatten 'dag' into u64s: q, chunk_size, nchunks, nsuccs, then rows, ndeps,
+ * succ_start and succs */
+static uint64_t *
+schedule_encode(const garble_dag *dag, size_t *size)
+{
+    const size_t nsuccs = dag->succ_start[dag->nchunks];
+    const size_t len = 4 + 3 * dag->nchunks + 1 + nsuccs;
+    uint64_t *buf = malloc(len * sizeof(uint64_t)), *p = buf;
+
+    if (buf == NULL)
+        return NULL;
+    *p++ = dag->q;
+    *p++ = dag->chunk_size;
+    *p++ = dag->nchunks;
+    *p++ = nsuccs;
+    for (size_t i = 0; i < dag->nchunks; ++i)
+        *p++ = dag->rows[i];
+    for (size_t i = 0; i < dag->nchunks; ++i)
+        *p++ = dag->ndeps[i];
+    for (size_t i = 0; i <= dag->nchunks; ++i)
+        *p++ = dag->succ_start[i];
+    for (size_t i = 0; i < nsuccs; ++i)
+        *p++ = dag->succs[i];
+    *size = len * sizeof(uint64_t);
+    return buf;
+}
+
+int
+garble_container_save(const garble_circuit *gc, const garble_dag *dag,
+                      size_t segment_gates, int fd)
+{
+    static const char zeros[GARBLE_CONTAINER_ALIGN];
+    container_header h;
+    garble_section *dir = NULL;
+    const void **data = NULL;
+    struct iovec *iov = NULL;
+    uint64_t *schedule = NULL;
+    size_t nsegments, nsections, n = 0, schedule_size = 0;
+    uint64_t off;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL || gc->q < gc->nxors || (dag && dag->q != gc->q))
+        return GARBLE_ERR;
+    if (segment_gates == 0)
+        segment_gates = dag ? dag->chunk_size : GARBLE_CONTAINER_SEGMENT;
+    nsegments = (gc->q + segment_gates - 1) / segment_gates;
+    nsections = 3 + nsegments + (dag ? 1 : 0);
+
+    dir = calloc(nsections, sizeof(garble_section));
+    data = calloc(nsections, sizeof(void *));
+    iov = calloc(2 + 2 * nsections, sizeof(struct iovec));
+    if (dir == NULL || data == NULL || iov == NULL)
+        goto cleanup;
+    if (dag && (schedule = schedule_encode(dag, &schedule_size)) == NULL)
+        goto cleanup;
+
+#define SECTION(k, ptr, len, s, e)                                      \
+    do {                                                                \
+        dir[n].kind = (k);                                              \
+        dir[n].size = (len);                                            \
+        dir[n].start = (s);                                             \
+        dir[n].end = (e);                                               \
+        data[n] = (ptr);                                                \
+        dir[n].checksum = crc32c(0, data[n], dir[n].size);              \
+        ++n;                                                            \
+    } while (0)
+
+    SECTION(GARBLE_SECTION_GATES, gc->gates, sizeof(garble_gate) * gc->q,
+            0, gc->q);
+    SECTION(GARBLE_SECTION_OUTPUTS, gc->outputs, sizeof(int) * gc->m, 0, 0);
+    SECTION(GARBLE_SECTION_OUTPUT_PERMS, gc->output_perms,
+            sizeof(bool) * gc->m, 0, 0);
+    for (size_t i = 0, row = 0; i < nsegments; ++i) {
+        const size_t start = i * segment_gates;
+        const size_t end = start + segment_gates < gc->q
+            ? start + segment_gates : gc->q;
+        const size_t rows = garble_rows_in(gc, start, end);
+
+        SECTION(GARBLE_SECTION_TABLE, gc->table + row * garble_table_blocks(gc),
+                rows * garble_table_size(gc), start, end);
+        row += rows;
+    }
+    if (dag)
+        SECTION(GARBLE_SECTION_SCHEDULE, schedule, schedule_size, 0, 0);
+#undef SECTION
+
+    memset(&h, '\0', sizeof h);
+    memcpy(h.magic, CONTAINER_MAGIC, sizeof h.magic);
+    h.version = GARBLE_CONTAINER_VERSION;
+    h.nsections = nsections;
+    h.n = gc->n;
+    h.m = gc->m;
+    h.q = gc->q;
+    h.r = gc->r;
+    h.nxors = gc->nxors;
+    h.type = gc->type;
+    h.fixed_label = gc->fixed_label;
+    h.global_key = gc->global_key;
+
+    off = align_up(sizeof h + nsections * sizeof(garble_section));
+    for (size_t i = 0; i < nsections; ++i) {
+        dir[i].offset = off;
+        off = align_up(off + dir[i].size);
+    }
+    h.checksum = crc32c(crc32c(0, &h, sizeof h), dir,
+                        nsections * sizeof(garble_section));
+
+    n = 0;
+    iov[n].iov_base = &h;
+    iov[n++].iov_len = sizeof h;
+    iov[n].iov_base = dir;
+    iov[n++].iov_len = nsections * sizeof(garble_section);
+    off = sizeof h + nsections * sizeof(garble_section);
+    for (size_t i = 0; i < nsections; ++i) {
+        iov[n].iov_base = (void *) (uintptr_t) zeros;
+        iov[n++].iov_len = dir[i].offset - off;
+        iov[n].iov_base = (void *) (uintptr_t) data[i];
+        iov[n++].iov_len = dir[i].size;
+        off = dir[i].offset + dir[i].size;
+    }
+    res = _garble_writev_all(fd, iov, n);
+
+cleanup:
+    free(dir);
+    free(data);
+    free(iov);
+    free(schedule);
+    return res;
+}
+
+/* pread(2) all of 'len' bytes at 'offset' */
+static int
+pread_all(int fd, void *buf, size_t len, uint64_t offset)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t res = pread(fd, p, len, offset);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return GARBLE_ERR;
+        }
+        if (res == 0)
+            return GARBLE_ERR;
+        p += res;
+        len -= res;
+        offset += res;
+    }
+    return GARBLE_OK;
+}
+
+int
+garble_container_open(garble_container *c, int fd)
+{
+    container_header h;
+    struct stat st;
+    uint32_t checksum;
+
+    if (c == NULL)
+        return GARBLE_ERR;
+    memset(c, '\0', sizeof(garble_container));
+    if (fstat(fd, &st) == -1 || pread_all(fd, &h, sizeof h, 0) == GARBLE_ERR)
+        return GARBLE_ERR;
+    if (memcmp(h.magic, CONTAINER_MAGIC, sizeof h.magic) != 0
+        || h.version != GARBLE_CONTAINER_VERSION || h.q < h.nxors
+        || h.type > GARBLE_TYPE_PRIVACY_FREE
+        || h.nsections > (uint64_t) st.st_size / sizeof(garble_section))
+        return GARBLE_ERR;
+    if ((c->sections = malloc((h.nsections ? h.nsections : 1)
+                              * sizeof(garble_section))) == NULL)
+        return GARBLE_ERR;
+    if (pread_all(fd, c->sections, h.nsections * sizeof(garble_section),
+                  sizeof h) == GARBLE_ERR)
+        goto error;
+    checksum = h.checksum;
+    h.checksum = 0;
+    if (crc32c(crc32c(0, &h, sizeof h), c->sections,
+               h.nsections * sizeof(garble_section)) != checksum)
+        goto error;
+    for (size_t i = 0; i < h.nsections; ++i) {
+        const garble_section *s = &c->sections[i];
+        if (s->offset % GARBLE_CONTAINER_ALIGN != 0
+            || s->offset > (uint64_t) st.st_size
+            || s->size > (uint64_t) st.st_size - s->offset)
+            goto error;
+    }
+
+    c->fd = fd;
+    c->nsections = h.nsections;
+    c->gc.n = h.n;
+    c->gc.m = h.m;
+    c->gc.q = h.q;
+    c->gc.r = h.r;
+    c->gc.nxors = h.nxors;
+    c->gc.type = h.type;
+    c->gc.fixed_label = h.fixed_label;
+    c->gc.global_key = h.global_key;
+    return GARBLE_OK;
+error:
+    free(c->sections);
+    c->sections = NULL;
+    return GARBLE_ERR;
+}
+
+void
+garble_container_close(garble_container *c)
+{
+    if (c == NULL)
+        return;
+    free(c->sections);
+    memset(c, '\0', sizeof(garble_container));
+}
+
+const garble_section *
+garble_container_find(const garble_container *c, garble_section_e kind,
+                      size_t gate)
+{
+    for (size_t i = 0; i < c->nsections; ++i) {
+        const garble_section *s = &c->sections[i];
+        if (s->kind == (uint32_t) kind
+            && (kind != GARBLE_SECTION_TABLE
+                || (s->start <= gate && gate < s->end)))
+            return s;
+    }
+    return NULL;
+}
+
+int
+garble_container_read(const garble_container *c, const garble_section *s,
+                      void *buf)
+{
+    if (c == NULL || s == NULL)
+        return GARBLE_ERR;
+    if (pread_all(c->fd, buf, s->size, s->offset) == GARBLE_ERR)
+        return GARBLE_ERR;
+    return crc32c(0, buf, s->size) == s->checksum ? GARBLE_OK : GARBLE_ERR;
+}
+
+/* Read the section of 'kind' into a fresh buffer of exactly 'size' bytes */
+static void *
+read_section(const garble_container *c, garble_section_e kind, size_t size)
+{
+    const garble_section *s = garble_container_find(c, kind, 0);
+    void *buf;
+
+    if (s == NULL || s->size != size || (buf = malloc(size ? size : 1)) == NULL)
+        return NULL;
+    if (garble_container_read(c, s, buf) == GARBLE_ERR) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+int
+garble_container_load(const garble_container *c, garble_circuit *gc)
+{
+    size_t row = 0, gate = 0;
+
+    if (c == NULL || gc == NULL)
+        return GARBLE_ERR;
+    *gc = c->gc;
+    gc->gates = read_section(c, GARBLE_SECTION_GATES, sizeof(garble_gate) * gc->q);
+    gc->outputs = read_section(c, GARBLE_SECTION_OUTPUTS, sizeof(int) * gc->m);
+    gc->output_perms = read_section(c, GARBLE_SECTION_OUTPUT_PERMS,
+                                    sizeof(bool) * gc->m);
+    gc->table = garble_allocate_blocks((gc->q - gc->nxors) * garble_table_blocks(gc) + 1);
+    if (gc->gates == NULL || gc->outputs == NULL || gc->output_perms == NULL
+        || gc->table == NULL)
+        goto error;
+    for (size_t i = 0; i < c->nsections; ++i) {
+        const garble_section *s = &c->sections[i];
+        size_t rows;
+
+        if (s->kind != GARBLE_SECTION_TABLE)
+            continue;
+        /* The checksums only catch damage, not a writer lying about sizes:
+           segments must tile the gates and hold exactly their rows */
+        if (s->start != gate || s->end > gc->q || s->start > s->end
+            || s->size % garble_table_size(gc) != 0)
+            goto error;
+        rows = s->size / garble_table_size(gc);
+        if (rows != garble_rows_in(gc, s->start, s->end)
+            || row + rows > gc->q - gc->nxors
+            || garble_container_read(c, s, gc->table + row * garble_table_blocks(gc))
+            == GARBLE_ERR)
+            goto error;
+        row += rows;
+        gate = s->end;
+    }
+    if (gate != gc->q || row != gc->q - gc->nxors)
+        goto error;
+    return GARBLE_OK;
+error:
+    garble_delete(gc);
+    return GARBLE_ERR;
+}
+
+int
+garble_container_load_schedule(const garble_container *c, garble_dag *dag)
+{
+    const garble_section *s;
+    garble_circuit gc;
+    uint64_t *buf = NULL, *rebuilt = NULL;
+    size_t size;
+    int res = GARBLE_ERR;
+
+    if (c == NULL || dag == NULL
+        || (s = garble_container_find(c, GARBLE_SECTION_SCHEDULE, 0)) == NULL
+        || s->size < 4 * sizeof(uint64_t))
+        return GARBLE_ERR;
+    memset(dag, '\0', sizeof(garble_dag));
+    gc = c->gc;
+    gc.gates = read_section(c, GARBLE_SECTION_GATES, sizeof(garble_gate) * gc.q);
+    if (gc.gates == NULL || (buf = malloc(s->size)) == NULL
+        || garble_container_read(c, s, buf) == GARBLE_ERR || buf[1] == 0)
+        goto cleanup;
+    /* Rows and dependency counts index the table and drive the executor, so
+       a stored schedule is only used if it matches one rebuilt from the
+       gates */
+    if (garble_dag_new(dag, &gc, buf[1]) == GARBLE_ERR)
+        goto cleanup;
+    if ((rebuilt = schedule_encode(dag, &size)) == NULL || size != s->size
+        || memcmp(rebuilt, buf, size) != 0) {
+        garble_dag_delete(dag);
+        goto cleanup;
+    }
+    res = GARBLE_OK;
+cleanup:
+    free(gc.gates);
+    free(buf);
+    free(rebuilt);
+    return res;
+}
@@ -0,0 +1,683 @@
+/*
+ * Dependency-counting parallel garbling and evaluation.
+ *
+ * The gate list is split into contiguous chunks.  Each chunk records how many
+ * distinct earlier chunks produce its input wires, and each chunk keeps a
+ * fan-out list of the chunks consuming its outputs.  At run time, a chunk is
+ * pushed onto the work-stealing deque of whichever worker retires its last
+ * predecessor, so narrow AND chains and wide XOR layers interleave freely
+ * instead of synchronizing level by level.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+#include "config.h"
+
+#ifdef HAVE_LIBNUMA
+#  include <numa.h>
+#  include <numaif.h>
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NO_CHUNK SIZE_MAX
+
+int
+garble_dag_new(garble_dag *dag, const garble_circuit *gc, size_t chunk_size)
+{
+    size_t *producer = NULL, *mark = NULL, *cursor = NULL;
+    size_t nfree = 0;
+
+    if (dag == NULL || gc == NULL || gc->r > SIZE_MAX / sizeof(size_t))
+        return GARBLE_ERR;
+
+    memset(dag, '\0', sizeof(garble_dag));
+    if (chunk_size == 0)
+        chunk_size = GARBLE_DAG_CHUNK_SIZE;
+    dag->q = gc->q;
+    dag->chunk_size = chunk_size;
+    dag->nchunks = (gc->q + chunk_size - 1) / chunk_size;
+
+    dag->rows = calloc(dag->nchunks, sizeof(size_t));
+    dag->ndeps = calloc(dag->nchunks, sizeof(size_t));
+    dag->succ_start = calloc(dag->nchunks + 1, sizeof(size_t));
+    producer = malloc(gc->r * sizeof(size_t));
+    mark = malloc(dag->nchunks * sizeof(size_t));
+    if (dag->rows == NULL || dag->ndeps == NULL || dag->succ_start == NULL
+        || producer == NULL || mark == NULL)
+        goto error;
+
+    /* Map each wire to the chunk producing it; inputs and fixed wires have no
+     * producer */
+    for (size_t w = 0; w < gc->r; ++w)
+        producer[w] = NO_CHUNK;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        if (g->output >= gc->r || g->input0 >= gc->r || g->input1 >= gc->r)
+            goto error;
+        if (i % chunk_size == 0)
+            dag->rows[i / chunk_size] = i - nfree;
+        nfree += garble_gate_is_free(g->type) ? 1 : 0;
+        producer[g->output] = i / chunk_size;
+    }
+
+    /* First pass: count distinct predecessors and successors of each chunk */
+    for (size_t c = 0; c < dag->nchunks; ++c)
+        mark[c] = NO_CHUNK;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        const size_t c = i / chunk_size;
+        const size_t ps[2] = { producer[g->input0], producer[g->input1] };
+        for (int j = 0; j < 2; ++j) {
+            const size_t p = ps[j];
+            if (p == NO_CHUNK || p >= c || mark[p] == c)
+                continue;
+            mark[p] = c;
+            dag->ndeps[c]++;
+            dag->succ_start[p + 1]++;
+        }
+    }
+    for (size_t c = 0; c < dag->nchunks; ++c)
+        dag->succ_start[c + 1] += dag->succ_start[c];
+
+    /* Second pass: fill in the fan-out lists */
+    dag->succs = malloc((dag->succ_start[dag->nchunks] + 1) * sizeof(size_t));
+    cursor = malloc(dag->nchunks * sizeof(size_t));
+    if (dag->succs == NULL || cursor == NULL)
+        goto error;
+    memcpy(cursor, dag->succ_start, dag->nchunks * sizeof(size_t));
+    for (size_t c = 0; c < dag->nchunks; ++c)
+        mark[c] = NO_CHUNK;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        const size_t c = i / chunk_size;
+        const size_t ps[2] = { producer[g->input0], producer[g->input1] };
+        for (int j = 0; j < 2; ++j) {
+            const size_t p = ps[j];
+            if (p == NO_CHUNK || p >= c || mark[p] == c)
+                continue;
+            mark[p] = c;
+            dag->succs[cursor[p]++] = c;
+        }
+    }
+
+    free(producer);
+    free(mark);
+    free(cursor);
+    return GARBLE_OK;
+error:
+    free(producer);
+    free(mark);
+    free(cursor);
+    garble_dag_delete(dag);
+    return GARBLE_ERR;
+}
+
+void
+garble_dag_delete(garble_dag *dag)
+{
+    if (dag == NULL)
+        return;
+    free(dag->rows);
+    free(dag->ndeps);
+    free(dag->succ_start);
+    free(dag->succs);
+    memset(dag, '\0', sizeof(garble_dag));
+}
+
+/*
+ * Chase-Lev work-stealing deque.  Every chunk is pushed exactly once per run,
+ * so a buffer of 'nchunks' entries never wraps and needs no resizing.
+ */
+
+typedef struct {
+    _Alignas(64) _Atomic ptrdiff_t top;
+    _Alignas(64) _Atomic ptrdiff_t bottom;
+    size_t *buf;
+} deque;
+
+static void
+deque_push(deque *d, size_t c)
+{
+    ptrdiff_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    d->buf[b] = c;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+static size_t
+deque_take(deque *d)
+{
+    ptrdiff_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    ptrdiff_t t;
+    size_t c = NO_CHUNK;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t <= b) {
+        c = d->buf[b];
+        if (t == b) {
+            /* Last entry: race against thieves */
+            if (!atomic_compare_exchange_strong_explicit(
+                    &d->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                c = NO_CHUNK;
+            atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return c;
+}
+
+static size_t
+deque_steal(deque *d)
+{
+    ptrdiff_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    ptrdiff_t b;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t < b) {
+        size_t c = d->buf[t];
+        if (!atomic_compare_exchange_strong_explicit(
+                &d->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed))
+            return NO_CHUNK;
+        return c;
+    }
+    return NO_CHUNK;
+}
+
+typedef struct {
+    const garble_dag *dag;
+    _Atomic size_t *pending;
+    _Atomic size_t ndone;
+    deque *deques;
+    size_t nthreads;
+    /* Process gates [start, end) whose first table row is 'row' */
+    void (*run)(void *arg, size_t start, size_t end, size_t row);
+    void *arg;
+    /* NUMA placement: if 'touch' is set, each worker binds itself to its node
+     * and first-touches the memory of chunks [start, end) it owns before any
+     * chunk runs */
+    void (*touch)(void *arg, size_t start, size_t end);
+    size_t nnodes;
+    _Atomic size_t ntouched;
+    _Atomic size_t nstarted;
+    _Atomic size_t local_chunks;
+    _Atomic size_t remote_chunks;
+} executor;
+
+typedef struct {
+    executor *ex;
+    size_t id;
+} worker;
+
+/* Chunks are owned in contiguous ranges, and workers are spread evenly over
+ * the nodes */
+static size_t
+owner_start(const executor *ex, size_t t)
+{
+    return ex->dag->nchunks * t / ex->nthreads;
+}
+
+static size_t
+chunk_owner(const executor *ex, size_t c)
+{
+    size_t t = c * ex->nthreads / ex->dag->nchunks;
+    while (t + 1 < ex->nthreads && owner_start(ex, t + 1) <= c)
+        ++t;
+    while (t > 0 && owner_start(ex, t) > c)
+        --t;
+    return t;
+}
+
+static size_t
+worker_node(const executor *ex, size_t t)
+{
+    return t * ex->nnodes / ex->nthreads;
+}
+
+static size_t
+steal_any(executor *ex, size_t id, uint64_t *seed)
+{
+    size_t victim;
+
+    /* xorshift to spread thieves over victims */
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    victim = *seed % ex->nthreads;
+    /* With NUMA placement, only cross nodes once the local node is dry */
+    for (int pass = ex->touch ? 0 : 1; pass < 2; ++pass) {
+        for (size_t i = 0; i < ex->nthreads; ++i) {
+            size_t v = (victim + i) % ex->nthreads;
+            size_t c;
+            if (v == id)
+                continue;
+            if (pass == 0 && worker_node(ex, v) != worker_node(ex, id))
+                continue;
+            if ((c = deque_steal(&ex->deques[v])) != NO_CHUNK)
+                return c;
+        }
+    }
+    return NO_CHUNK;
+}
+
+static void
+worker_place(executor *ex, size_t id)
+{
+#ifdef HAVE_LIBNUMA
+    if (ex->nnodes > 1)
+        (void) numa_run_on_node(worker_node(ex, id));
+#endif
+    ex->touch(ex->arg, owner_start(ex, id), owner_start(ex, id + 1));
+    /* Nobody runs a chunk until all owned memory has been first-touched */
+    atomic_fetch_add_explicit(&ex->ntouched, 1, memory_order_acq_rel);
+    for (;;) {
+        size_t nstarted = atomic_load_explicit(&ex->nstarted, memory_order_acquire);
+        if (nstarted
+            && atomic_load_explicit(&ex->ntouched, memory_order_acquire) == nstarted)
+            break;
+        sched_yield();
+    }
+}
+
+static void *
+worker_loop(void *arg)
+{
+    worker *w = arg;
+    executor *ex = w->ex;
+    const garble_dag *dag = ex->dag;
+    deque *own = &ex->deques[w->id];
+    uint64_t seed = 0x9e3779b97f4a7c15ULL * (w->id + 1);
+    size_t local = 0, remote = 0;
+
+    if (ex->touch)
+        worker_place(ex, w->id);
+
+    while (atomic_load_explicit(&ex->ndone, memory_order_acquire) < dag->nchunks) {
+        size_t c, start, end;
+
+        if ((c = deque_take(own)) == NO_CHUNK
+            && (c = steal_any(ex, w->id, &seed)) == NO_CHUNK) {
+            sched_yield();
+            continue;
+        }
+        start = c * dag->chunk_size;
+        end = start + dag->chunk_size;
+        if (end > dag->q)
+            end = dag->q;
+        ex->run(ex->arg, start, end, dag->rows[c]);
+        if (ex->touch) {
+            if (worker_node(ex, chunk_owner(ex, c)) == worker_node(ex, w->id))
+                ++local;
+            else
+                ++remote;
+        }
+
+        for (size_t i = dag->succ_start[c]; i < dag->succ_start[c + 1]; ++i) {
+            size_t s = dag->succs[i];
+            if (atomic_fetch_sub_explicit(&ex->pending[s], 1,
+                                          memory_order_acq_rel) == 1)
+                deque_push(own, s);
+        }
+        atomic_fetch_add_explicit(&ex->ndone, 1, memory_order_release);
+    }
+    atomic_fetch_add(&ex->local_chunks, local);
+    atomic_fetch_add(&ex->remote_chunks, remote);
+    return NULL;
+}
+
+static int
+execute(executor *ex, size_t nthreads)
+{
+    const garble_dag *dag = ex->dag;
+    void *pending;
+    worker *workers = NULL;
+    pthread_t *threads = NULL;
+    size_t nstarted = 0, next = 0;
+    int res = GARBLE_ERR;
+
+    if (nthreads == 0)
+        nthreads = 1;
+    if (nthreads > dag->nchunks && dag->nchunks > 0)
+        nthreads = dag->nchunks;
+
+    ex->nthreads = nthreads;
+    if (ex->nnodes == 0)
+        ex->nnodes = 1;
+    atomic_init(&ex->ndone, 0);
+    atomic_init(&ex->ntouched, 0);
+    atomic_init(&ex->nstarted, 0);
+    atomic_init(&ex->local_chunks, 0);
+    atomic_init(&ex->remote_chunks, 0);
+    ex->pending = pending = calloc(dag->nchunks, sizeof(_Atomic size_t));
+    ex->deques = aligned_alloc(64, nthreads * sizeof(deque));
+    workers = calloc(nthreads, sizeof(worker));
+    threads = calloc(nthreads, sizeof(pthread_t));
+    if (ex->pending == NULL || ex->deques == NULL || workers == NULL
+        || threads == NULL)
+        goto cleanup;
+    memset(ex->deques, '\0', nthreads * sizeof(deque));
+    for (size_t t = 0; t < nthreads; ++t) {
+        atomic_init(&ex->deques[t].top, 0);
+        atomic_init(&ex->deques[t].bottom, 0);
+        if ((ex->deques[t].buf = malloc((dag->nchunks + 1) * sizeof(size_t))) == NULL)
+            goto cleanup;
+        workers[t].ex = ex;
+        workers[t].id = t;
+    }
+
+    /* Deal the initially ready chunks round-robin, or to their owners when
+     * placing memory */
+    for (size_t c = 0; c < dag->nchunks; ++c) {
+        atomic_init(&ex->pending[c], dag->ndeps[c]);
+        if (dag->ndeps[c] == 0)
+            deque_push(&ex->deques[ex->touch ? chunk_owner(ex, c) : next++ % nthreads], c);
+    }
+
+    /* The calling thread acts as worker 0; if thread creation fails the
+     * remaining deques are drained by stealing */
+    for (nstarted = 1; nstarted < nthreads; ++nstarted) {
+        if (pthread_create(&threads[nstarted], NULL, worker_loop,
+                           &workers[nstarted]) != 0)
+            break;
+    }
+    atomic_store(&ex->nstarted, nstarted);
+    if (ex->touch) {
+        /* Memory of workers that failed to start is touched here */
+        for (size_t t = nstarted; t < nthreads; ++t)
+            ex->touch(ex->arg, owner_start(ex, t), owner_start(ex, t + 1));
+    }
+    {
+#ifdef HAVE_LIBNUMA
+        /* worker_place binds the calling thread to the node of worker 0;
+         * give it back its own CPU affinity afterwards */
+        struct bitmask *cpus = NULL;
+        if (ex->nnodes > 1 && (cpus = numa_allocate_cpumask()) != NULL
+            && numa_sched_getaffinity(0, cpus) < 0) {
+            numa_free_cpumask(cpus);
+            cpus = NULL;
+        }
+#endif
+        (void) worker_loop(&workers[0]);
+#ifdef HAVE_LIBNUMA
+        if (cpus) {
+            (void) numa_sched_setaffinity(0, cpus);
+            numa_free_cpumask(cpus);
+        }
+#endif
+    }
+    for (size_t t = 1; t < nstarted; ++t)
+        (void) pthread_join(threads[t], NULL);
+    res = GARBLE_OK;
+
+cleanup:
+    if (ex->deques) {
+        for (size_t t = 0; t < nthreads; ++t)
+            free(ex->deques[t].buf);
+    }
+    free(ex->deques);
+    free(pending);
+    free(workers);
+    free(threads);
+    return res;
+}
+
+typedef struct {
+    garble_circuit *gc;
+    const garble_dag *dag;
+    const AES_KEY *key;
+    block delta;
+} garble_arg;
+
+static void
+run_garble(void *arg, size_t start, size_t end, size_t row)
+{
+    garble_arg *a = arg;
+    _garble_gates(a->gc, a->key, a->delta, start, end,
+                  a->gc->table + row * garble_table_blocks(a->gc));
+}
+
+int
+garble_garble_parallel(garble_circuit *gc, const garble_dag *dag,
+                       const block *input_labels, block *output_labels,
+                       size_t nthreads)
+{
+    executor ex;
+    AES_KEY key;
+    garble_arg arg;
+
+    if (gc == NULL || dag == NULL || dag->q != gc->q)
+        return GARBLE_ERR;
+
+    if (_garble_init(gc, input_labels, &key, &arg.delta, true) == GARBLE_ERR)
+        return GARBLE_ERR;
+    arg.gc = gc;
+    arg.dag = dag;
+    arg.key = &key;
+    memset(&ex, '\0', sizeof ex);
+    ex.dag = dag;
+    ex.run = run_garble;
+    ex.arg = &arg;
+    if (execute(&ex, nthreads) == GARBLE_ERR)
+        return GARBLE_ERR;
+    _garble_finish(gc, output_labels);
+
+    return GARBLE_OK;
+}
+
+/* First-touch the table rows and output labels of chunks [start, end) */
+static void
+touch_garble(void *arg, size_t start, size_t end)
+{
+    garble_arg *a = arg;
+    const garble_dag *dag = a->dag;
+    const size_t row_end = end < dag->nchunks
+        ? dag->rows[end] : a->gc->q - a->gc->nxors;
+    const size_t gate_end = end * dag->chunk_size < dag->q
+        ? end * dag->chunk_size : dag->q;
+
+    if (start >= end)
+        return;
+    memset(a->gc->table + dag->rows[start] * garble_table_blocks(a->gc), '\0',
+           (row_end - dag->rows[start]) * garble_table_size(a->gc));
+    for (size_t i = start * dag->chunk_size; i < gate_end; ++i) {
+        const size_t w = a->gc->gates[i].output;
+        a->gc->wires[2 * w] = a->gc->wires[2 * w + 1] = garble_zero_block();
+    }
+}
+
+/* Allocate 'size' bytes without touching them, so that pages are placed by
+ * whichever worker writes them first */
+static void *
+alloc_untouched(size_t size)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, 4096, size ? size : 1) != 0)
+        return NULL;
+    return p;
+}
+
+#ifdef HAVE_LIBNUMA
+typedef struct {
+    const executor *ex;
+    const garble_arg *a;
+    size_t *wire_chunks;        /* r: chunk producing each wire */
+} placement;
+
+/* Worker expected to own the byte at 'offset' of the table */
+static size_t
+table_owner(const placement *pl, size_t offset)
+{
+    const garble_dag *dag = pl->ex->dag;
+    const size_t row = offset / garble_table_size(pl->a->gc);
+    size_t lo = 0, hi = dag->nchunks;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (dag->rows[mid] <= row)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return chunk_owner(pl->ex, lo);
+}
+
+/* Worker expected to own the byte at 'offset' of the wire labels */
+static size_t
+wire_owner(const placement *pl, size_t offset)
+{
+    const size_t w = offset / (2 * sizeof(block));
+    return pl->wire_chunks[w] == NO_CHUNK
+        ? 0 : chunk_owner(pl->ex, pl->wire_chunks[w]);
+}
+
+/* Query where the pages of [p, p + size) live and compare with the node of
+ * the worker owning the start of each page */
+static void
+count_pages(const placement *pl, const void *p, size_t size,
+            size_t (*owner)(const placement *, size_t),
+            size_t *local, size_t *remote)
+{
+    const long pagesize = sysconf(_SC_PAGESIZE);
+    const uintptr_t first = (uintptr_t) p & ~(uintptr_t) (pagesize - 1);
+    const size_t npages = ((uintptr_t) p + size - first + pagesize - 1) / pagesize;
+    void **pages = malloc(npages * sizeof(void *));
+    int *status = malloc(npages * sizeof(int));
+
+    if (size && pages && status) {
+        for (size_t i = 0; i < npages; ++i)
+            pages[i] = (void *) (first + i * pagesize);
+        if (move_pages(0, npages, pages, NULL, status, 0) == 0) {
+            for (size_t i = 0; i < npages; ++i) {
+                uintptr_t addr = i ? first + i * pagesize : (uintptr_t) p;
+                if (status[i] < 0)
+                    continue;
+                if ((size_t) status[i]
+                    == worker_node(pl->ex, owner(pl, addr - (uintptr_t) p)))
+                    ++*local;
+                else
+                    ++*remote;
+            }
+        }
+    }
+    free(pages);
+    free(status);
+}
+#endif
+
+int
+garble_garble_numa(garble_circuit *gc, const garble_dag *dag,
+                   const block *input_labels, block *output_labels,
+                   size_t nthreads, garble_numa_stats *stats)
+{
+    executor ex;
+    AES_KEY key;
+    garble_arg arg;
+
+    if (gc == NULL || dag == NULL || dag->q != gc->q)
+        return GARBLE_ERR;
+
+    memset(&ex, '\0', sizeof ex);
+    ex.nnodes = 1;
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0)
+        ex.nnodes = numa_num_configured_nodes();
+#endif
+
+    if (gc->wires == NULL
+        && (gc->wires = alloc_untouched(2 * gc->r * sizeof(block))) == NULL)
+        return GARBLE_ERR;
+    if (gc->table == NULL
+        && (gc->table = alloc_untouched((gc->q - gc->nxors) * garble_table_size(gc))) == NULL)
+        return GARBLE_ERR;
+    if (_garble_init(gc, input_labels, &key, &arg.delta, true) == GARBLE_ERR)
+        return GARBLE_ERR;
+    arg.gc = gc;
+    arg.dag = dag;
+    arg.key = &key;
+    ex.dag = dag;
+    ex.run = run_garble;
+    ex.touch = touch_garble;
+    ex.arg = &arg;
+    if (execute(&ex, nthreads) == GARBLE_ERR)
+        return GARBLE_ERR;
+    _garble_finish(gc, output_labels);
+
+    if (stats) {
+        memset(stats, '\0', sizeof(garble_numa_stats));
+        stats->nnodes = ex.nnodes;
+        stats->local_chunks = atomic_load(&ex.local_chunks);
+        stats->remote_chunks = atomic_load(&ex.remote_chunks);
+#ifdef HAVE_LIBNUMA
+        {
+            placement pl = { &ex, &arg, malloc(gc->r * sizeof(size_t)) };
+            count_pages(&pl, gc->table, (gc->q - gc->nxors) * garble_table_size(gc),
+                        table_owner, &stats->local_pages, &stats->remote_pages);
+            if (pl.wire_chunks) {
+                for (size_t w = 0; w < gc->r; ++w)
+                    pl.wire_chunks[w] = NO_CHUNK;
+                for (size_t i = 0; i < gc->q; ++i)
+                    pl.wire_chunks[gc->gates[i].output] = i / dag->chunk_size;
+                count_pages(&pl, gc->wires, 2 * gc->r * sizeof(block),
+                            wire_owner, &stats->local_pages, &stats->remote_pages);
+                free(pl.wire_chunks);
+            }
+        }
+#endif
+    }
+
+    return GARBLE_OK;
+}
+
+typedef struct {
+    const garble_circuit *gc;
+    block *labels;
+    const AES_KEY *key;
+} eval_arg;
+
+static void
+run_eval(void *arg, size_t start, size_t end, size_t row)
+{
+    eval_arg *a = arg;
+    _eval_gates(a->gc, a->labels, a->key, start, end,
+                a->gc->table + row * garble_table_blocks(a->gc));
+}
+
+int
+garble_eval_parallel(const garble_circuit *gc, const garble_dag *dag,
+                     const block *input_labels, block *output_labels,
+                     bool *outputs, size_t nthreads)
+{
+    executor ex;
+    AES_KEY key;
+    eval_arg arg;
+    int res;
+
+    if (gc == NULL || dag == NULL || dag->q != gc->q)
+        return GARBLE_ERR;
+
+    if ((arg.labels = garble_allocate_blocks(gc->r)) == NULL)
+        return GARBLE_ERR;
+    _eval_init(gc, input_labels, arg.labels, &key);
+    arg.gc = gc;
+    arg.key = &key;
+    memset(&ex, '\0', sizeof ex);
+    ex.dag = dag;
+    ex.run = run_eval;
+    ex.arg = &arg;
+    res = execute(&ex, nthreads);
+    if (res == GARBLE_OK)
+        _eval_finish(gc, arg.labels, output_labels, outputs);
+    free(arg.labels);
+
+    return res;
+}
@@ -1,4 +1,5 @@
 #include "garble.h"
+#include "garble_internal.h"
 #include "garble/garble_gate_halfgates.h"
 #include "garble/garble_gate_privacy_free.h"
 #include "garble/garble_gate_standard.h"
@@ -7,66 +8,80 @@
 #include <string.h>
 
 static void
-_eval_privacy_free(const garble_circuit *gc, block *labels, const AES_KEY *key)
+_eval_privacy_free(const garble_circuit *gc, block *labels, const AES_KEY *key,
+                   size_t start, size_t end, const block *table)
 {
-    size_t nxors = 0;
-    for (size_t i = 0; i < gc->q; i++) {
+    size_t nfree = 0;
+    for (size_t i = start; i < end; i++) {
         garble_gate *g = &gc->gates[i];
-        nxors += (g->type == GARBLE_GATE_XOR ? 1 : 0);
+        nfree += garble_gate_is_free(g->type) ? 1 : 0;
         garble_gate_eval_privacy_free(g->type,
                                       labels[g->input0],
                                       labels[g->input1],
                                       &labels[g->output],
-                                      &gc->table[i - nxors],
+                                      &table[i - start - nfree],
                                       i, key);
     }
 }
 
 static void
-_eval_halfgates(const garble_circuit *gc, block *labels, const AES_KEY *key)
+_eval_halfgates(const garble_circuit *gc, block *labels, const AES_KEY *key,
+                size_t start, size_t end, const block *table)
 {
-    size_t nxors = 0;
-    for (size_t i = 0; i < gc->q; i++) {
+    size_t nfree = 0;
+    for (size_t i = start; i < end; i++) {
         garble_gate *g = &gc->gates[i];
-        nxors += (g->type == GARBLE_GATE_XOR ? 1 : 0);
+        nfree += garble_gate_is_free(g->type) ? 1 : 0;
         garble_gate_eval_halfgates(g->type,
                                    labels[g->input0],
                                    labels[g->input1],
                                    &labels[g->output],
-                                   &gc->table[2 * (i - nxors)],
+                                   &table[2 * (i - start - nfree)],
                                    i, key);
     }
 }
 
 static void
-_eval_standard(const garble_circuit *gc, block *labels, AES_KEY *key)
+_eval_standard(const garble_circuit *gc, block *labels, const AES_KEY *key,
+               size_t start, size_t end, const block *table)
 {
-    size_t nxors = 0;
-    for (size_t i = 0; i < gc->q; i++) {
+    size_t nfree = 0;
+    for (size_t i = start; i < end; i++) {
         garble_gate *g = &gc->gates[i];
-        nxors += (g->type == GARBLE_GATE_XOR ? 1 : 0);
+        nfree += garble_gate_is_free(g->type) ? 1 : 0;
         garble_gate_eval_standard(g->type,
                                   labels[g->input0],
                                   labels[g->input1],
                                   &labels[g->output],
-                                  &gc->table[3 * (i - nxors)],
+                                  &table[3 * (i - start - nfree)],
                                   i, key);
     }
 }
 
-int
-garble_eval(const garble_circuit *gc, const block *input_labels,
-            block *output_labels, bool *outputs)
+void
+_eval_gates(const garble_circuit *gc, block *labels, const AES_KEY *key,
+            size_t start, size_t end, const block *table)
 {
-    AES_KEY key;
-    block *labels;
-    block fixed_label;
+    switch (gc->type) {
+    case GARBLE_TYPE_STANDARD:
+        _eval_standard(gc, labels, key, start, end, table);
+        break;
+    case GARBLE_TYPE_HALFGATES:
+        _eval_halfgates(gc, labels, key, start, end, table);
+        break;
+    case GARBLE_TYPE_PRIVACY_FREE:
+        _eval_privacy_free(gc, labels, key, start, end, table);
+        break;
+    }
+}
 
-    if (gc == NULL)
-        return GARBLE_ERR;
+void
+_eval_init(const garble_circuit *gc, const block *input_labels, block *labels,
+           AES_KEY *key)
+{
+    block fixed_label;
 
-    AES_set_encrypt_key(gc->global_key, &key);
-    labels = garble_allocate_blocks(gc->r);
+    AES_set_encrypt_key(gc->global_key, key);
 
     /* Set input wire labels */
     memcpy(labels, input_labels, gc->n * sizeof input_labels[0]);
@@ -77,19 +92,12 @@ garble_eval(const garble_circuit *gc, const block *input_labels,
     labels[gc->n] = fixed_label;
     *((char *) &fixed_label) |= 0x01;
     labels[gc->n + 1] = fixed_label;
+}
 
-    switch (gc->type) {
-    case GARBLE_TYPE_STANDARD:
-        _eval_standard(gc, labels, &key);
-        break;
-    case GARBLE_TYPE_HALFGATES:
-        _eval_halfgates(gc, labels, &key);
-        break;
-    case GARBLE_TYPE_PRIVACY_FREE:
-        _eval_privacy_free(gc, labels, &key);
-        break;
-    }
-
+void
+_eval_finish(const garble_circuit *gc, const block *labels,
+             block *output_labels, bool *outputs)
+{
     if (output_labels) {
         for (size_t i = 0; i < gc->m; ++i) {
             output_labels[i] = labels[gc->outputs[i]];
@@ -98,9 +106,28 @@ garble_eval(const garble_circuit *gc, const block *input_labels,
     if (outputs) {
         for (size_t i = 0; i < gc->m; ++i) {
             outputs[i] =
-                (*((char *) &labels[gc->outputs[i]]) & 0x1) ^ gc->output_perms[i];
+                (*((const char *) &labels[gc->outputs[i]]) & 0x1) ^ gc->output_perms[i];
         }
     }
+}
+
+int
+garble_eval(const garble_circuit *gc, const block *input_labels,
+            block *output_labels, bool *outputs)
+{
+    AES_KEY key;
+    block *labels;
+
+    if (gc == NULL)
+        return GARBLE_ERR;
+
+    labels = garble_allocate_blocks(gc->r);
+    if (labels == NULL)
+        return GARBLE_ERR;
+
+    _eval_init(gc, input_labels, labels, &key);
+    _eval_gates(gc, labels, &key, 0, gc->q, gc->table);
+    _eval_finish(gc, labels, output_labels, outputs);
 
     free(labels);
 
@@ -1,4 +1,5 @@
 #include "garble.h"
+#include "garble_internal.h"
 #include "garble/garble_gate_halfgates.h"
 #include "garble/garble_gate_privacy_free.h"
 #include "garble/garble_gate_standard.h"
@@ -10,12 +11,13 @@
 #include <time.h>
 
 static void
-_garble_privacy_free(garble_circuit *restrict gc, const AES_KEY *restrict key, block delta)
+_garble_privacy_free(garble_circuit *restrict gc, const AES_KEY *restrict key,
+                     block delta, size_t start, size_t end, block *restrict table)
 {
-    size_t nxors = 0;
-    for (uint64_t i = 0; i < gc->q; ++i) {
+    size_t nfree = 0;
+    for (size_t i = start; i < end; ++i) {
         garble_gate *g = &gc->gates[i];
-        nxors += (g->type == GARBLE_GATE_XOR) ? 1 : 0;
+        nfree += garble_gate_is_free(g->type) ? 1 : 0;
         garble_gate_garble_privacy_free(g->type,
                                         gc->wires[2 * g->input0],
                                         gc->wires[2 * g->input0 + 1],
@@ -23,19 +25,20 @@ _garble_privacy_free(garble_circuit *restrict gc, const AES_KEY *restrict key, b
                                         gc->wires[2 * g->input1 + 1],
                                         &gc->wires[2 * g->output],
                                         &gc->wires[2 * g->output + 1],
-                                        delta, &gc->table[i - nxors], i, key);
+                                        delta, &table[i - start - nfree], i, key);
     }
 }
 
 
 static void
-_garble_halfgates(garble_circuit *restrict gc, const AES_KEY *restrict key, block delta)
+_garble_halfgates(garble_circuit *restrict gc, const AES_KEY *restrict key,
+                  block delta, size_t start, size_t end, block *restrict table)
 {
-    size_t nxors = 0;
-    for (size_t i = 0; i < gc->q; i++) {
+    size_t nfree = 0;
+    for (size_t i = start; i < end; i++) {
         garble_gate *g = &gc->gates[i];
-        bool isxor = g->type == GARBLE_GATE_XOR;
-        nxors += isxor ? 1 : 0;
+        bool isfree = garble_gate_is_free(g->type);
+        nfree += isfree ? 1 : 0;
         garble_gate_garble_halfgates(g->type,
                                      gc->wires[2 * g->input0],
                                      gc->wires[2 * g->input0 + 1],
@@ -43,17 +46,18 @@ _garble_halfgates(garble_circuit *restrict gc, const AES_KEY *restrict key, bloc
                                      gc->wires[2 * g->input1 + 1],
                                      &gc->wires[2 * g->output],
                                      &gc->wires[2 * g->output + 1],
-                                     delta, isxor ? NULL : &gc->table[2 * (i - nxors)], i, key);
+                                     delta, isfree ? NULL : &table[2 * (i - start - nfree)], i, key);
     }
 }
 
 static void
-_garble_standard(garble_circuit *restrict gc, const AES_KEY *restrict key, block delta)
+_garble_standard(garble_circuit *restrict gc, const AES_KEY *restrict key,
+                 block delta, size_t start, size_t end, block *restrict table)
 {
-    size_t nxors = 0;
-    for (size_t i = 0; i < gc->q; i++) {
+    size_t nfree = 0;
+    for (size_t i = start; i < end; i++) {
         garble_gate *g = &gc->gates[i];
-        nxors += (g->type == GARBLE_GATE_XOR) ? 1 : 0;
+        nfree += garble_gate_is_free(g->type) ? 1 : 0;
         garble_gate_garble_standard(g->type,
                                     gc->wires[2 * g->input0],
                                     gc->wires[2 * g->input0 + 1],
@@ -61,26 +65,39 @@ _garble_standard(garble_circuit *restrict gc, const AES_KEY *restrict key, block
                                     gc->wires[2 * g->input1 + 1],
                                     &gc->wires[2 * g->output],
                                     &gc->wires[2 * g->output + 1],
-                                    delta, &gc->table[3 * (i - nxors)], i, key);
+                                    delta, &table[3 * (i - start - nfree)], i, key);
     }
 }
 
-int
-garble_garble(garble_circuit *restrict gc, const block *restrict input_labels,
-              block *restrict output_labels)
+void
+_garble_gates(garble_circuit *restrict gc, const AES_KEY *restrict key,
+              block delta, size_t start, size_t end, block *restrict table)
 {
-    AES_KEY key;
-    block delta;
+    switch (gc->type) {
+    case GARBLE_TYPE_STANDARD:
+        _garble_standard(gc, key, delta, start, end, table);
+        break;
+    case GARBLE_TYPE_HALFGATES:
+        _garble_halfgates(gc, key, delta, start, end, table);
+        break;
+    case GARBLE_TYPE_PRIVACY_FREE:
+        _garble_privacy_free(gc, key, delta, start, end, table);
+        break;
+    }
+}
 
-    if (gc == NULL)
-        return GARBLE_ERR;
+int
+_garble_init(garble_circuit *restrict gc, const block *restrict input_labels,
+             AES_KEY *restrict key, block *restrict delta, bool alloc_table)
+{
+    uint64_t index;
 
     if (gc->wires == NULL) {
         gc->wires = calloc(2 * gc->r, sizeof(block));
         if (gc->wires == NULL)
             return GARBLE_ERR;
     }
-    if (gc->table == NULL) {
+    if (alloc_table && gc->table == NULL) {
         gc->table = calloc(gc->q - gc->nxors, garble_table_size(gc));
         if (gc->table == NULL)
             return GARBLE_ERR;
@@ -91,52 +108,53 @@ garble_garble(garble_circuit *restrict gc, const block *restrict input_labels,
             return GARBLE_ERR;
     }
 
+    /* Reserve all random blocks up front, in the order delta, input labels,
+     * fixed label, global key, so concurrent garblings draw disjoint blocks
+     * with a single atomic update */
+    index = _garble_random_reserve(input_labels ? 2 : gc->n + 3);
     if (input_labels) {
         for (uint64_t i = 0; i < gc->n; ++i) {
             gc->wires[2 * i] = input_labels[2 * i];
             gc->wires[2 * i + 1] = input_labels[2 * i + 1];
         }
         /* assumes same delta for all 0/1 labels in 'inputs' */
-        delta = garble_xor(gc->wires[0], gc->wires[1]);
+        *delta = garble_xor(gc->wires[0], gc->wires[1]);
     } else {
-        delta = garble_create_delta();
+        _garble_random_fill(delta, 1, 1, index++);
+        *((char *) delta) |= 1;
+        _garble_random_fill(gc->wires, gc->n, 2, index);
+        index += gc->n;
         for (uint64_t i = 0; i < gc->n; ++i) {
-            gc->wires[2 * i] = garble_random_block();
             if (gc->type == GARBLE_TYPE_PRIVACY_FREE) {
                 /* zero label should have 0 permutation bit */
                 *((char *) &gc->wires[2 * i]) &= 0xfe;
             }
-            gc->wires[2 * i + 1] = garble_xor(gc->wires[2 * i], delta);
+            gc->wires[2 * i + 1] = garble_xor(gc->wires[2 * i], *delta);
         }
     }
 
     {
-        block fixed_label = garble_random_block();
+        block fixed_label;
+        _garble_random_fill(&fixed_label, 1, 1, index++);
         gc->fixed_label = fixed_label;
 
         *((char *) &fixed_label) &= 0xfe;
         gc->wires[2 * gc->n] = fixed_label;
-        gc->wires[2 * gc->n + 1] = garble_xor(fixed_label, delta);
+        gc->wires[2 * gc->n + 1] = garble_xor(fixed_label, *delta);
         *((char *) &fixed_label) |= 0x01;
-        gc->wires[2 * (gc->n + 1)] = garble_xor(fixed_label, delta);
+        gc->wires[2 * (gc->n + 1)] = garble_xor(fixed_label, *delta);
         gc->wires[2 * (gc->n + 1) + 1] = fixed_label;
     }
 
-    gc->global_key = garble_random_block();
-    AES_set_encrypt_key(gc->global_key, &key);
+    _garble_random_fill(&gc->global_key, 1, 1, index);
+    AES_set_encrypt_key(gc->global_key, key);
 
-    switch (gc->type) {
-    case GARBLE_TYPE_STANDARD:
-        _garble_standard(gc, &key, delta);
-        break;
-    case GARBLE_TYPE_HALFGATES:
-        _garble_halfgates(gc, &key, delta);
-        break;
-    case GARBLE_TYPE_PRIVACY_FREE:
-        _garble_privacy_free(gc, &key, delta);
-        break;
-    }
+    return GARBLE_OK;
+}
 
+void
+_garble_finish(garble_circuit *restrict gc, block *restrict output_labels)
+{
     for (uint64_t i = 0; i < gc->m; ++i) {
         gc->output_perms[i] = *((char *) &gc->wires[2 * gc->outputs[i]]) & 0x1;
     }
@@ -147,6 +165,22 @@ garble_garble(garble_circuit *restrict gc, const block *restrict input_labels,
             output_labels[2*i+1] = gc->wires[2 * gc->outputs[i] + 1];
         }
     }
+}
+
+int
+garble_garble(garble_circuit *restrict gc, const block *restrict input_labels,
+              block *restrict output_labels)
+{
+    AES_KEY key;
+    block delta;
+
+    if (gc == NULL)
+        return GARBLE_ERR;
+
+    if (_garble_init(gc, input_labels, &key, &delta, true) == GARBLE_ERR)
+        return GARBLE_ERR;
+    _garble_gates(gc, &key, delta, 0, gc->q, gc->table);
+    _garble_finish(gc, output_labels);
 
     return GARBLE_OK;
 }
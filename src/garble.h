@@ -1,11 +1,13 @@
 #ifndef LIBGARBLE_H
 #define LIBGARBLE_H
 
+#include "garble/aes.h"
 #include "garble/block.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 #include <openssl/sha.h>
 
 #define GARBLE_OK    0
@@ -30,8 +32,19 @@ typedef enum {
     GARBLE_GATE_OR,
     GARBLE_GATE_XOR,
     GARBLE_GATE_NOT,
+    GARBLE_GATE_XNOR,
 } garble_gate_type_e;
 
+/* Whether gates of 'type' are free: garbled without a table row or any
+ * AES call.  NOT swaps the labels of its input and XNOR is XOR with the
+ * labels swapped. */
+static inline bool
+garble_gate_is_free(garble_gate_type_e type)
+{
+    return type == GARBLE_GATE_XOR || type == GARBLE_GATE_XNOR
+        || type == GARBLE_GATE_NOT;
+}
+
 typedef struct {
     /* The type of gate this is */
     garble_gate_type_e type;
@@ -55,7 +68,7 @@ typedef struct {
     /* q: number of gates */
     /* r: number of wires */
     size_t n, m, q, r;
-    /* number of xor gates */
+    /* number of free gates (XOR, XNOR and NOT), which take no table row */
     size_t nxors;
     /* garbling scheme type */
     garble_type_e type;
@@ -71,6 +84,11 @@ typedef struct {
     block fixed_label;
     /* key used for fixed-key AES */
     block global_key;
+
+    /* read-only file mapping set by garble_load_mmap, released by
+     * garble_delete; arrays pointing into it are not freed */
+    void *mapping;
+    size_t mapping_size;
 } garble_circuit;
 
 /* Return the table size of a garbled circuit */
@@ -136,19 +154,521 @@ int
 garble_map_outputs(const block *output_labels, const block *map, bool *vals,
                    size_t m);
 
-/* write/read circuit description to/from file */
+/* Default number of gates per chunk in a garble_dag */
+#define GARBLE_DAG_CHUNK_SIZE 128
+
+/* Chunk-level dependency graph over the gates of a circuit, used to garble and
+ * evaluate in parallel.  Gates are split into contiguous chunks of
+ * 'chunk_size' gates; a chunk becomes ready once every chunk producing one of
+ * its input wires has finished. */
+typedef struct {
+    /* number of gates covered */
+    size_t q;
+    /* gates per chunk */
+    size_t chunk_size;
+    size_t nchunks;
+    size_t *rows;               /* nchunks: table row of each chunk's first gate */
+    size_t *ndeps;              /* nchunks: number of distinct predecessor chunks */
+    size_t *succ_start;         /* nchunks + 1: offsets into 'succs' */
+    size_t *succs;              /* fan-out lists of successor chunks */
+} garble_dag;
+
+/* Build the chunk dependency graph of 'gc'.  The graph only depends on the
+ * circuit topology, so it can be reused across garblings and evaluations.
+   If 'chunk_size' is 0, use GARBLE_DAG_CHUNK_SIZE.
+ */
+int
+garble_dag_new(garble_dag *dag, const garble_circuit *gc, size_t chunk_size);
+void
+garble_dag_delete(garble_dag *dag);
+/* Same as garble_garble, but runs ready chunks on 'nthreads' threads using
+ * work-stealing deques.  Produces the same table as garble_garble. */
+int
+garble_garble_parallel(garble_circuit *gc, const garble_dag *dag,
+                       const block *input_labels, block *output_labels,
+                       size_t nthreads);
+/* Same as garble_eval, but runs ready chunks on 'nthreads' threads */
+int
+garble_eval_parallel(const garble_circuit *gc, const garble_dag *dag,
+                     const block *input_labels, block *output_labels,
+                     bool *outputs, size_t nthreads);
+
+/* Placement statistics reported by garble_garble_numa */
+typedef struct {
+    /* number of NUMA nodes workers were spread over */
+    size_t nnodes;
+    /* chunks garbled on (resp. off) the node owning their memory */
+    size_t local_chunks, remote_chunks;
+    /* table and label pages resident on (resp. off) their owner's node; both
+     * are 0 without libnuma */
+    size_t local_pages, remote_pages;
+} garble_numa_stats;
+
+/* Same as garble_garble_parallel, but NUMA-aware: each worker owns a
+   contiguous range of chunks, is bound to a node, and first-touches the table
+   rows and output labels of its chunks so they are placed on that node.
+   Ready chunks are stolen within a node before crossing nodes.
+   Placement only applies when 'gc->table' and 'gc->wires' are NULL on entry.
+   If 'stats' is not NULL, it receives local/remote placement statistics.
+ */
+int
+garble_garble_numa(garble_circuit *gc, const garble_dag *dag,
+                   const block *input_labels, block *output_labels,
+                   size_t nthreads, garble_numa_stats *stats);
+
+/* Gates garbled per ring slot, and number of ring slots, in
+ * garble_garble_pipelined */
+#define GARBLE_PIPELINE_GATES 4096
+#define GARBLE_PIPELINE_SLOTS 8
+
+/* Garbles 'gc' and writes it to 'fd' in the same format as garble_save with
+   the same 'table_only' and 'wires' false, overlapping garbling, hashing and
+   writing on three threads.  If 'table_only' is set, the gates and outputs
+   are left out, as garble_save does, and the reader must already have them.
+   The table is streamed through a bounded ring and 'gc->table' is never
+   allocated: it stays NULL for a circuit that was not garbled before.
+   garble_hash, garble_eval and garble_save therefore must not be called on
+   'gc' afterwards unless the table is first loaded back from 'fd', e.g. with
+   garble_load_fd and the same 'table_only'.
+   If 'hash' is not NULL, it receives the same digest as garble_hash.
+ */
+int
+garble_garble_pipelined(garble_circuit *gc, const block *input_labels,
+                        block *output_labels, int fd, bool table_only,
+                        unsigned char hash[SHA_DIGEST_LENGTH]);
+
+/* Same as garble_garble, but splits the gates into 'nshards' contiguous shards
+ * garbled by forked worker processes.  Labels are handed off between shards
+ * through shared memory and the per-shard table segments are stitched back
+ * into 'gc->table'.  Produces the same table as garble_garble. */
+int
+garble_garble_sharded(garble_circuit *gc, const block *input_labels,
+                      block *output_labels, size_t nshards);
+/* Same as garble_eval, but evaluates 'nshards' shards in forked workers */
+int
+garble_eval_sharded(const garble_circuit *gc, const block *input_labels,
+                    block *output_labels, bool *outputs, size_t nshards);
+
+/* A batch of independent circuits garbled or evaluated together.  Wires,
+ * tables and output permutation bits of all instances are carved out of a
+ * single pooled allocation, so a batch of many small circuits costs a handful
+ * of allocations instead of several per circuit. */
+typedef struct {
+    garble_circuit *gcs;        /* count: instances, owned by the caller */
+    size_t count;
+    void *pool;                 /* backing store of the instances' arrays */
+    size_t pool_size;
+    size_t max_r;               /* largest number of wires of any instance */
+} garble_batch;
+
+/* Set up a batch over 'gcs', pointing the 'wires', 'table' and 'output_perms'
+   of every instance that has them NULL into a shared pool. */
+int
+garble_batch_new(garble_batch *batch, garble_circuit *gcs, size_t count);
+/* Release the pool and reset the pooled pointers of every instance to NULL;
+   the instances themselves still need garble_delete. */
+void
+garble_batch_delete(garble_batch *batch);
+/* Garble every instance on 'nthreads' threads.
+   If 'input_labels' is NULL, generate input-wire labels for all instances;
+   otherwise 'input_labels[i]' is passed to instance i as in garble_garble.
+   If 'output_labels' is not NULL, 'output_labels[i]' receives the output-wire
+   labels of instance i.
+ */
+int
+garble_batch_garble(garble_batch *batch, const block *const *input_labels,
+                    block *const *output_labels, size_t nthreads);
+/* Evaluate every instance on 'nthreads' threads.  'input_labels[i]' holds the
+   input labels of instance i; 'output_labels' and 'outputs', if not NULL,
+   receive per-instance results as in garble_eval.
+ */
+int
+garble_batch_eval(const garble_batch *batch, const block *const *input_labels,
+                  block *const *output_labels, bool *const *outputs,
+                  size_t nthreads);
+
+/* Maximum number of instances garbled in lockstep */
+#define GARBLE_LOCKSTEP_MAX 16
+
+/* Several instances of one circuit topology garbled in lockstep: the gates
+ * are walked once and every gate hashes the labels of all instances in one
+ * AES batch.  Zero labels are kept transposed in 'labels', so that the
+ * labels of one wire across all instances are adjacent. */
+typedef struct {
+    garble_circuit *gcs;        /* k: instances, owned by the caller */
+    size_t k;
+    block *labels;              /* r * k: transposed zero labels */
+} garble_lockstep;
+
+/* Set up lockstep garbling of 'k' (at most GARBLE_LOCKSTEP_MAX) instances
+   'gcs', which must all have the same gates, n, m, q, r, nxors and type.
+ */
+int
+garble_lockstep_new(garble_lockstep *ls, garble_circuit *gcs, size_t k);
+void
+garble_lockstep_delete(garble_lockstep *ls);
+/* Garbles every instance, producing the same tables as garble_garble.
+   'input_labels' and 'output_labels', if not NULL, hold one array per
+   instance as in garble_garble.  Only the input, fixed and output wire labels
+   are stored in each instance's 'wires'.
+ */
+int
+garble_lockstep_garble(garble_lockstep *ls, const block *const *input_labels,
+                       block *const *output_labels);
+
+/* Resumable garbling or evaluation of a single circuit, processed in bounded
+ * slices of gates so that it can be interleaved with other work such as
+ * non-blocking I/O. */
+typedef struct {
+    const garble_circuit *gc;
+    garble_circuit *garbling;   /* 'gc' when garbling, NULL when evaluating */
+    AES_KEY key;
+    block delta;                /* garbling only */
+    block *labels;              /* evaluation only: r */
+    size_t next;                /* next gate to process */
+    size_t row;                 /* table row of the next non-XOR gate */
+} garble_task;
+
+/* Start garbling 'gc'; 'input_labels' is used as in garble_garble */
+int
+garble_task_garble(garble_task *task, garble_circuit *gc,
+                   const block *input_labels);
+/* Start evaluating 'gc' on 'input_labels' */
+int
+garble_task_eval(garble_task *task, const garble_circuit *gc,
+                 const block *input_labels);
+/* Process at most 'max_gates' more gates */
+int
+garble_task_step(garble_task *task, size_t max_gates);
+static inline bool
+garble_task_done(const garble_task *task)
+{
+    return task->next == task->gc->q;
+}
+/* Complete a task once garble_task_done holds.  When garbling,
+   'output_labels' is as in garble_garble and 'outputs' is ignored; when
+   evaluating, both are as in garble_eval.  Releases the task.
+ */
+int
+garble_task_finish(garble_task *task, block *output_labels, bool *outputs);
+/* Release a task without finishing it */
+void
+garble_task_delete(garble_task *task);
+
+/* A garbled instance handed out by a garble_pool.  'gc' owns its table,
+ * wires and output permutation bits; its gates and outputs are shared with the
+ * registered circuit and must not be freed, so release instances with
+ * garble_pool_instance_delete or garble_pool_recycle, never garble_delete. */
+typedef struct {
+    garble_circuit gc;
+    block *output_map;          /* 2 * m: output labels */
+} garble_pool_instance;
+
+/* Pool of pre-garbled instances of one circuit, refilled in the background */
+typedef struct garble_pool garble_pool;
+
+/* Register 'gc' (only its topology is used, and it must outlive the pool) and
+   start 'nthreads' idle-priority threads keeping up to 'capacity' garbled
+   instances ready.  Returns NULL on failure.
+ */
+garble_pool *
+garble_pool_new(const garble_circuit *gc, size_t capacity, size_t nthreads);
+void
+garble_pool_delete(garble_pool *pool);
+/* Move a ready instance into 'inst'; the caller becomes its owner.  If none is
+   ready, wait for one if 'wait' is set, and fail otherwise.  Waiting also
+   fails once every refill thread has stopped on a garbling error.
+ */
+int
+garble_pool_take(garble_pool *pool, garble_pool_instance *inst, bool wait);
+/* Number of instances ready to be taken */
+size_t
+garble_pool_ready(garble_pool *pool);
+/* Hand an evaluated instance back so its buffers are reused for refilling */
+void
+garble_pool_recycle(garble_pool *pool, garble_pool_instance *inst);
+void
+garble_pool_instance_delete(garble_pool_instance *inst);
+
+/* Default number of table rows per chunk in streaming garbling */
+#define GARBLE_STREAM_ROWS 1024
+
+/* Callback receiving the next 'len' bytes of a stream */
+typedef int (*garble_write_fn)(void *arg, const void *buf, size_t len);
+/* Callback reading up to 'len' bytes of a stream into 'buf'; returns the
+ * number of bytes read, or 0 or -1 at end of stream or on error */
+typedef ssize_t (*garble_read_fn)(void *arg, void *buf, size_t len);
+
+/* State for garbling or evaluating a circuit as a stream of table chunks,
+ * with memory bounded by the circuit width: the table is produced or consumed
+ * 'chunk_rows' rows at a time, and wires are mapped onto 'nslots' label slots
+ * that are reused once a wire is no longer read. */
+typedef struct {
+    size_t q;
+    size_t nslots;              /* labels live at once */
+    garble_gate *gates;         /* q: gates over label slots */
+    int *outputs;               /* m: slot of each output wire */
+    size_t chunk_rows;
+    block *labels;              /* 2 * nslots */
+    block *chunk;               /* chunk_rows table rows */
+} garble_stream;
+
+/* Plan streaming for the topology of 'gc'; the plan can be reused for any
+   number of garblings.  If 'chunk_rows' is 0, use GARBLE_STREAM_ROWS.
+ */
+int
+garble_stream_new(garble_stream *stream, const garble_circuit *gc,
+                  size_t chunk_rows);
+void
+garble_stream_delete(garble_stream *stream);
+/* Garbles 'gc', passing the table to 'write' in chunks of at most
+   'chunk_rows' rows, in order.  'gc->table' and 'gc->wires' are not used; the
+   input labels are left in 'stream->labels[0 .. 2n)' and 'gc->fixed_label',
+   'gc->global_key' and 'gc->output_perms' are set as by garble_garble.
+   'input_labels' and 'output_labels' are as in garble_garble.
+ */
+int
+garble_stream_garble(garble_stream *stream, garble_circuit *gc,
+                     const block *input_labels, block *output_labels,
+                     garble_write_fn write, void *arg);
+/* Same as garble_stream_garble, writing the table to 'fd' */
+int
+garble_stream_garble_fd(garble_stream *stream, garble_circuit *gc,
+                        const block *input_labels, block *output_labels,
+                        int fd);
+/* Evaluates 'gc', reading its table in order from 'read' and evaluating each
+   gate as soon as its row has arrived.  'gc->table' is not used; 'stream'
+   must have been planned with the same chunk size as the garbler's.
+   'input_labels', 'output_labels' and 'outputs' are as in garble_eval.
+ */
+int
+garble_stream_eval(garble_stream *stream, const garble_circuit *gc,
+                   const block *input_labels, block *output_labels,
+                   bool *outputs, garble_read_fn read, void *arg);
+/* Same as garble_stream_eval, reading the table from 'fd' */
+int
+garble_stream_eval_fd(garble_stream *stream, const garble_circuit *gc,
+                      const block *input_labels, block *output_labels,
+                      bool *outputs, int fd);
+
+/* Requested socket buffer size of channels made by garble_channel_pair */
+#define GARBLE_CHANNEL_BUFFER (1 << 20)
+
+/* One end of a byte channel between a garbler and an evaluator */
+typedef struct {
+    int fd;
+    /* bytes sent and received so far */
+    size_t sent, received;
+} garble_channel;
+
+/* Wraps a connected stream socket, pipe or other fd; the channel owns 'fd' */
+void
+garble_channel_open(garble_channel *ch, int fd);
+/* Creates a connected pair of channels over a Unix socketpair */
+int
+garble_channel_pair(garble_channel *garbler, garble_channel *evaluator);
+void
+garble_channel_close(garble_channel *ch);
+int
+garble_channel_send(garble_channel *ch, const void *buf, size_t len);
+/* Receives exactly 'len' bytes */
+int
+garble_channel_recv(garble_channel *ch, void *buf, size_t len);
+/* Receives at most 'len' bytes; returns the number received, or 0 or -1 at
+ * end of stream or on error */
+ssize_t
+garble_channel_recv_some(garble_channel *ch, void *buf, size_t len);
+/* Sends 'len' bytes of 'fd' starting at 'offset' with sendfile, or with
+ * splice through a pipe where sendfile does not apply; the data never passes
+ * through user memory.  The file offset of 'fd' is not changed. */
+int
+garble_channel_sendfile(garble_channel *ch, int fd, off_t offset, size_t len);
+/* Serves the circuit saved by garble_save in 'fd' with
+   garble_channel_sendfile; the peer loads it with garble_channel_recv_saved */
+int
+garble_channel_send_saved(garble_channel *ch, int fd);
+/* Serves only the table section of the circuit saved in 'fd', for a peer that
+   already holds the rest of the circuit */
+int
+garble_channel_send_table(garble_channel *ch, int fd);
+/* Loads a circuit sent by garble_channel_send_saved, as garble_load_fd */
+int
+garble_channel_recv_saved(garble_channel *ch, garble_circuit *gc,
+                          bool table_only, bool wires);
+
+/* Garbles 'gc' with garble_stream_garble, sending its fixed label, global
+   key, table and output permutation bits on 'ch' while garbling.  Evaluator
+   input labels are not sent.
+ */
+int
+garble_channel_garble(garble_channel *ch, garble_stream *stream,
+                      garble_circuit *gc, const block *input_labels,
+                      block *output_labels);
+/* Receives a circuit sent by garble_channel_garble and evaluates it with
+   garble_stream_eval as it arrives.  'gc' holds the same topology as the
+   garbler's; its fixed label, global key and output permutation bits are set
+   from the channel.  'input_labels', 'output_labels' and 'outputs' are as in
+   garble_eval.
+ */
+int
+garble_channel_eval(garble_channel *ch, garble_stream *stream,
+                    garble_circuit *gc, const block *input_labels,
+                    block *output_labels, bool *outputs);
+
+/* Write/read the circuit description (topology, garbling type and output
+   permutation bits) to/from 'fname' in the native SCD v2 format.  Loading
+   validates gate types and wire indices, and computes 'r' and 'nxors'. */
 int
 garble_circuit_to_file(garble_circuit *gc, char *fname);
 int
 garble_circuit_from_file(garble_circuit *gc, char *fname);
 
+/* Compact encoding of the topology of 'gc' (n, m, q, r, type, gates and
+   outputs): LEB128 varints, with gate types in the low bits and wire
+   indices delta-encoded against each gate's output wire.  Loading fills in
+   the topology and 'nxors' of a fresh circuit, as garble_new would.
+   garble_topology_to_buffer returns a malloc'ed buffer and its size. */
+char *
+garble_topology_to_buffer(const garble_circuit *gc, size_t *size);
+int
+garble_topology_from_buffer(garble_circuit *gc, const char *buf, size_t size);
+int
+garble_topology_save(const garble_circuit *gc, FILE *f);
+int
+garble_topology_load(garble_circuit *gc, FILE *f);
+
+/* Reads a Bristol Fashion netlist from 'f' into a fresh circuit garbled with
+   'type', in one pass.  XOR, AND, INV, EQ, EQW and MAND gates are supported;
+   the inputs of all parties are concatenated into the 'n' circuit inputs, and
+   the outputs of all parties into the 'm' circuit outputs. */
+int
+garble_load_bristol(garble_circuit *gc, FILE *f, garble_type_e type);
+
 size_t
 garble_size(const garble_circuit *restrict gc, bool table_only, bool wires);
 
+/* Save/load 'gc'.  Fields are written with writev(2) straight from the
+   arrays of 'gc', and read back straight into freshly allocated arrays, with
+   no intermediate buffer */
 int
 garble_save(const garble_circuit *gc, FILE *f, bool table_only, bool wires);
 int
 garble_load(garble_circuit *gc, FILE *f, bool table_only, bool wires);
+int
+garble_save_fd(const garble_circuit *gc, int fd, bool table_only, bool wires);
+int
+garble_load_fd(garble_circuit *gc, int fd, bool table_only, bool wires);
+/* Locates the table of the circuit saved by garble_save at the start of 'fd':
+   its file offset and length, and the length of the whole saved circuit */
+int
+garble_saved_table(int fd, off_t *offset, size_t *len, size_t *total);
+
+/* Alignment of each section in the garble_save_mmap layout */
+#define GARBLE_MAP_ALIGN 64
+
+/* Save 'gc' (without wires) in a layout that garble_load_mmap can map in
+   place: a header, then the table, gates, outputs and output permutation
+   bits, each aligned to GARBLE_MAP_ALIGN bytes. */
+int
+garble_save_mmap(const garble_circuit *gc, int fd);
+/* Load a circuit saved by garble_save_mmap by mapping 'fd' read-only: the
+   table, gates, outputs and output permutation bits point into the mapping
+   and are faulted in lazily.  The result can be evaluated but not garbled;
+   'fd' may be closed afterwards.
+ */
+int
+garble_load_mmap(garble_circuit *gc, int fd);
+
+/* Container format version written by garble_container_save */
+#define GARBLE_CONTAINER_VERSION 2
+/* Alignment of every container section */
+#define GARBLE_CONTAINER_ALIGN 64
+/* Default number of gates per table segment */
+#define GARBLE_CONTAINER_SEGMENT 65536
+
+typedef enum {
+    GARBLE_SECTION_GATES,
+    GARBLE_SECTION_OUTPUTS,
+    GARBLE_SECTION_OUTPUT_PERMS,
+    /* table rows of gates [start, end) */
+    GARBLE_SECTION_TABLE,
+    /* chunk schedule of a garble_dag */
+    GARBLE_SECTION_SCHEDULE,
+} garble_section_e;
+
+/* Container directory entry */
+typedef struct {
+    uint32_t kind;              /* garble_section_e */
+    uint32_t checksum;          /* CRC-32C of the section's bytes */
+    uint64_t offset, size;      /* position in the file, in bytes */
+    uint64_t start, end;        /* gates covered by a table segment */
+} garble_section;
+
+/* An open container: the header fields of the circuit (without any arrays)
+ * and the section directory */
+typedef struct {
+    int fd;
+    garble_circuit gc;
+    size_t nsections;
+    garble_section *sections;
+} garble_container;
+
+/* Writes 'gc' to 'fd' as a sectioned container, with the table split into
+   segments of 'segment_gates' gates.  If 'dag' is not NULL, its schedule is
+   stored too, and 'segment_gates' defaults to its chunk size; otherwise it
+   defaults to GARBLE_CONTAINER_SEGMENT.
+ */
+int
+garble_container_save(const garble_circuit *gc, const garble_dag *dag,
+                      size_t segment_gates, int fd);
+/* Reads and checks the header and directory of the container in 'fd'.
+   Sections are read on demand; 'fd' must stay open until
+   garble_container_close, which does not close it. */
+int
+garble_container_open(garble_container *c, int fd);
+void
+garble_container_close(garble_container *c);
+/* First section of 'kind', or for GARBLE_SECTION_TABLE the segment
+   containing 'gate'; NULL if there is none */
+const garble_section *
+garble_container_find(const garble_container *c, garble_section_e kind,
+                      size_t gate);
+/* Reads section 's' into 'buf' ('s->size' bytes) and checks its checksum.
+   Safe to call concurrently. */
+int
+garble_container_read(const garble_container *c, const garble_section *s,
+                      void *buf);
+/* Reads the whole circuit, checking every section */
+int
+garble_container_load(const garble_container *c, garble_circuit *gc);
+/* Reads the stored schedule into 'dag', failing unless it matches the
+   schedule garble_dag_new builds from the stored gates */
+int
+garble_container_load_schedule(const garble_container *c, garble_dag *dag);
+
+/* Number of table rows per chunk written or read by the io_uring backend; a
+   multiple of 256 keeps every chunk GARBLE_URING_ALIGN-aligned */
+#define GARBLE_URING_ROWS 16384
+/* Number of chunks in flight */
+#define GARBLE_URING_DEPTH 4
+/* Buffer, offset and length alignment, as required by O_DIRECT */
+#define GARBLE_URING_ALIGN 4096
+
+/* Whether the kernel lets us set up an io_uring; if not, the functions below
+   fall back to synchronous pwrite/pread */
+bool
+garble_uring_available(void);
+/* Garbles 'gc' and writes the raw table (in gate order, as in 'gc->table') to
+   'fd', overlapping the writes with garbling; 'gc->table' is not allocated.
+   'fd' may be opened with O_DIRECT. */
+int
+garble_garble_uring(garble_circuit *gc, const block *input_labels,
+                    block *output_labels, int fd);
+/* Evaluates 'gc' reading the table written by garble_garble_uring from 'fd',
+   with reads of the next chunks in flight */
+int
+garble_eval_uring(const garble_circuit *gc, const block *input_labels,
+                  block *output_labels, bool *outputs, int fd);
 
 char *
 garble_to_buffer(const garble_circuit *gc, char *buf, bool table_only, bool wires);
@@ -22,6 +22,9 @@ block
 garble_seed(block *seed);
 block
 garble_random_block(void);
+/* Fill 'blocks' with 'nblocks' random blocks; safe to call concurrently */
+void
+garble_random_blocks(block *blocks, size_t nblocks);
 block *
 garble_allocate_blocks(size_t nblocks);
 
@@ -12,7 +12,7 @@ garble_gate_eval_halfgates(garble_gate_type_e type, block A, block B,
                            block *restrict out, const block *restrict table,
                            size_t idx, const AES_KEY *restrict key)
 {
-    if (type == GARBLE_GATE_XOR) {
+    if (type == GARBLE_GATE_XOR || type == GARBLE_GATE_XNOR) {
         *out = garble_xor(A, B);
     } else if (type == GARBLE_GATE_NOT) {
         *out = A;
@@ -60,6 +60,9 @@ garble_gate_garble_halfgates(garble_gate_type_e type, block A0, block A1, block
     if (type == GARBLE_GATE_XOR) {
         *out0 = garble_xor(A0, B0);
         *out1 = garble_xor(*out0, delta);
+    } else if (type == GARBLE_GATE_XNOR) {
+        *out1 = garble_xor(A0, B0);
+        *out0 = garble_xor(*out1, delta);
     } else if (type == GARBLE_GATE_NOT) {
         *out0 = A1;
         *out1 = A0;
@@ -69,6 +72,11 @@ garble_gate_garble_halfgates(garble_gate_type_e type, block A0, block A1, block
         block HA0, HA1, HB0, HB1;
         block tmp, W0;
 
+        if (type == GARBLE_GATE_OR) {
+            /* a | b = ~(~a & ~b), see garble_gate_standard.h */
+            tmp = A0; A0 = A1; A1 = tmp;
+            tmp = B0; B0 = B1; B1 = tmp;
+        }
         pa = garble_lsb(A0);
         pb = garble_lsb(B0);
 
@@ -100,6 +108,8 @@ garble_gate_garble_halfgates(garble_gate_type_e type, block A0, block A1, block
         if (pb)
             W0 = garble_xor(W0, tmp);
 
+        if (type == GARBLE_GATE_OR)
+            W0 = garble_xor(W0, delta);
         *out0 = W0;
         *out1 = garble_xor(*out0, delta);
     }
@@ -7,6 +7,12 @@
 #include <assert.h>
 #include <string.h>
 
+/* Zero labels must keep a clear permutation bit, so a wire is complemented
+ * by XORing its labels with this public block, whose permutation bit is set,
+ * rather than by swapping them */
+#define garble_privacy_free_not_mask() \
+    garble_make_block((uint64_t) 0, (uint64_t) 1)
+
 static inline void
 garble_gate_eval_privacy_free(garble_gate_type_e type, block A, block B,
                               block *restrict out,
@@ -15,13 +21,21 @@ garble_gate_eval_privacy_free(garble_gate_type_e type, block A, block B,
 {
     if (type == GARBLE_GATE_XOR) {
         *out = garble_xor(A, B);
+    } else if (type == GARBLE_GATE_XNOR) {
+        *out = garble_xor(garble_xor(A, B), garble_privacy_free_not_mask());
     } else if (type == GARBLE_GATE_NOT) {
-        *out = A;
+        *out = garble_xor(A, garble_privacy_free_not_mask());
     } else {
         block HA, W;
         bool sa;
         block tweak;
 
+        if (type == GARBLE_GATE_OR) {
+            /* a | b = ~(~a & ~b), see garble_gate_garble_privacy_free */
+            A = garble_xor(A, garble_privacy_free_not_mask());
+            B = garble_xor(B, garble_privacy_free_not_mask());
+        }
+
         sa = garble_lsb(A);
 
         tweak = garble_make_block(2 * idx, (uint64_t) 0);
@@ -42,6 +56,8 @@ garble_gate_eval_privacy_free(garble_gate_type_e type, block A, block B,
             *((char *) &HA) &= 0xfe;
             W = HA;
         }
+        if (type == GARBLE_GATE_OR)
+            W = garble_xor(W, garble_privacy_free_not_mask());
         *out = W;
     }
 }
@@ -66,13 +82,24 @@ garble_gate_garble_privacy_free(garble_gate_type_e type, block A0, block A1,
     if (type == GARBLE_GATE_XOR) {
         *out0 = garble_xor(A0, B0);
         *out1 = garble_xor(*out0, delta);
+    } else if (type == GARBLE_GATE_XNOR) {
+        *out1 = garble_xor(garble_xor(A0, B0), garble_privacy_free_not_mask());
+        *out0 = garble_xor(*out1, delta);
     } else if (type == GARBLE_GATE_NOT) {
-        *out0 = A1;
-        *out1 = A0;
+        *out0 = garble_xor(A1, garble_privacy_free_not_mask());
+        *out1 = garble_xor(A0, garble_privacy_free_not_mask());
     } else {
         block tweak, tmp;
         block HA0, HA1;
 
+        if (type == GARBLE_GATE_OR) {
+            /* a | b = ~(~a & ~b): garble an AND with every wire
+             * complemented */
+            tmp = garble_xor(A1, garble_privacy_free_not_mask());
+            A1 = garble_xor(A0, garble_privacy_free_not_mask());
+            A0 = tmp;
+            B0 = garble_xor(B1, garble_privacy_free_not_mask());
+        }
         tweak = garble_make_block(2 * idx, (long) 0);
         {
             block masks[2], keys[2];
@@ -88,6 +115,9 @@ garble_gate_garble_privacy_free(garble_gate_type_e type, block A0, block A1,
         *((char *) &HA1) |= 0x01;
         tmp = garble_xor(HA0, HA1);
         table[0] = garble_xor(tmp, B0);
+        if (type == GARBLE_GATE_OR)
+            HA0 = garble_xor(garble_xor(HA0, delta),
+                             garble_privacy_free_not_mask());
         *out0 = HA0;
         *out1 = garble_xor(HA0, delta);
     }
@@ -12,7 +12,7 @@ garble_gate_eval_standard(garble_gate_type_e type, block A, block B,
                           block *restrict out, const block *restrict table,
                           uint64_t idx, const AES_KEY *restrict key)
 {
-    if (type == GARBLE_GATE_XOR) {
+    if (type == GARBLE_GATE_XOR || type == GARBLE_GATE_XNOR) {
         *out = garble_xor(A, B);
     } else if (type == GARBLE_GATE_NOT) {
         *out = A;
@@ -55,15 +55,24 @@ garble_gate_garble_standard(garble_gate_type_e type, block A0, block A1, block B
     if (type == GARBLE_GATE_XOR) {
         *out0 = garble_xor(A0, B0);
         *out1 = garble_xor(*out0, delta);
+    } else if (type == GARBLE_GATE_XNOR) {
+        *out1 = garble_xor(A0, B0);
+        *out0 = garble_xor(*out1, delta);
     } else if (type == GARBLE_GATE_NOT) {
         *out0 = A1;
         *out1 = A0;
     } else {
-        block tweak, blocks[4], keys[4], mask[4];
+        block tweak, blocks[4], keys[4], mask[4], tmp;
         block newToken, newToken2;
         block *label0, *label1;
         long lsb0, lsb1;
 
+        if (type == GARBLE_GATE_OR) {
+            /* a | b = ~(~a & ~b): garble an AND with every wire
+             * complemented, which the evaluator cannot tell apart */
+            tmp = A0; A0 = A1; A1 = tmp;
+            tmp = B0; B0 = B1; B1 = tmp;
+        }
         tweak = garble_make_block(idx, (uint64_t) 0);
         lsb0 = garble_lsb(A0);
         lsb1 = garble_lsb(B0);
@@ -109,6 +118,11 @@ garble_gate_garble_standard(garble_gate_type_e type, block A0, block A1, block B
             table[2*(1-lsb0) + lsb1-1] = garble_xor(blocks[2], mask[2]);
         if (2*(1-lsb0) + (1-lsb1) != 0)
             table[2*(1-lsb0) + (1-lsb1)-1] = garble_xor(blocks[3], mask[3]);
+        if (type == GARBLE_GATE_OR) {
+            tmp = *out0;
+            *out0 = *out1;
+            *out1 = tmp;
+        }
     }
 }
 
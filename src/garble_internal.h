@@ -0,0 +1,91 @@
+#ifndef LIBGARBLE_INTERNAL_H
+#define LIBGARBLE_INTERNAL_H
+
+/* Internal helpers shared between the sequential, parallel and streaming
+ * garbling/evaluation drivers.  Not installed. */
+
+#include "garble.h"
+#include "garble/aes.h"
+
+#include <sys/uio.h>
+
+/* Number of blocks a single non-XOR gate occupies in the garbled table */
+static inline size_t
+garble_table_blocks(const garble_circuit *restrict gc)
+{
+    return garble_table_size(gc) / sizeof(block);
+}
+
+/* Number of table rows used by gates [start, end) */
+static inline size_t
+garble_rows_in(const garble_circuit *restrict gc, size_t start, size_t end)
+{
+    size_t nrows = 0;
+    for (size_t i = start; i < end; ++i)
+        nrows += garble_gate_is_free(gc->gates[i].type) ? 0 : 1;
+    return nrows;
+}
+
+/* Set up input, fixed and key material for garbling 'gc'.  Allocates
+ * 'gc->wires' and 'gc->output_perms' if needed, and 'gc->table' if needed and
+ * 'alloc_table' is set. */
+int
+_garble_init(garble_circuit *restrict gc, const block *restrict input_labels,
+             AES_KEY *restrict key, block *restrict delta, bool alloc_table);
+/* Garble gates [start, end).  'table' points to the table row of the first
+ * non-XOR gate in the range. */
+void
+_garble_gates(garble_circuit *restrict gc, const AES_KEY *restrict key,
+              block delta, size_t start, size_t end, block *restrict table);
+/* Compute output permutation bits and (optionally) output labels */
+void
+_garble_finish(garble_circuit *restrict gc, block *restrict output_labels);
+
+/* Load input and fixed labels into 'labels' (of size 'gc->r') */
+void
+_eval_init(const garble_circuit *gc, const block *input_labels, block *labels,
+           AES_KEY *key);
+/* Evaluate gates [start, end).  'table' points to the table row of the first
+ * non-XOR gate in the range. */
+void
+_eval_gates(const garble_circuit *gc, block *labels, const AES_KEY *key,
+            size_t start, size_t end, const block *table);
+void
+_eval_finish(const garble_circuit *gc, const block *labels,
+             block *output_labels, bool *outputs);
+
+/* Reserve 'nblocks' consecutive indices of the random block stream and return
+ * the first one */
+uint64_t
+_garble_random_reserve(size_t nblocks);
+/* Write the random blocks at 'index', 'index' + 1, ... to 'blocks' [0],
+ * [stride], [2 * stride], ... */
+void
+_garble_random_fill(block *blocks, size_t nblocks, size_t stride,
+                    uint64_t index);
+
+/* write(2) all of 'buf' to 'fd', retrying on short writes and EINTR */
+int
+_garble_write_all(int fd, const void *buf, size_t len);
+
+/* Number of iovecs filled by _garble_save_iov, and index of the table in
+ * them: the size prefix and header fields come before it, the trailer
+ * (fixed label, global key, output permutation bits, then gates, wires and
+ * outputs unless 'table_only') after it */
+#define GARBLE_SAVE_IOVS 14
+#define GARBLE_IOV_TABLE 7
+/* Point 'iov' at '*size' and the fields of 'gc', in the order of the
+ * garble_save format; returns the number of iovecs used */
+size_t
+_garble_save_iov(const garble_circuit *gc, const size_t *size,
+                 struct iovec *iov, bool table_only, bool wires);
+/* Most iovecs a single writev(2)/readv(2) accepts (UIO_MAXIOV on Linux) */
+#define GARBLE_IOV_MAX 1024
+/* writev(2)/readv(2) all of 'iov', retrying on short transfers and EINTR;
+ * 'iov' is updated in place.  Reading fails at end of file. */
+int
+_garble_writev_all(int fd, struct iovec *iov, size_t iovcnt);
+int
+_garble_readv_all(int fd, struct iovec *iov, size_t iovcnt);
+
+#endif
@@ -1,7 +1,12 @@
 #include "garble.h"
+#include "garble_internal.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 int
 garble_new(garble_circuit *gc, size_t n, size_t m, garble_type_e type)
@@ -17,21 +22,33 @@ garble_new(garble_circuit *gc, size_t n, size_t m, garble_type_e type)
     return GARBLE_OK;
 }
 
+/* Free 'p' unless it points into the file mapping of 'gc' */
+static void
+free_unmapped(const garble_circuit *gc, void *p)
+{
+    const char *c = p, *map = gc->mapping;
+    if (map && c >= map && c < map + gc->mapping_size)
+        return;
+    free(p);
+}
+
 void
 garble_delete(garble_circuit *gc)
 {
     if (gc == NULL)
         return;
     if (gc->gates)
-        free(gc->gates);
+        free_unmapped(gc, gc->gates);
     if (gc->table)
-        free(gc->table);
+        free_unmapped(gc, gc->table);
     if (gc->wires)
-        free(gc->wires);
+        free_unmapped(gc, gc->wires);
     if (gc->outputs)
-        free(gc->outputs);
+        free_unmapped(gc, gc->outputs);
     if (gc->output_perms)
-        free(gc->output_perms);
+        free_unmapped(gc, gc->output_perms);
+    if (gc->mapping)
+        (void) munmap(gc->mapping, gc->mapping_size);
     memset(gc, '\0', sizeof(garble_circuit));
 }
 
@@ -116,6 +133,10 @@ garble_from_buffer(garble_circuit *gc, const char *buf, bool table_only, bool wi
 
     if (gc == NULL || buf == NULL)
         return GARBLE_ERR;
+    if (!table_only) {
+        gc->mapping = NULL;
+        gc->mapping_size = 0;
+    }
 
     p += cpy_to_buf(&gc->n, buf + p, sizeof gc->n);
     p += cpy_to_buf(&gc->m, buf + p, sizeof gc->m);
@@ -158,39 +179,216 @@ error:
     return GARBLE_ERR;
 }
 
+static inline void
+iov_set(struct iovec *iov, const void *base, size_t len)
+{
+    /* The same iovecs are used for writing and for reading into 'gc' */
+    iov->iov_base = (void *) (uintptr_t) base;
+    iov->iov_len = len;
+}
+
+size_t
+_garble_save_iov(const garble_circuit *gc, const size_t *size,
+                 struct iovec *iov, bool table_only, bool wires)
+{
+    size_t n = 0;
+
+    iov_set(&iov[n++], size, sizeof *size);
+    iov_set(&iov[n++], &gc->n, sizeof gc->n);
+    iov_set(&iov[n++], &gc->m, sizeof gc->m);
+    iov_set(&iov[n++], &gc->q, sizeof gc->q);
+    iov_set(&iov[n++], &gc->r, sizeof gc->r);
+    iov_set(&iov[n++], &gc->nxors, sizeof gc->nxors);
+    iov_set(&iov[n++], &gc->type, sizeof gc->type);
+    iov_set(&iov[n++], gc->table, garble_table_size(gc) * (gc->q - gc->nxors));
+    iov_set(&iov[n++], &gc->fixed_label, sizeof(block));
+    iov_set(&iov[n++], &gc->global_key, sizeof(block));
+    iov_set(&iov[n++], gc->output_perms, sizeof(bool) * gc->m);
+    if (!table_only) {
+        iov_set(&iov[n++], gc->gates, sizeof(garble_gate) * gc->q);
+        if (wires)
+            iov_set(&iov[n++], gc->wires, sizeof(block) * 2 * gc->r);
+        iov_set(&iov[n++], gc->outputs, sizeof(int) * gc->m);
+    }
+    return n;
+}
+
+static int
+iov_all(int fd, struct iovec *iov, size_t iovcnt, bool writing)
+{
+    for (;;) {
+        ssize_t res;
+        int cnt;
+
+        while (iovcnt > 0 && iov->iov_len == 0) {
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt == 0)
+            return GARBLE_OK;
+        cnt = iovcnt < GARBLE_IOV_MAX ? iovcnt : GARBLE_IOV_MAX;
+        res = writing ? writev(fd, iov, cnt) : readv(fd, iov, cnt);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return GARBLE_ERR;
+        }
+        if (res == 0 && !writing)
+            return GARBLE_ERR;
+        while (iovcnt > 0 && (size_t) res >= iov->iov_len) {
+            res -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (res > 0) {
+            iov->iov_base = (char *) iov->iov_base + res;
+            iov->iov_len -= res;
+        }
+    }
+}
+
+int
+_garble_writev_all(int fd, struct iovec *iov, size_t iovcnt)
+{
+    return iov_all(fd, iov, iovcnt, true);
+}
+
+int
+_garble_readv_all(int fd, struct iovec *iov, size_t iovcnt)
+{
+    return iov_all(fd, iov, iovcnt, false);
+}
+
+int
+garble_save_fd(const garble_circuit *gc, int fd, bool table_only, bool wires)
+{
+    struct iovec iov[GARBLE_SAVE_IOVS];
+    size_t size, n;
+
+    if (gc == NULL || (size = garble_size(gc, table_only, wires)) == 0)
+        return GARBLE_ERR;
+    n = _garble_save_iov(gc, &size, iov, table_only, wires);
+    return _garble_writev_all(fd, iov, n);
+}
+
 int
 garble_save(const garble_circuit *gc, FILE *f, bool table_only, bool wires)
 {
-    const size_t size = garble_size(gc, table_only, wires);
-    char *buf;
-    size_t res;
+    if (fflush(f) == EOF)
+        return GARBLE_ERR;
+    return garble_save_fd(gc, fileno(f), table_only, wires);
+}
+
+typedef int (*iov_reader)(void *arg, struct iovec *iov, size_t iovcnt);
+
+/* Read the header through 'read', allocate the arrays of 'gc', and read the
+ * rest of the circuit straight into them */
+static int
+load_iov(garble_circuit *gc, bool table_only, bool wires, iov_reader read,
+         void *arg)
+{
+    struct iovec iov[GARBLE_SAVE_IOVS];
+    size_t size = 0, n;
 
-    (void) fwrite(&size, sizeof(char), sizeof size, f);
-    buf = calloc(size, sizeof(char));
-    if (garble_to_buffer(gc, buf, table_only, wires) == NULL) {
-        fprintf(stderr, "[%s] failed to save circuit to buffer\n", __func__);
-        free(buf);
+    if (gc == NULL)
+        return GARBLE_ERR;
+    if (!table_only) {
+        gc->mapping = NULL;
+        gc->mapping_size = 0;
+    }
+    (void) _garble_save_iov(gc, &size, iov, table_only, wires);
+    if (read(arg, iov, GARBLE_IOV_TABLE) == GARBLE_ERR
+        || size != garble_size(gc, table_only, wires))
         return GARBLE_ERR;
+
+    if ((gc->table = calloc(gc->q - gc->nxors, garble_table_size(gc))) == NULL)
+        goto error;
+    if ((gc->output_perms = calloc(gc->m, sizeof(bool))) == NULL)
+        goto error;
+    if (!table_only) {
+        if ((gc->gates = calloc(gc->q, sizeof(garble_gate))) == NULL)
+            goto error;
+        if (wires) {
+            if ((gc->wires = calloc(2 * gc->r, sizeof(block))) == NULL)
+                goto error;
+        } else {
+            gc->wires = NULL;
+        }
+        if ((gc->outputs = calloc(gc->m, sizeof(int))) == NULL)
+            goto error;
     }
-    res = fwrite(buf, sizeof(char), size, f);
-    free(buf);
-    return res == size ? GARBLE_OK : GARBLE_ERR;
+    n = _garble_save_iov(gc, &size, iov, table_only, wires);
+    if (read(arg, iov + GARBLE_IOV_TABLE, n - GARBLE_IOV_TABLE) == GARBLE_ERR)
+        goto error;
+    return GARBLE_OK;
+error:
+    garble_delete(gc);
+    return GARBLE_ERR;
+}
+
+static int
+read_fd(void *arg, struct iovec *iov, size_t iovcnt)
+{
+    return _garble_readv_all(*(int *) arg, iov, iovcnt);
+}
+
+static int
+read_file(void *arg, struct iovec *iov, size_t iovcnt)
+{
+    for (size_t i = 0; i < iovcnt; ++i) {
+        if (fread(iov[i].iov_base, sizeof(char), iov[i].iov_len, arg)
+            != iov[i].iov_len)
+            return GARBLE_ERR;
+    }
+    return GARBLE_OK;
 }
 
 int
-garble_load(garble_circuit *gc, FILE *f, bool table_only, bool wires)
+garble_load_fd(garble_circuit *gc, int fd, bool table_only, bool wires)
 {
-    size_t size;
-    char *buf;
+    return load_iov(gc, table_only, wires, read_fd, &fd);
+}
 
-    (void) fread(&size, sizeof(char), sizeof size, f);
-    buf = calloc(size, sizeof(char));
-    (void) fread(buf, sizeof(char), size, f);
-    if (garble_from_buffer(gc, buf, table_only, wires) == GARBLE_ERR) {
-        fprintf(stderr, "[%s] failed to load circuit from buffer\n", __func__);
-        free(buf);
+int
+garble_saved_table(int fd, off_t *offset, size_t *len, size_t *total)
+{
+    garble_circuit tmp;
+    struct iovec iov[GARBLE_SAVE_IOVS];
+    struct stat st;
+    size_t size = 0, hlen = 0;
+    ssize_t res;
+
+    memset(&tmp, '\0', sizeof tmp);
+    (void) _garble_save_iov(&tmp, &size, iov, true, false);
+    for (size_t i = 0; i < GARBLE_IOV_TABLE; ++i)
+        hlen += iov[i].iov_len;
+    do {
+        res = preadv(fd, iov, GARBLE_IOV_TABLE, 0);
+    } while (res == -1 && errno == EINTR);
+    if (res != (ssize_t) hlen || fstat(fd, &st) == -1)
+        return GARBLE_ERR;
+    /* 'size' must match one of the layouts garble_save writes */
+    if (tmp.q < tmp.nxors || tmp.type > GARBLE_TYPE_PRIVACY_FREE
+        || (size != garble_size(&tmp, true, false)
+            && size != garble_size(&tmp, false, false)
+            && size != garble_size(&tmp, false, true))
+        || (uint64_t) st.st_size < sizeof size + size)
+        return GARBLE_ERR;
+    if (offset)
+        *offset = hlen;
+    if (len)
+        *len = garble_table_size(&tmp) * (tmp.q - tmp.nxors);
+    if (total)
+        *total = sizeof size + size;
+    return GARBLE_OK;
+}
+
+int
+garble_load(garble_circuit *gc, FILE *f, bool table_only, bool wires)
+{
+    if (load_iov(gc, table_only, wires, read_file, f) == GARBLE_ERR) {
+        fprintf(stderr, "[%s] failed to load circuit\n", __func__);
         return GARBLE_ERR;
     }
-    free(buf);
     return GARBLE_OK;
 }
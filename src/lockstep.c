@@ -0,0 +1,409 @@
+/*
+ * Lockstep garbling of several instances of one circuit topology.
+ *
+ * The gate list is walked once for all 'k' instances.  Zero labels are kept in
+ * a transposed buffer where the 'k' labels of a wire are adjacent, so each
+ * gate loads its topology once, XOR gates become a few wide loads and stores,
+ * and non-XOR gates hash the labels of every instance in a single interleaved
+ * AES batch (four instances per instruction with VAES).  Each instance keeps
+ * its own delta, key and table, and the tables are identical to those of
+ * garble_garble.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+#include "garble/garble_gate_privacy_free.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+/* Zero label of wire 'w' of instance 'j' in the transposed buffer; the one
+ * label is always the zero label XOR delta, so it is not stored */
+#define LABEL(W, k, w, j) (W)[(w) * (k) + (j)]
+
+static inline long
+lsb(block x)
+{
+    return _mm_cvtsi128_si32(x) & 1;
+}
+
+#if defined(__VAES__) && defined(__AVX512F__)
+#  define LOCKSTEP_VAES
+#endif
+
+/* Round keys of all instances; with VAES, the keys of four consecutive
+ * instances are also packed into the lanes of one 512-bit register */
+typedef struct {
+    AES_KEY aes[GARBLE_LOCKSTEP_MAX];
+#ifdef LOCKSTEP_VAES
+    __m512i packed[GARBLE_LOCKSTEP_MAX / 4][11];
+#endif
+} lockstep_keys;
+
+static void
+pack_keys(lockstep_keys *keys, size_t k)
+{
+#ifdef LOCKSTEP_VAES
+    for (size_t j = 0; j + 4 <= k; j += 4)
+        for (int r = 0; r < 11; ++r) {
+            __m512i v = _mm512_castsi128_si512(keys->aes[j].rd_key[r]);
+            v = _mm512_inserti32x4(v, keys->aes[j + 1].rd_key[r], 1);
+            v = _mm512_inserti32x4(v, keys->aes[j + 2].rd_key[r], 2);
+            v = _mm512_inserti32x4(v, keys->aes[j + 3].rd_key[r], 3);
+            keys->packed[j / 4][r] = v;
+        }
+#else
+    (void) keys;
+    (void) k;
+#endif
+}
+
+/* Encrypt blocks 'blks[i * k + j]' for i < 'per' with the key of instance j.
+ * Instances are taken four at a time with VAES, then two at a time, so that
+ * every group keeps several independent blocks in flight through all
+ * rounds. */
+static inline void
+encrypt_multikey(block *restrict blks, size_t per, size_t k,
+                 const lockstep_keys *restrict keys)
+{
+    size_t j = 0;
+
+#ifdef LOCKSTEP_VAES
+    for (; j + 4 <= k; j += 4) {
+        const __m512i *rk = keys->packed[j / 4];
+        __m512i x[4];
+        for (size_t i = 0; i < per; ++i)
+            x[i] = _mm512_xor_si512(_mm512_loadu_si512(&blks[i * k + j]), rk[0]);
+        for (unsigned int r = 1; r < 10; ++r)
+            for (size_t i = 0; i < per; ++i)
+                x[i] = _mm512_aesenc_epi128(x[i], rk[r]);
+        for (size_t i = 0; i < per; ++i)
+            _mm512_storeu_si512(&blks[i * k + j],
+                                _mm512_aesenclast_epi128(x[i], rk[10]));
+    }
+#endif
+    for (; j + 2 <= k; j += 2) {
+        const AES_KEY *k0 = &keys->aes[j], *k1 = &keys->aes[j + 1];
+        block x[4], y[4];
+        for (size_t i = 0; i < per; ++i) {
+            x[i] = _mm_xor_si128(blks[i * k + j], k0->rd_key[0]);
+            y[i] = _mm_xor_si128(blks[i * k + j + 1], k1->rd_key[0]);
+        }
+        for (unsigned int r = 1; r < 10; ++r) {
+            for (size_t i = 0; i < per; ++i) {
+                x[i] = _mm_aesenc_si128(x[i], k0->rd_key[r]);
+                y[i] = _mm_aesenc_si128(y[i], k1->rd_key[r]);
+            }
+        }
+        for (size_t i = 0; i < per; ++i) {
+            blks[i * k + j] = _mm_aesenclast_si128(x[i], k0->rd_key[10]);
+            blks[i * k + j + 1] = _mm_aesenclast_si128(y[i], k1->rd_key[10]);
+        }
+    }
+    if (j < k) {
+        block x[4];
+        for (size_t i = 0; i < per; ++i)
+            x[i] = blks[i * k + j];
+        AES_ecb_encrypt_blks(x, per, &keys->aes[j]);
+        for (size_t i = 0; i < per; ++i)
+            blks[i * k + j] = x[i];
+    }
+}
+
+static inline void
+and_standard(block *restrict W, size_t k, const garble_gate *g, size_t idx,
+             const block *restrict deltas, const lockstep_keys *restrict keys,
+             block *const *restrict tables)
+{
+    block h[4 * GARBLE_LOCKSTEP_MAX], masks[4 * GARBLE_LOCKSTEP_MAX];
+    const block tweak = garble_make_block(idx, (uint64_t) 0);
+
+    for (size_t j = 0; j < k; ++j) {
+        const block a0 = LABEL(W, k, g->input0, j);
+        const block b0 = LABEL(W, k, g->input1, j);
+        const block A0 = garble_double(a0);
+        const block A1 = garble_double(garble_xor(a0, deltas[j]));
+        const block B0 = garble_double(garble_double(b0));
+        const block B1 = garble_double(garble_double(garble_xor(b0, deltas[j])));
+        h[0 * k + j] = garble_xor(garble_xor(A0, B0), tweak);
+        h[1 * k + j] = garble_xor(garble_xor(A0, B1), tweak);
+        h[2 * k + j] = garble_xor(garble_xor(A1, B0), tweak);
+        h[3 * k + j] = garble_xor(garble_xor(A1, B1), tweak);
+    }
+    memcpy(masks, h, 4 * k * sizeof(block));
+    encrypt_multikey(h, 4, k, keys);
+    for (size_t j = 0; j < k; ++j) {
+        const long lsb0 = lsb(LABEL(W, k, g->input0, j));
+        const long lsb1 = lsb(LABEL(W, k, g->input1, j));
+        block mask[4], *table = tables[j];
+        block newToken, label0, label1;
+
+        for (size_t i = 0; i < 4; ++i)
+            mask[i] = garble_xor(masks[i * k + j], h[i * k + j]);
+        newToken = mask[2 * lsb0 + lsb1];
+        if (lsb1 & lsb0) {
+            label0 = garble_xor(deltas[j], newToken);
+            label1 = newToken;
+        } else {
+            label0 = newToken;
+            label1 = garble_xor(deltas[j], newToken);
+        }
+        if (2*lsb0 + lsb1 != 0)
+            table[2*lsb0 + lsb1 -1] = garble_xor(label0, mask[0]);
+        if (2*lsb0 + 1-lsb1 != 0)
+            table[2*lsb0 + 1-lsb1-1] = garble_xor(label0, mask[1]);
+        if (2*(1-lsb0) + lsb1 != 0)
+            table[2*(1-lsb0) + lsb1-1] = garble_xor(label0, mask[2]);
+        if (2*(1-lsb0) + (1-lsb1) != 0)
+            table[2*(1-lsb0) + (1-lsb1)-1] = garble_xor(label1, mask[3]);
+        LABEL(W, k, g->output, j) = label0;
+    }
+}
+
+static inline void
+and_halfgates(block *restrict W, size_t k, const garble_gate *g, size_t idx,
+              const block *restrict deltas, const lockstep_keys *restrict keys,
+              block *const *restrict tables)
+{
+    block h[4 * GARBLE_LOCKSTEP_MAX], masks[4 * GARBLE_LOCKSTEP_MAX];
+    const block tweak1 = garble_make_block(2 * idx, (uint64_t) 0);
+    const block tweak2 = garble_make_block(2 * idx + 1, (uint64_t) 0);
+
+    for (size_t j = 0; j < k; ++j) {
+        const block a0 = LABEL(W, k, g->input0, j);
+        const block b0 = LABEL(W, k, g->input1, j);
+        h[0 * k + j] = garble_xor(garble_double(a0), tweak1);
+        h[1 * k + j] = garble_xor(garble_double(garble_xor(a0, deltas[j])), tweak1);
+        h[2 * k + j] = garble_xor(garble_double(b0), tweak2);
+        h[3 * k + j] = garble_xor(garble_double(garble_xor(b0, deltas[j])), tweak2);
+    }
+    memcpy(masks, h, 4 * k * sizeof(block));
+    encrypt_multikey(h, 4, k, keys);
+    for (size_t j = 0; j < k; ++j) {
+        const block A0 = LABEL(W, k, g->input0, j);
+        const bool pa = lsb(A0);
+        const bool pb = lsb(LABEL(W, k, g->input1, j));
+        const block HA0 = garble_xor(h[0 * k + j], masks[0 * k + j]);
+        const block HA1 = garble_xor(h[1 * k + j], masks[1 * k + j]);
+        const block HB0 = garble_xor(h[2 * k + j], masks[2 * k + j]);
+        const block HB1 = garble_xor(h[3 * k + j], masks[3 * k + j]);
+        block *table = tables[j];
+        block tmp, W0;
+
+        table[0] = garble_xor(HA0, HA1);
+        if (pb)
+            table[0] = garble_xor(table[0], deltas[j]);
+        W0 = HA0;
+        if (pa)
+            W0 = garble_xor(W0, table[0]);
+        tmp = garble_xor(HB0, HB1);
+        table[1] = garble_xor(tmp, A0);
+        W0 = garble_xor(W0, HB0);
+        if (pb)
+            W0 = garble_xor(W0, tmp);
+        LABEL(W, k, g->output, j) = W0;
+    }
+}
+
+static inline void
+and_privacy_free(block *restrict W, size_t k, const garble_gate *g, size_t idx,
+                 const block *restrict deltas, const lockstep_keys *restrict keys,
+                 block *const *restrict tables)
+{
+    block h[2 * GARBLE_LOCKSTEP_MAX], masks[2 * GARBLE_LOCKSTEP_MAX];
+    const block tweak = garble_make_block(2 * idx, (uint64_t) 0);
+
+    for (size_t j = 0; j < k; ++j) {
+        const block a0 = LABEL(W, k, g->input0, j);
+        h[0 * k + j] = garble_xor(garble_double(a0), tweak);
+        h[1 * k + j] = garble_xor(garble_double(garble_xor(a0, deltas[j])), tweak);
+    }
+    memcpy(masks, h, 2 * k * sizeof(block));
+    encrypt_multikey(h, 2, k, keys);
+    for (size_t j = 0; j < k; ++j) {
+        block HA0 = garble_xor(h[0 * k + j], masks[0 * k + j]);
+        block HA1 = garble_xor(h[1 * k + j], masks[1 * k + j]);
+
+        *((char *) &HA0) &= 0xfe;
+        *((char *) &HA1) |= 0x01;
+        tables[j][0] = garble_xor(garble_xor(HA0, HA1),
+                                  LABEL(W, k, g->input1, j));
+        LABEL(W, k, g->output, j) = HA0;
+    }
+}
+
+static inline void
+complement_inputs(block *restrict W, size_t k, const garble_gate *g,
+                  const block *restrict comp)
+{
+    for (size_t j = 0; j < k; ++j) {
+        LABEL(W, k, g->input0, j) = garble_xor(LABEL(W, k, g->input0, j), comp[j]);
+        if (g->input1 != g->input0)
+            LABEL(W, k, g->input1, j) = garble_xor(LABEL(W, k, g->input1, j),
+                                                   comp[j]);
+    }
+}
+
+/* Garble all gates; 'type' is a constant in each caller so the per-scheme
+ * AND kernel is inlined into the loop */
+static inline void
+lockstep_gates(const garble_circuit *gc, garble_type_e type, block *restrict W,
+               size_t k, const block *restrict deltas,
+               const lockstep_keys *restrict keys, block **restrict tables)
+{
+    const size_t tb = garble_table_blocks(gc);
+    block comp[GARBLE_LOCKSTEP_MAX];
+
+    /* XORing a zero label with comp[j] complements the wire */
+    for (size_t j = 0; j < k; ++j)
+        comp[j] = type == GARBLE_TYPE_PRIVACY_FREE
+            ? garble_xor(deltas[j], garble_privacy_free_not_mask())
+            : deltas[j];
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        if (g->type == GARBLE_GATE_XOR) {
+            size_t j = 0;
+#ifdef LOCKSTEP_VAES
+            for (; j + 4 <= k; j += 4)
+                _mm512_storeu_si512(&LABEL(W, k, g->output, j),
+                                    _mm512_xor_si512(_mm512_loadu_si512(&LABEL(W, k, g->input0, j)),
+                                                     _mm512_loadu_si512(&LABEL(W, k, g->input1, j))));
+#endif
+            for (; j < k; ++j)
+                LABEL(W, k, g->output, j) = garble_xor(LABEL(W, k, g->input0, j),
+                                                       LABEL(W, k, g->input1, j));
+            continue;
+        }
+        if (g->type == GARBLE_GATE_NOT || g->type == GARBLE_GATE_XNOR) {
+            /* The zero label of the output is the one label of the input,
+             * masked for privacy-free (see garble_gate_privacy_free.h) */
+            for (size_t j = 0; j < k; ++j) {
+                block out = garble_xor(LABEL(W, k, g->input0, j), comp[j]);
+                if (g->type == GARBLE_GATE_XNOR)
+                    out = garble_xor(out, LABEL(W, k, g->input1, j));
+                LABEL(W, k, g->output, j) = out;
+            }
+            continue;
+        }
+        /* a | b = ~(~a & ~b): complement the inputs in place around the
+         * AND kernel, and the output after it */
+        if (g->type == GARBLE_GATE_OR)
+            complement_inputs(W, k, g, comp);
+        if (type == GARBLE_TYPE_STANDARD) {
+            and_standard(W, k, g, i, deltas, keys, tables);
+        } else if (type == GARBLE_TYPE_HALFGATES) {
+            and_halfgates(W, k, g, i, deltas, keys, tables);
+        } else {
+            and_privacy_free(W, k, g, i, deltas, keys, tables);
+        }
+        if (g->type == GARBLE_GATE_OR) {
+            complement_inputs(W, k, g, comp);
+            for (size_t j = 0; j < k; ++j)
+                LABEL(W, k, g->output, j) = garble_xor(LABEL(W, k, g->output, j),
+                                                       comp[j]);
+        }
+        for (size_t j = 0; j < k; ++j)
+            tables[j] += tb;
+    }
+}
+
+/* The kernels walk the gates of the first instance for all of them */
+static bool
+same_topology(const garble_circuit *a, const garble_circuit *b)
+{
+    if (a->n != b->n || a->m != b->m || a->q != b->q || a->r != b->r
+        || a->nxors != b->nxors || a->type != b->type)
+        return false;
+    if (a->gates != b->gates) {
+        for (size_t i = 0; i < a->q; ++i) {
+            const garble_gate *x = &a->gates[i], *y = &b->gates[i];
+            /* Compared field by field: the struct has padding */
+            if (x->type != y->type || x->input0 != y->input0
+                || x->input1 != y->input1 || x->output != y->output)
+                return false;
+        }
+    }
+    return a->outputs == b->outputs
+        || memcmp(a->outputs, b->outputs, a->m * sizeof(int)) == 0;
+}
+
+int
+garble_lockstep_new(garble_lockstep *ls, garble_circuit *gcs, size_t k)
+{
+    if (ls == NULL || gcs == NULL || k == 0 || k > GARBLE_LOCKSTEP_MAX)
+        return GARBLE_ERR;
+    for (size_t j = 1; j < k; ++j) {
+        if (!same_topology(&gcs[0], &gcs[j]))
+            return GARBLE_ERR;
+    }
+    ls->gcs = gcs;
+    ls->k = k;
+    if ((ls->labels = garble_allocate_blocks(gcs[0].r * k)) == NULL)
+        return GARBLE_ERR;
+    return GARBLE_OK;
+}
+
+void
+garble_lockstep_delete(garble_lockstep *ls)
+{
+    if (ls == NULL)
+        return;
+    free(ls->labels);
+    ls->labels = NULL;
+}
+
+int
+garble_lockstep_garble(garble_lockstep *ls, const block *const *input_labels,
+                       block *const *output_labels)
+{
+    lockstep_keys keys;
+    block deltas[GARBLE_LOCKSTEP_MAX];
+    block *tables[GARBLE_LOCKSTEP_MAX];
+    garble_circuit *gcs;
+    block *W;
+    size_t k;
+
+    if (ls == NULL || ls->labels == NULL)
+        return GARBLE_ERR;
+    gcs = ls->gcs;
+    k = ls->k;
+    W = ls->labels;
+
+    for (size_t j = 0; j < k; ++j) {
+        if (_garble_init(&gcs[j], input_labels ? input_labels[j] : NULL,
+                         &keys.aes[j], &deltas[j], true) == GARBLE_ERR)
+            return GARBLE_ERR;
+        tables[j] = gcs[j].table;
+    }
+    pack_keys(&keys, k);
+
+    /* Transpose input and fixed labels */
+    for (size_t w = 0; w < gcs[0].n + 2; ++w)
+        for (size_t j = 0; j < k; ++j)
+            LABEL(W, k, w, j) = gcs[j].wires[2 * w];
+
+    switch (gcs[0].type) {
+    case GARBLE_TYPE_STANDARD:
+        lockstep_gates(&gcs[0], GARBLE_TYPE_STANDARD, W, k, deltas, &keys, tables);
+        break;
+    case GARBLE_TYPE_HALFGATES:
+        lockstep_gates(&gcs[0], GARBLE_TYPE_HALFGATES, W, k, deltas, &keys, tables);
+        break;
+    case GARBLE_TYPE_PRIVACY_FREE:
+        lockstep_gates(&gcs[0], GARBLE_TYPE_PRIVACY_FREE, W, k, deltas, &keys, tables);
+        break;
+    }
+
+    /* Only the output labels are copied back; internal labels stay in the
+     * transposed buffer */
+    for (size_t j = 0; j < k; ++j) {
+        garble_circuit *gc = &gcs[j];
+        for (size_t i = 0; i < gc->m; ++i) {
+            const size_t w = gc->outputs[i];
+            gc->wires[2 * w] = LABEL(W, k, w, j);
+            gc->wires[2 * w + 1] = garble_xor(LABEL(W, k, w, j), deltas[j]);
+        }
+        _garble_finish(gc, output_labels ? output_labels[j] : NULL);
+    }
+    return GARBLE_OK;
+}
@@ -0,0 +1,141 @@
+/*
+ * Memory-mapped garbled circuits.
+ *
+ * garble_save_mmap writes a circuit in a layout where every section starts
+ * on a GARBLE_MAP_ALIGN boundary, so garble_load_mmap can map the file
+ * read-only and point 'gc->table', 'gc->gates', 'gc->outputs' and
+ * 'gc->output_perms' straight into the mapping.  Nothing is copied at load
+ * time; pages are faulted in as evaluation reaches them.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAP_MAGIC "GARBLEM2"
+
+typedef struct {
+    char magic[8];
+    uint64_t n, m, q, r, nxors, type;
+    /* file offsets of the sections, and total file size */
+    uint64_t table, gates, outputs, output_perms, size;
+    block fixed_label, global_key;
+} map_header;
+
+static inline uint64_t
+align_up(uint64_t x)
+{
+    return (x + GARBLE_MAP_ALIGN - 1) & ~(uint64_t) (GARBLE_MAP_ALIGN - 1);
+}
+
+static uint64_t
+table_bytes(const garble_circuit *gc)
+{
+    return garble_table_size(gc) * (gc->q - gc->nxors);
+}
+
+static void
+layout(const garble_circuit *gc, map_header *h)
+{
+    memset(h, '\0', sizeof(map_header));
+    memcpy(h->magic, MAP_MAGIC, sizeof h->magic);
+    h->n = gc->n;
+    h->m = gc->m;
+    h->q = gc->q;
+    h->r = gc->r;
+    h->nxors = gc->nxors;
+    h->type = gc->type;
+    h->table = align_up(sizeof(map_header));
+    h->gates = align_up(h->table + table_bytes(gc));
+    h->outputs = align_up(h->gates + sizeof(garble_gate) * gc->q);
+    h->output_perms = align_up(h->outputs + sizeof(int) * gc->m);
+    h->size = h->output_perms + sizeof(bool) * gc->m;
+}
+
+int
+garble_save_mmap(const garble_circuit *gc, int fd)
+{
+    static const char zeros[GARBLE_MAP_ALIGN];
+    struct iovec iov[10];
+    map_header h;
+    uint64_t off = 0;
+    size_t n = 0;
+
+    if (gc == NULL || gc->q < gc->nxors)
+        return GARBLE_ERR;
+    layout(gc, &h);
+    h.fixed_label = gc->fixed_label;
+    h.global_key = gc->global_key;
+
+#define SECTION(start, base, len)                                       \
+    do {                                                                \
+        iov[n].iov_base = (void *) (uintptr_t) zeros;                   \
+        iov[n++].iov_len = (start) - off;                               \
+        iov[n].iov_base = (void *) (uintptr_t) (base);                  \
+        iov[n++].iov_len = (len);                                       \
+        off = (start) + (len);                                          \
+    } while (0)
+
+    SECTION(0, &h, sizeof h);
+    SECTION(h.table, gc->table, table_bytes(gc));
+    SECTION(h.gates, gc->gates, sizeof(garble_gate) * gc->q);
+    SECTION(h.outputs, gc->outputs, sizeof(int) * gc->m);
+    SECTION(h.output_perms, gc->output_perms, sizeof(bool) * gc->m);
+#undef SECTION
+
+    /* The leading padding iovec is empty */
+    return _garble_writev_all(fd, iov + 1, n - 1);
+}
+
+int
+garble_load_mmap(garble_circuit *gc, int fd)
+{
+    garble_circuit tmp;
+    struct stat st;
+    map_header h, expect;
+    char *p;
+
+    if (gc == NULL || fstat(fd, &st) == -1
+        || (uint64_t) st.st_size < sizeof(map_header))
+        return GARBLE_ERR;
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return GARBLE_ERR;
+    memcpy(&h, p, sizeof h);
+
+    memset(&tmp, '\0', sizeof tmp);
+    tmp.n = h.n;
+    tmp.m = h.m;
+    tmp.q = h.q;
+    tmp.r = h.r;
+    tmp.nxors = h.nxors;
+    tmp.type = h.type;
+    if (memcmp(h.magic, MAP_MAGIC, sizeof h.magic) != 0 || h.q < h.nxors
+        || h.type > GARBLE_TYPE_PRIVACY_FREE
+        || h.q > (uint64_t) st.st_size / sizeof(garble_gate)
+        || h.m > (uint64_t) st.st_size / sizeof(int))
+        goto error;
+    /* The section offsets must be the ones garble_save_mmap lays out */
+    layout(&tmp, &expect);
+    if (h.table != expect.table || h.gates != expect.gates
+        || h.outputs != expect.outputs || h.output_perms != expect.output_perms
+        || h.size != expect.size || h.size > (uint64_t) st.st_size)
+        goto error;
+
+    tmp.table = (block *) (p + h.table);
+    tmp.gates = (garble_gate *) (p + h.gates);
+    tmp.outputs = (int *) (p + h.outputs);
+    tmp.output_perms = (bool *) (p + h.output_perms);
+    tmp.fixed_label = h.fixed_label;
+    tmp.global_key = h.global_key;
+    tmp.mapping = p;
+    tmp.mapping_size = st.st_size;
+    *gc = tmp;
+    return GARBLE_OK;
+error:
+    (void) munmap(p, st.st_size);
+    return GARBLE_ERR;
+}
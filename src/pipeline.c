@@ -0,0 +1,191 @@
+/*
+ * Pipelined garbling: the calling thread garbles chunks of gates into a ring
+ * of table buffers, a hashing thread folds each finished chunk into the SHA-1
+ * digest, and a writer thread writes it out.  The ring is a pair of chained
+ * single-producer/single-consumer queues sharing the same slots, so the three
+ * stages overlap while only GARBLE_PIPELINE_SLOTS chunks are ever resident.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    garble_circuit *gc;
+    int fd;
+    bool hashing;
+    SHA_CTX sha;
+    size_t nchunks;
+    size_t slot_blocks;
+    block *slots;               /* GARBLE_PIPELINE_SLOTS * slot_blocks */
+    size_t lens[GARBLE_PIPELINE_SLOTS]; /* bytes used in each slot */
+    _Alignas(64) _Atomic size_t produced;
+    _Alignas(64) _Atomic size_t hashed;
+    _Alignas(64) _Atomic size_t written;
+    _Atomic bool failed;
+} pipeline;
+
+static void
+wait_for(_Atomic size_t *counter, size_t target)
+{
+    int spins = 0;
+    while (atomic_load_explicit(counter, memory_order_acquire) < target) {
+        if (++spins < 64)
+            _mm_pause();
+        else
+            sched_yield();
+    }
+}
+
+int
+_garble_write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t res = write(fd, p, len);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return GARBLE_ERR;
+        }
+        p += res;
+        len -= res;
+    }
+    return GARBLE_OK;
+}
+
+static void *
+hash_stage(void *arg)
+{
+    pipeline *p = arg;
+    for (size_t c = 0; c < p->nchunks; ++c) {
+        const size_t slot = c % GARBLE_PIPELINE_SLOTS;
+        wait_for(&p->produced, c + 1);
+        if (p->hashing)
+            (void) SHA1_Update(&p->sha, p->slots + slot * p->slot_blocks,
+                               p->lens[slot]);
+        atomic_store_explicit(&p->hashed, c + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void *
+write_stage(void *arg)
+{
+    pipeline *p = arg;
+    for (size_t c = 0; c < p->nchunks; ++c) {
+        const size_t slot = c % GARBLE_PIPELINE_SLOTS;
+        wait_for(&p->hashed, c + 1);
+        /* Keep draining after a failed write so the other stages finish */
+        if (!atomic_load_explicit(&p->failed, memory_order_relaxed)
+            && _garble_write_all(p->fd, p->slots + slot * p->slot_blocks,
+                                p->lens[slot]) == GARBLE_ERR)
+            atomic_store_explicit(&p->failed, true, memory_order_relaxed);
+        atomic_store_explicit(&p->written, c + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static int
+write_header(const garble_circuit *gc, int fd, bool table_only)
+{
+    struct iovec iov[GARBLE_SAVE_IOVS];
+    const size_t size = garble_size(gc, table_only, false);
+
+    (void) _garble_save_iov(gc, &size, iov, table_only, false);
+    return _garble_writev_all(fd, iov, GARBLE_IOV_TABLE);
+}
+
+static int
+write_trailer(const garble_circuit *gc, int fd, bool table_only)
+{
+    struct iovec iov[GARBLE_SAVE_IOVS];
+    const size_t size = 0;
+    const size_t n = _garble_save_iov(gc, &size, iov, table_only, false);
+
+    return _garble_writev_all(fd, iov + GARBLE_IOV_TABLE + 1,
+                              n - GARBLE_IOV_TABLE - 1);
+}
+
+int
+garble_garble_pipelined(garble_circuit *gc, const block *input_labels,
+                        block *output_labels, int fd, bool table_only,
+                        unsigned char hash[SHA_DIGEST_LENGTH])
+{
+    pipeline p;
+    pthread_t hasher, writer;
+    AES_KEY key;
+    block delta;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL)
+        return GARBLE_ERR;
+
+    memset(&p, '\0', sizeof p);
+    p.gc = gc;
+    p.fd = fd;
+    p.hashing = hash != NULL;
+    p.nchunks = (gc->q + GARBLE_PIPELINE_GATES - 1) / GARBLE_PIPELINE_GATES;
+    p.slot_blocks = GARBLE_PIPELINE_GATES * garble_table_blocks(gc);
+    atomic_init(&p.produced, 0);
+    atomic_init(&p.hashed, 0);
+    atomic_init(&p.written, 0);
+    atomic_init(&p.failed, false);
+    if ((p.slots = garble_allocate_blocks(GARBLE_PIPELINE_SLOTS * p.slot_blocks)) == NULL)
+        return GARBLE_ERR;
+    if (p.hashing) {
+        memset(hash, '\0', SHA_DIGEST_LENGTH);
+        (void) SHA1_Init(&p.sha);
+    }
+
+    if (_garble_init(gc, input_labels, &key, &delta, false) == GARBLE_ERR)
+        goto cleanup;
+    if (write_header(gc, fd, table_only) == GARBLE_ERR)
+        goto cleanup;
+
+    if (pthread_create(&hasher, NULL, hash_stage, &p) != 0)
+        goto cleanup;
+    if (pthread_create(&writer, NULL, write_stage, &p) != 0) {
+        /* Unblock the hasher by producing nothing: mark all chunks done */
+        atomic_store(&p.produced, p.nchunks);
+        (void) pthread_join(hasher, NULL);
+        goto cleanup;
+    }
+
+    for (size_t c = 0; c < p.nchunks; ++c) {
+        const size_t slot = c % GARBLE_PIPELINE_SLOTS;
+        const size_t start = c * GARBLE_PIPELINE_GATES;
+        const size_t end = start + GARBLE_PIPELINE_GATES < gc->q
+            ? start + GARBLE_PIPELINE_GATES : gc->q;
+
+        /* Wait until the writer has released this slot */
+        if (c >= GARBLE_PIPELINE_SLOTS)
+            wait_for(&p.written, c - GARBLE_PIPELINE_SLOTS + 1);
+        _garble_gates(gc, &key, delta, start, end,
+                      p.slots + slot * p.slot_blocks);
+        p.lens[slot] = garble_rows_in(gc, start, end) * garble_table_size(gc);
+        atomic_store_explicit(&p.produced, c + 1, memory_order_release);
+    }
+
+    (void) pthread_join(hasher, NULL);
+    (void) pthread_join(writer, NULL);
+    if (atomic_load(&p.failed))
+        goto cleanup;
+
+    _garble_finish(gc, output_labels);
+    if (write_trailer(gc, fd, table_only) == GARBLE_ERR)
+        goto cleanup;
+    if (p.hashing)
+        (void) SHA1_Final(hash, &p.sha);
+    res = GARBLE_OK;
+
+cleanup:
+    free(p.slots);
+    return res;
+}
@@ -0,0 +1,241 @@
+/*
+ * Pool of pre-garbled circuits.
+ *
+ * Garbling does not depend on the inputs, so it can happen ahead of time.  A
+ * pool keeps up to 'capacity' garbled instances of one registered circuit in a
+ * FIFO; background threads running at idle priority refill it, and
+ * garble_pool_take moves an instance out by copying its pointers, leaving
+ * only label transfer and evaluation on the online path.  Instances handed
+ * back with garble_pool_recycle have their buffers reused by the refill
+ * threads.
+ */
+
+#define _GNU_SOURCE
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+struct garble_pool {
+    garble_circuit gc;          /* registered topology; owns nothing */
+    size_t capacity;
+    /* ready instances, a FIFO of 'nready' entries starting at 'head' */
+    garble_pool_instance *ready;
+    size_t head, nready;
+    /* instances currently being garbled by refill threads */
+    size_t pending;
+    /* recycled instances whose buffers can be reused */
+    garble_pool_instance *spare;
+    size_t nspare;
+    bool stop;
+    /* refill threads still running; a thread that fails to garble exits */
+    size_t nlive;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    pthread_t *threads;
+    size_t nthreads;
+};
+
+static void
+instance_free(garble_pool_instance *inst)
+{
+    free(inst->gc.table);
+    free(inst->gc.wires);
+    free(inst->gc.output_perms);
+    free(inst->output_map);
+    memset(inst, '\0', sizeof(garble_pool_instance));
+}
+
+/* Garble a fresh instance into 'inst', reusing its buffers if it has any */
+static int
+instance_garble(const garble_pool *pool, garble_pool_instance *inst)
+{
+    const garble_circuit *gc = &pool->gc;
+
+    if (inst->output_map == NULL) {
+        if ((inst->output_map = garble_allocate_blocks(2 * gc->m)) == NULL)
+            return GARBLE_ERR;
+    }
+    {
+        block *table = inst->gc.table, *wires = inst->gc.wires;
+        bool *perms = inst->gc.output_perms;
+        inst->gc = *gc;
+        inst->gc.table = table;
+        inst->gc.wires = wires;
+        inst->gc.output_perms = perms;
+    }
+    return garble_garble(&inst->gc, NULL, inst->output_map);
+}
+
+static void *
+refill(void *arg)
+{
+    garble_pool *pool = arg;
+    struct sched_param param;
+
+    /* Only use otherwise idle CPU time; failure just leaves normal priority */
+    memset(&param, '\0', sizeof param);
+    (void) pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    (void) pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        garble_pool_instance inst;
+        int res;
+
+        while (!pool->stop
+               && pool->nready + pool->pending >= pool->capacity)
+            (void) pthread_cond_wait(&pool->not_full, &pool->lock);
+        if (pool->stop)
+            break;
+        pool->pending++;
+        if (pool->nspare > 0)
+            inst = pool->spare[--pool->nspare];
+        else
+            memset(&inst, '\0', sizeof inst);
+        (void) pthread_mutex_unlock(&pool->lock);
+
+        res = instance_garble(pool, &inst);
+
+        (void) pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        if (res == GARBLE_ERR) {
+            instance_free(&inst);
+            break;
+        }
+        pool->ready[(pool->head + pool->nready++) % pool->capacity] = inst;
+        (void) pthread_cond_signal(&pool->not_empty);
+    }
+    /* Waiting takers give up once no thread is left to refill */
+    if (--pool->nlive == 0)
+        (void) pthread_cond_broadcast(&pool->not_empty);
+    (void) pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+garble_pool *
+garble_pool_new(const garble_circuit *gc, size_t capacity, size_t nthreads)
+{
+    garble_pool *pool;
+
+    if (gc == NULL || capacity == 0 || nthreads == 0)
+        return NULL;
+    if ((pool = calloc(1, sizeof(garble_pool))) == NULL)
+        return NULL;
+    pool->gc = *gc;
+    pool->gc.table = NULL;
+    pool->gc.wires = NULL;
+    pool->gc.output_perms = NULL;
+    pool->capacity = capacity;
+    pool->ready = calloc(capacity, sizeof(garble_pool_instance));
+    pool->spare = calloc(capacity, sizeof(garble_pool_instance));
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    if (pool->ready == NULL || pool->spare == NULL || pool->threads == NULL) {
+        free(pool->ready);
+        free(pool->spare);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    (void) pthread_mutex_init(&pool->lock, NULL);
+    (void) pthread_cond_init(&pool->not_empty, NULL);
+    (void) pthread_cond_init(&pool->not_full, NULL);
+    (void) pthread_mutex_lock(&pool->lock);
+    for (pool->nthreads = 0; pool->nthreads < nthreads; ++pool->nthreads) {
+        pool->nlive++;
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, refill,
+                           pool) != 0) {
+            pool->nlive--;
+            break;
+        }
+    }
+    (void) pthread_mutex_unlock(&pool->lock);
+    if (pool->nthreads == 0) {
+        garble_pool_delete(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void
+garble_pool_delete(garble_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    (void) pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    (void) pthread_cond_broadcast(&pool->not_full);
+    (void) pthread_cond_broadcast(&pool->not_empty);
+    (void) pthread_mutex_unlock(&pool->lock);
+    for (size_t t = 0; t < pool->nthreads; ++t)
+        (void) pthread_join(pool->threads[t], NULL);
+
+    for (size_t i = 0; i < pool->nready; ++i)
+        instance_free(&pool->ready[(pool->head + i) % pool->capacity]);
+    for (size_t i = 0; i < pool->nspare; ++i)
+        instance_free(&pool->spare[i]);
+    (void) pthread_mutex_destroy(&pool->lock);
+    (void) pthread_cond_destroy(&pool->not_empty);
+    (void) pthread_cond_destroy(&pool->not_full);
+    free(pool->ready);
+    free(pool->spare);
+    free(pool->threads);
+    free(pool);
+}
+
+int
+garble_pool_take(garble_pool *pool, garble_pool_instance *inst, bool wait)
+{
+    int res = GARBLE_ERR;
+
+    if (pool == NULL || inst == NULL)
+        return GARBLE_ERR;
+    (void) pthread_mutex_lock(&pool->lock);
+    while (wait && pool->nready == 0 && !pool->stop && pool->nlive > 0)
+        (void) pthread_cond_wait(&pool->not_empty, &pool->lock);
+    if (pool->nready > 0) {
+        *inst = pool->ready[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->nready--;
+        (void) pthread_cond_signal(&pool->not_full);
+        res = GARBLE_OK;
+    }
+    (void) pthread_mutex_unlock(&pool->lock);
+    return res;
+}
+
+size_t
+garble_pool_ready(garble_pool *pool)
+{
+    size_t n;
+
+    (void) pthread_mutex_lock(&pool->lock);
+    n = pool->nready;
+    (void) pthread_mutex_unlock(&pool->lock);
+    return n;
+}
+
+void
+garble_pool_recycle(garble_pool *pool, garble_pool_instance *inst)
+{
+    if (pool == NULL || inst == NULL)
+        return;
+    (void) pthread_mutex_lock(&pool->lock);
+    if (pool->nspare < pool->capacity) {
+        pool->spare[pool->nspare++] = *inst;
+        memset(inst, '\0', sizeof(garble_pool_instance));
+    }
+    (void) pthread_mutex_unlock(&pool->lock);
+    if (inst->output_map)
+        garble_pool_instance_delete(inst);
+}
+
+void
+garble_pool_instance_delete(garble_pool_instance *inst)
+{
+    if (inst == NULL)
+        return;
+    instance_free(inst);
+}
@@ -1,131 +1,189 @@
+/*
+ * SCD v2: native binary circuit description.
+ *
+ * Little-endian, fixed-width sections, 32-bit ones first so they stay
+ * aligned.  Loading is a single bulk read followed by tight loops over flat
+ * arrays:
+ *
+ *   char     magic[8]            "GARBSCD2"
+ *   uint64_t n, m, q, type
+ *   uint32_t input0[q], input1[q], output[q]
+ *   uint32_t outputs[m]
+ *   uint8_t  types[q]
+ *   uint8_t  output_perms[m]
+ *
+ * 32-bit wire indices suffice since 'gc->outputs' holds ints.  'r' and
+ * 'nxors' are not stored but computed while validating.
+ */
+
 #include "garble.h"
-#include "config.h"
 
-#include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
-#ifdef HAVE_MSGPACK
-#  include <msgpack.h>
-#endif
-#include <malloc.h>
+#include <string.h>
 #include <sys/stat.h>
 
-#ifdef HAVE_MSGPACK
-static long
-fsize(const char *filename)
-{
-    struct stat st;
+#define SCD_MAGIC "GARBSCD2"
+#define SCD_MAGIC_LEN 8
+#define SCD_HEADER (SCD_MAGIC_LEN + 4 * sizeof(uint64_t))
 
-    if (stat(filename, &st) == 0)
-        return st.st_size;
-    return 0;
+static size_t
+scd_size(uint64_t m, uint64_t q)
+{
+    return SCD_HEADER + q * (1 + 3 * sizeof(uint32_t))
+        + m * (sizeof(uint32_t) + 1);
 }
-#endif
 
 int
 garble_circuit_to_file(garble_circuit *gc, char *fname)
 {
-#ifdef HAVE_MSGPACK
-    msgpack_sbuffer *buffer;
-    msgpack_packer *pk;
+    const uint64_t header[4] = { gc->n, gc->m, gc->q, gc->type };
+    char *buf, *p;
+    size_t size;
     FILE *f;
+    int res;
+
+    if (gc->r > UINT32_MAX)
+        return GARBLE_ERR;
+    size = scd_size(gc->m, gc->q);
+    if ((buf = malloc(size)) == NULL)
+        return GARBLE_ERR;
+
+    memcpy(buf, SCD_MAGIC, SCD_MAGIC_LEN);
+    memcpy(buf + SCD_MAGIC_LEN, header, sizeof header);
+    p = buf + SCD_HEADER;
+    {
+        uint32_t *in0 = (uint32_t *) p;
+        uint32_t *in1 = in0 + gc->q, *out = in1 + gc->q;
+        uint32_t *outputs = out + gc->q;
+        uint8_t *types = (uint8_t *) (outputs + gc->m);
+        uint8_t *perms = types + gc->q;
+
+        for (uint64_t i = 0; i < gc->q; ++i) {
+            types[i] = gc->gates[i].type;
+            in0[i] = gc->gates[i].input0;
+            in1[i] = gc->gates[i].input1;
+            out[i] = gc->gates[i].output;
+        }
+        for (uint64_t i = 0; i < gc->m; ++i) {
+            outputs[i] = gc->outputs[i];
+            perms[i] = gc->output_perms ? gc->output_perms[i] : 0;
+        }
+    }
 
     if ((f = fopen(fname, "wb")) == NULL) {
         perror("fopen");
+        free(buf);
         return GARBLE_ERR;
     }
-    buffer = msgpack_sbuffer_new();
-    pk = msgpack_packer_new(buffer, msgpack_sbuffer_write);
-    msgpack_sbuffer_clear(buffer);
-
-    msgpack_pack_array(pk, 3 + 4 * gc->q + gc->m + gc->m);
-    msgpack_pack_int(pk, gc->n);
-    msgpack_pack_int(pk, gc->m);
-    msgpack_pack_int(pk, gc->q);
-    for (uint64_t i = 0; i < gc->q; ++i) {
-        msgpack_pack_int(pk, gc->gates[i].input0);
-        msgpack_pack_int(pk, gc->gates[i].input1);
-        msgpack_pack_int(pk, gc->gates[i].output);
-        msgpack_pack_int(pk, gc->gates[i].type);
-    }
-    for (uint64_t i = 0; i < gc->m; ++i) {
-        msgpack_pack_int(pk, gc->outputs[i]);
+    res = fwrite(buf, sizeof(char), size, f) == size ? GARBLE_OK : GARBLE_ERR;
+    if (fclose(f) == EOF)
+        res = GARBLE_ERR;
+    free(buf);
+    return res;
+}
+
+/* Check gate types and wire indices in one branch-free pass per array, and
+ * compute the number of wires and of XOR gates */
+static int
+scd_validate(const uint8_t *types, const uint32_t *in0, const uint32_t *in1,
+             const uint32_t *out, uint64_t n, uint64_t q, uint64_t *r,
+             uint64_t *nxors)
+{
+    uint32_t maxw = 0, minout = UINT32_MAX;
+    uint8_t maxt = 0;
+    uint64_t nx = 0;
+
+    for (uint64_t i = 0; i < q; ++i) {
+        maxt = types[i] > maxt ? types[i] : maxt;
+        nx += garble_gate_is_free(types[i]);
     }
-    for (uint64_t i = 0; i < gc->m; ++i) {
-        msgpack_pack_int(pk, gc->output_perms[i]);
+    for (uint64_t i = 0; i < q; ++i) {
+        maxw = in0[i] > maxw ? in0[i] : maxw;
+        maxw = in1[i] > maxw ? in1[i] : maxw;
+        maxw = out[i] > maxw ? out[i] : maxw;
+        minout = out[i] < minout ? out[i] : minout;
     }
-    fwrite(buffer->data, sizeof(char), buffer->size, f);
-    fclose(f);
-    msgpack_packer_free(pk);
-    msgpack_sbuffer_free(buffer);
-    return 0;
-#else
-    (void) gc; (void) fname;
-    (void) fprintf(stderr, "need msgpack for garble_circuit_to_file\n");
-    return GARBLE_ERR;
-#endif
+    if (maxt > GARBLE_GATE_XNOR || (q && minout < n + 2))
+        return GARBLE_ERR;
+    *r = q ? (uint64_t) maxw + 1 : 0;
+    if (*r < n + 2)
+        *r = n + 2;
+    *nxors = nx;
+    return GARBLE_OK;
 }
 
 int
 garble_circuit_from_file(garble_circuit *gc, char *fname)
 {
-#ifdef HAVE_MSGPACK
-    msgpack_sbuffer buffer;
-    msgpack_unpacked msg;
-    msgpack_object *p;
-    FILE *f = NULL;
+    uint64_t header[4], n, m, q, r, nxors;
+    struct stat st;
+    char *buf = NULL;
+    FILE *f;
     int res = GARBLE_ERR;
 
-    msgpack_sbuffer_init(&buffer);
-
-    if ((buffer.size = fsize(fname)) == 0)
+    if (gc == NULL || (f = fopen(fname, "rb")) == NULL)
+        return GARBLE_ERR;
+    if (fstat(fileno(f), &st) == -1 || (size_t) st.st_size < SCD_HEADER
+        || (buf = malloc(st.st_size)) == NULL
+        || fread(buf, sizeof(char), st.st_size, f) != (size_t) st.st_size)
         goto cleanup;
-    if ((f = fopen(fname, "rb")) == NULL) {
-        perror("fopen");
+    memcpy(header, buf + SCD_MAGIC_LEN, sizeof header);
+    n = header[0];
+    m = header[1];
+    q = header[2];
+    if (memcmp(buf, SCD_MAGIC, SCD_MAGIC_LEN) != 0
+        || header[3] > GARBLE_TYPE_PRIVACY_FREE || n > INT_MAX
+        || m > (size_t) st.st_size || q > (size_t) st.st_size
+        || scd_size(m, q) != (size_t) st.st_size)
         goto cleanup;
-    }
 
-    if ((buffer.data = malloc(buffer.size)) == NULL)
-        goto cleanup;
-    (void) fread(buffer.data, sizeof(char), buffer.size, f);
-
-    msgpack_unpacked_init(&msg);
-    msgpack_unpack_next(&msg, buffer.data, buffer.size, NULL);
-    p = msg.data.via.array.ptr;
-    gc->n = (*p++).via.i64;
-    gc->m = (*p++).via.i64;
-    gc->q = (*p++).via.i64;
-    gc->r = gc->n + gc->q;
-
-    gc->gates = calloc(gc->q, sizeof(garble_gate));
-    gc->table = NULL;
-    gc->wires = calloc(2 * gc->r, sizeof(block));
-    gc->outputs = calloc(gc->m, sizeof(int));
-
-    for (uint64_t i = 0; i < gc->q; ++i) {
-        gc->gates[i].input0 = (*p++).via.i64;
-        gc->gates[i].input1 = (*p++).via.i64;
-        gc->gates[i].output = (*p++).via.i64;
-        gc->gates[i].type = (*p++).via.i64;
-    }
-    for (uint64_t i = 0; i < gc->m; ++i) {
-        gc->outputs[i] = (*p++).via.i64;
-    }
-    for (uint64_t i = 0; i < gc->m; ++i) {
-        gc->output_perms[i] = (*p++).via.i64;
-    }
-    msgpack_unpacked_destroy(&msg);
+    {
+        const uint32_t *in0 = (const uint32_t *) (buf + SCD_HEADER);
+        const uint32_t *in1 = in0 + q, *out = in1 + q;
+        const uint32_t *outputs = out + q;
+        const uint8_t *types = (const uint8_t *) (outputs + m);
+        const uint8_t *perms = types + q;
 
+        if (scd_validate(types, in0, in1, out, n, q, &r, &nxors) == GARBLE_ERR
+            || r > INT_MAX)
+            goto cleanup;
+        for (uint64_t i = 0; i < m; ++i) {
+            if (outputs[i] >= r)
+                goto cleanup;
+        }
+
+        memset(gc, '\0', sizeof(garble_circuit));
+        gc->n = n;
+        gc->m = m;
+        gc->q = q;
+        gc->r = r;
+        gc->nxors = nxors;
+        gc->type = header[3];
+        gc->gates = malloc((q ? q : 1) * sizeof(garble_gate));
+        gc->outputs = malloc((m ? m : 1) * sizeof(int));
+        gc->output_perms = malloc((m ? m : 1) * sizeof(bool));
+        if (gc->gates == NULL || gc->outputs == NULL
+            || gc->output_perms == NULL) {
+            garble_delete(gc);
+            goto cleanup;
+        }
+        for (uint64_t i = 0; i < q; ++i) {
+            gc->gates[i].type = types[i];
+            gc->gates[i].input0 = in0[i];
+            gc->gates[i].input1 = in1[i];
+            gc->gates[i].output = out[i];
+        }
+        for (uint64_t i = 0; i < m; ++i) {
+            gc->outputs[i] = outputs[i];
+            gc->output_perms[i] = perms[i] & 1;
+        }
+    }
     res = GARBLE_OK;
+
 cleanup:
-    if (f)
-        fclose(f);
-    msgpack_sbuffer_destroy(&buffer);
+    free(buf);
+    fclose(f);
     return res;
-#else
-    (void) gc; (void) fname;
-    (void) fprintf(stderr, "need msgpack for garble_circuit_from_file\n");
-    return GARBLE_ERR;
-#endif
 }
@@ -0,0 +1,372 @@
+/*
+ * Multi-process sharded garbling and evaluation.
+ *
+ * The gate list is split into 'nshards' contiguous shards, each handled by a
+ * forked worker process.  Wire labels live in a shared memfd region so that
+ * labels produced in one shard are visible to later shards; each shard
+ * publishes how many of its gates are done in a shared progress counter, and
+ * a worker only blocks when a gate reads a wire whose producing gate in an
+ * earlier shard has not finished yet.  Every shard garbles its table rows into
+ * its own memfd segment, which the coordinator stitches into 'gc->table'.
+ * Tweaks are the global gate indices, so the table is identical to the one
+ * produced by garble_garble.
+ */
+
+#define _GNU_SOURCE
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NO_GATE SIZE_MAX
+/* Maximum number of gates processed between two progress updates */
+#define SHARD_RUN 256
+
+typedef struct {
+    _Alignas(64) _Atomic size_t done;
+} progress;
+
+typedef struct {
+    size_t nshards;
+    size_t *starts;             /* nshards + 1: first gate of each shard */
+    size_t *rows;               /* nshards + 1: first table row of each shard */
+    size_t *producer;           /* r: gate producing each wire */
+    progress *progress;         /* shared: gates done per shard */
+    _Atomic int *abort;         /* shared: set when a worker failed */
+    void *shared;               /* the progress/abort mapping */
+    size_t shared_size;
+} shards;
+
+/* Map 'size' bytes of a fresh memfd region shared with forked workers */
+static void *
+shared_region(const char *name, size_t size)
+{
+    void *p;
+    int fd;
+
+    if (size == 0)
+        size = 1;
+    if ((fd = memfd_create(name, MFD_CLOEXEC)) == -1)
+        return NULL;
+    if (ftruncate(fd, size) == -1) {
+        (void) close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void
+shards_delete(shards *s)
+{
+    free(s->starts);
+    free(s->rows);
+    free(s->producer);
+    if (s->shared)
+        (void) munmap(s->shared, s->shared_size);
+}
+
+static int
+shards_new(shards *s, const garble_circuit *gc, size_t nshards)
+{
+    size_t row = 0;
+
+    memset(s, '\0', sizeof(shards));
+    if (nshards == 0)
+        nshards = 1;
+    if (nshards > gc->q && gc->q > 0)
+        nshards = gc->q;
+    s->nshards = nshards;
+    s->starts = calloc(nshards + 1, sizeof(size_t));
+    s->rows = calloc(nshards + 1, sizeof(size_t));
+    s->producer = malloc(gc->r * sizeof(size_t));
+    s->shared_size = (nshards + 1) * sizeof(progress);
+    s->shared = shared_region("garble-progress", s->shared_size);
+    if (s->starts == NULL || s->rows == NULL || s->producer == NULL
+        || s->shared == NULL)
+        goto error;
+    s->progress = s->shared;
+    s->abort = (_Atomic int *) &s->progress[nshards];
+    atomic_init(s->abort, 0);
+
+    for (size_t w = 0; w < gc->r; ++w)
+        s->producer[w] = NO_GATE;
+    for (size_t k = 0; k <= nshards; ++k)
+        s->starts[k] = gc->q * k / nshards;
+    for (size_t k = 0, i = 0; i <= gc->q; ++i) {
+        while (k <= nshards && s->starts[k] == i)
+            s->rows[k++] = row;
+        if (i == gc->q)
+            break;
+        if (gc->gates[i].output >= gc->r || gc->gates[i].input0 >= gc->r
+            || gc->gates[i].input1 >= gc->r)
+            goto error;
+        s->producer[gc->gates[i].output] = i;
+        row += garble_gate_is_free(gc->gates[i].type) ? 0 : 1;
+    }
+    for (size_t k = 0; k < nshards; ++k)
+        atomic_init(&s->progress[k].done, 0);
+    return GARBLE_OK;
+error:
+    shards_delete(s);
+    return GARBLE_ERR;
+}
+
+static size_t
+shard_of(const shards *s, size_t gate)
+{
+    size_t lo = 0, hi = s->nshards;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (s->starts[mid] <= gate)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Whether the wire 'w' read by a gate in shard 'k' is available; if 'wait'
+ * is set, wait for it */
+static bool
+wire_ready(const shards *s, size_t k, size_t w, bool wait)
+{
+    const size_t p = s->producer[w];
+    size_t t;
+    int spins = 0;
+
+    if (p == NO_GATE || p >= s->starts[k])
+        return true;
+    t = shard_of(s, p);
+    while (atomic_load_explicit(&s->progress[t].done, memory_order_acquire)
+           <= p - s->starts[t]) {
+        if (!wait || atomic_load_explicit(s->abort, memory_order_relaxed))
+            return false;
+        if (++spins < 64)
+            _mm_pause();
+        else
+            sched_yield();
+    }
+    return true;
+}
+
+/* Run shard 'k' by repeatedly calling 'run' on the longest prefix of gates
+ * whose inputs are ready, publishing progress after each run */
+static int
+shard_loop(const garble_circuit *gc, const shards *s, size_t k,
+           void (*run)(void *, size_t, size_t), void *arg)
+{
+    const size_t start = s->starts[k], end = s->starts[k + 1];
+    size_t i = start;
+
+    while (i < end) {
+        size_t j = i;
+        while (j < end && j - i < SHARD_RUN
+               && wire_ready(s, k, gc->gates[j].input0, false)
+               && wire_ready(s, k, gc->gates[j].input1, false))
+            ++j;
+        if (j == i) {
+            if (!wire_ready(s, k, gc->gates[i].input0, true)
+                || !wire_ready(s, k, gc->gates[i].input1, true))
+                return GARBLE_ERR;
+            j = i + 1;
+        }
+        run(arg, i, j);
+        atomic_store_explicit(&s->progress[k].done, j - start,
+                              memory_order_release);
+        i = j;
+    }
+    return GARBLE_OK;
+}
+
+/* Fork one worker per shard running 'work', then wait for all of them.  Shard
+ * k only waits on shards < k, so reaping in order and raising the abort flag
+ * on the first failure never leaves a worker spinning forever. */
+static int
+fork_workers(shards *s, int (*work)(void *, size_t), void *arg)
+{
+    pid_t *pids;
+    int res = GARBLE_OK;
+
+    if ((pids = calloc(s->nshards, sizeof(pid_t))) == NULL)
+        return GARBLE_ERR;
+    (void) fflush(NULL);
+    for (size_t k = 0; k < s->nshards; ++k) {
+        if ((pids[k] = fork()) == 0)
+            _exit(work(arg, k) == GARBLE_OK ? 0 : 1);
+        if (pids[k] == -1) {
+            atomic_store(s->abort, 1);
+            res = GARBLE_ERR;
+            break;
+        }
+    }
+    for (size_t k = 0; k < s->nshards && pids[k] > 0; ++k) {
+        int status;
+        if (waitpid(pids[k], &status, 0) == -1 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0) {
+            atomic_store(s->abort, 1);
+            res = GARBLE_ERR;
+        }
+    }
+    free(pids);
+    return res;
+}
+
+static size_t
+segment_size(const garble_circuit *gc, const shards *s, size_t k)
+{
+    size_t size = (s->rows[k + 1] - s->rows[k]) * garble_table_size(gc);
+    return size ? size : 1;
+}
+
+typedef struct {
+    garble_circuit *gc;
+    shards *s;
+    const AES_KEY *key;
+    block delta;
+    block **segments;           /* per-shard table segments */
+    block *table;               /* next row of the running shard's segment */
+} garble_job;
+
+static void
+run_garble(void *arg, size_t start, size_t end)
+{
+    garble_job *job = arg;
+    _garble_gates(job->gc, job->key, job->delta, start, end, job->table);
+    job->table += garble_rows_in(job->gc, start, end) * garble_table_blocks(job->gc);
+}
+
+static int
+work_garble(void *arg, size_t k)
+{
+    /* Runs in the forked worker, so updating 'job' is private to it */
+    garble_job *job = arg;
+    job->table = job->segments[k];
+    return shard_loop(job->gc, job->s, k, run_garble, job);
+}
+
+int
+garble_garble_sharded(garble_circuit *gc, const block *input_labels,
+                      block *output_labels, size_t nshards)
+{
+    shards s;
+    garble_job job;
+    AES_KEY key;
+    block *wires = NULL, *private_wires;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL)
+        return GARBLE_ERR;
+    if (shards_new(&s, gc, nshards) == GARBLE_ERR)
+        return GARBLE_ERR;
+
+    memset(&job, '\0', sizeof job);
+    if ((job.segments = calloc(s.nshards, sizeof(block *))) == NULL)
+        goto cleanup;
+    if (_garble_init(gc, input_labels, &key, &job.delta, true) == GARBLE_ERR)
+        goto cleanup;
+
+    /* Labels are handed off between shards through a shared region */
+    if ((wires = shared_region("garble-wires", 2 * gc->r * sizeof(block))) == NULL)
+        goto cleanup;
+    memcpy(wires, gc->wires, 2 * (gc->n + 2) * sizeof(block));
+    for (size_t k = 0; k < s.nshards; ++k) {
+        if ((job.segments[k] = shared_region("garble-table",
+                                             segment_size(gc, &s, k))) == NULL)
+            goto cleanup;
+    }
+
+    private_wires = gc->wires;
+    gc->wires = wires;
+    job.gc = gc;
+    job.s = &s;
+    job.key = &key;
+    res = fork_workers(&s, work_garble, &job);
+    gc->wires = private_wires;
+
+    if (res == GARBLE_OK) {
+        /* Stitch the table segments and labels back into 'gc' */
+        for (size_t k = 0; k < s.nshards; ++k)
+            memcpy(gc->table + s.rows[k] * garble_table_blocks(gc),
+                   job.segments[k],
+                   (s.rows[k + 1] - s.rows[k]) * garble_table_size(gc));
+        memcpy(gc->wires, wires, 2 * gc->r * sizeof(block));
+        _garble_finish(gc, output_labels);
+    }
+
+cleanup:
+    if (job.segments) {
+        for (size_t k = 0; k < s.nshards; ++k) {
+            if (job.segments[k])
+                (void) munmap(job.segments[k], segment_size(gc, &s, k));
+        }
+        free(job.segments);
+    }
+    if (wires)
+        (void) munmap(wires, 2 * gc->r * sizeof(block));
+    shards_delete(&s);
+    return res;
+}
+
+typedef struct {
+    const garble_circuit *gc;
+    shards *s;
+    const AES_KEY *key;
+    block *labels;
+    const block *table;         /* next row of the running shard */
+} eval_job;
+
+static void
+run_eval(void *arg, size_t start, size_t end)
+{
+    eval_job *job = arg;
+    _eval_gates(job->gc, job->labels, job->key, start, end, job->table);
+    job->table += garble_rows_in(job->gc, start, end) * garble_table_blocks(job->gc);
+}
+
+static int
+work_eval(void *arg, size_t k)
+{
+    eval_job *job = arg;
+    job->table = job->gc->table + job->s->rows[k] * garble_table_blocks(job->gc);
+    return shard_loop(job->gc, job->s, k, run_eval, job);
+}
+
+int
+garble_eval_sharded(const garble_circuit *gc, const block *input_labels,
+                    block *output_labels, bool *outputs, size_t nshards)
+{
+    shards s;
+    eval_job job;
+    AES_KEY key;
+    int res;
+
+    if (gc == NULL)
+        return GARBLE_ERR;
+    if (shards_new(&s, gc, nshards) == GARBLE_ERR)
+        return GARBLE_ERR;
+
+    memset(&job, '\0', sizeof job);
+    if ((job.labels = shared_region("garble-labels", gc->r * sizeof(block))) == NULL) {
+        shards_delete(&s);
+        return GARBLE_ERR;
+    }
+    _eval_init(gc, input_labels, job.labels, &key);
+    job.gc = gc;
+    job.s = &s;
+    job.key = &key;
+    res = fork_workers(&s, work_eval, &job);
+    if (res == GARBLE_OK)
+        _eval_finish(gc, job.labels, output_labels, outputs);
+
+    (void) munmap(job.labels, gc->r * sizeof(block));
+    shards_delete(&s);
+    return res;
+}
@@ -0,0 +1,287 @@
+/*
+ * Streaming garbling and evaluation.
+ *
+ * Table rows are garbled into a buffer of 'chunk_rows' rows and handed to a
+ * write callback as soon as the buffer fills, so the full table is never
+ * resident.  Wire labels are kept bounded as well: garble_stream_new assigns
+ * every wire a label slot that is reused once the wire's last reader has run,
+ * so only as many labels as the circuit has live wires at once are stored.
+ * Inputs, fixed wires and outputs keep their slots for the whole run.  Gate
+ * order and tweaks are unchanged, so the streamed rows are exactly the table
+ * of garble_garble.
+ *
+ * The evaluator reads the same chunks into its own buffer and evaluates each
+ * gate as soon as its row has arrived, overwriting rows once the chunk is
+ * done.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NO_SLOT SIZE_MAX
+
+int
+garble_stream_new(garble_stream *stream, const garble_circuit *gc,
+                  size_t chunk_rows)
+{
+    size_t *last_use = NULL, *slot = NULL, *free_slots = NULL;
+    bool *pinned = NULL;
+    size_t nfree = 0;
+
+    if (stream == NULL || gc == NULL)
+        return GARBLE_ERR;
+    memset(stream, '\0', sizeof(garble_stream));
+    if (chunk_rows == 0)
+        chunk_rows = GARBLE_STREAM_ROWS;
+    stream->q = gc->q;
+    stream->chunk_rows = chunk_rows;
+
+    last_use = calloc(gc->r, sizeof(size_t));
+    slot = malloc(gc->r * sizeof(size_t));
+    free_slots = malloc(gc->r * sizeof(size_t));
+    pinned = calloc(gc->r, sizeof(bool));
+    stream->gates = malloc(gc->q * sizeof(garble_gate));
+    stream->outputs = calloc(gc->m, sizeof(int));
+    if (last_use == NULL || slot == NULL || free_slots == NULL
+        || pinned == NULL || stream->gates == NULL || stream->outputs == NULL)
+        goto error;
+
+    for (size_t w = 0; w < gc->r; ++w)
+        slot[w] = NO_SLOT;
+    /* Inputs and fixed wires occupy slots 0 .. n + 1, as in 'gc->wires' */
+    for (size_t w = 0; w < gc->n + 2 && w < gc->r; ++w) {
+        slot[w] = w;
+        pinned[w] = true;
+    }
+    stream->nslots = gc->n + 2;
+    for (size_t i = 0; i < gc->m; ++i) {
+        if ((size_t) gc->outputs[i] >= gc->r)
+            goto error;
+        pinned[gc->outputs[i]] = true;
+    }
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        if (g->output >= gc->r || g->input0 >= gc->r || g->input1 >= gc->r)
+            goto error;
+        last_use[g->input0] = i;
+        last_use[g->input1] = i;
+    }
+
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        garble_gate *sg = &stream->gates[i];
+
+        sg->type = g->type;
+        if (slot[g->input0] == NO_SLOT || slot[g->input1] == NO_SLOT)
+            goto error;         /* read before written */
+        sg->input0 = slot[g->input0];
+        sg->input1 = slot[g->input1];
+        /* Inputs read for the last time free their slots, which the output
+         * of this very gate may reuse: gates read their inputs before writing
+         * the output */
+        if (last_use[g->input0] == i && !pinned[g->input0]) {
+            free_slots[nfree++] = slot[g->input0];
+            slot[g->input0] = NO_SLOT;
+        }
+        if (last_use[g->input1] == i && !pinned[g->input1]
+            && slot[g->input1] != NO_SLOT) {
+            free_slots[nfree++] = slot[g->input1];
+            slot[g->input1] = NO_SLOT;
+        }
+        if (slot[g->output] == NO_SLOT)
+            slot[g->output] = nfree > 0 ? free_slots[--nfree] : stream->nslots++;
+        sg->output = slot[g->output];
+        /* A wire nobody reads later only needs its slot for this gate */
+        if (last_use[g->output] <= i && !pinned[g->output]) {
+            free_slots[nfree++] = slot[g->output];
+            slot[g->output] = NO_SLOT;
+        }
+    }
+    for (size_t i = 0; i < gc->m; ++i) {
+        if (slot[gc->outputs[i]] == NO_SLOT)
+            goto error;
+        stream->outputs[i] = slot[gc->outputs[i]];
+    }
+
+    stream->labels = garble_allocate_blocks(2 * stream->nslots);
+    stream->chunk = garble_allocate_blocks(chunk_rows * garble_table_blocks(gc));
+    if (stream->labels == NULL || stream->chunk == NULL)
+        goto error;
+
+    free(last_use);
+    free(slot);
+    free(free_slots);
+    free(pinned);
+    return GARBLE_OK;
+error:
+    free(last_use);
+    free(slot);
+    free(free_slots);
+    free(pinned);
+    garble_stream_delete(stream);
+    return GARBLE_ERR;
+}
+
+void
+garble_stream_delete(garble_stream *stream)
+{
+    if (stream == NULL)
+        return;
+    free(stream->gates);
+    free(stream->outputs);
+    free(stream->labels);
+    free(stream->chunk);
+    memset(stream, '\0', sizeof(garble_stream));
+}
+
+/* A view of 'gc' over the stream's label slots */
+static garble_circuit
+stream_view(const garble_stream *stream, const garble_circuit *gc)
+{
+    garble_circuit view = *gc;
+
+    view.gates = stream->gates;
+    view.outputs = stream->outputs;
+    view.r = stream->nslots;
+    view.wires = stream->labels;
+    view.table = NULL;
+    return view;
+}
+
+/* First gate after 'start' such that gates [start, end) fill at most
+ * 'chunk_rows' table rows */
+static size_t
+chunk_end(const garble_stream *stream, size_t start, size_t *nrows)
+{
+    size_t end = start, rows = 0;
+
+    while (end < stream->q && rows < stream->chunk_rows)
+        rows += garble_gate_is_free(stream->gates[end++].type) ? 0 : 1;
+    /* Trailing free gates need no rows */
+    while (end < stream->q && garble_gate_is_free(stream->gates[end].type))
+        ++end;
+    *nrows = rows;
+    return end;
+}
+
+int
+garble_stream_garble(garble_stream *stream, garble_circuit *gc,
+                     const block *input_labels, block *output_labels,
+                     garble_write_fn write, void *arg)
+{
+    garble_circuit view;
+    AES_KEY key;
+    block delta;
+
+    if (stream == NULL || gc == NULL || write == NULL || gc->q != stream->q)
+        return GARBLE_ERR;
+
+    view = stream_view(stream, gc);
+    if (_garble_init(&view, input_labels, &key, &delta, false) == GARBLE_ERR)
+        return GARBLE_ERR;
+    gc->output_perms = view.output_perms;
+    gc->fixed_label = view.fixed_label;
+    gc->global_key = view.global_key;
+
+    for (size_t start = 0; start < gc->q;) {
+        size_t nrows;
+        const size_t end = chunk_end(stream, start, &nrows);
+
+        _garble_gates(&view, &key, delta, start, end, stream->chunk);
+        if (nrows > 0
+            && write(arg, stream->chunk, nrows * garble_table_size(gc)) == GARBLE_ERR)
+            return GARBLE_ERR;
+        start = end;
+    }
+    _garble_finish(&view, output_labels);
+    return GARBLE_OK;
+}
+
+static int
+write_fd(void *arg, const void *buf, size_t len)
+{
+    return _garble_write_all(*(int *) arg, buf, len);
+}
+
+int
+garble_stream_garble_fd(garble_stream *stream, garble_circuit *gc,
+                        const block *input_labels, block *output_labels,
+                        int fd)
+{
+    return garble_stream_garble(stream, gc, input_labels, output_labels,
+                                write_fd, &fd);
+}
+
+int
+garble_stream_eval(garble_stream *stream, const garble_circuit *gc,
+                   const block *input_labels, block *output_labels,
+                   bool *outputs, garble_read_fn read, void *arg)
+{
+    garble_circuit view;
+    AES_KEY key;
+    size_t tsize;
+
+    if (stream == NULL || gc == NULL || read == NULL || gc->q != stream->q)
+        return GARBLE_ERR;
+
+    view = stream_view(stream, gc);
+    tsize = garble_table_size(gc);
+    _eval_init(&view, input_labels, stream->labels, &key);
+
+    for (size_t start = 0; start < gc->q;) {
+        size_t nrows, have = 0, gate = start, row = 0;
+        const size_t end = chunk_end(stream, start, &nrows);
+
+        for (;;) {
+            /* Evaluate every gate whose row has fully arrived */
+            const size_t ready = have / tsize;
+            size_t j = gate, r = row;
+            ssize_t res;
+
+            while (j < end
+                   && (garble_gate_is_free(stream->gates[j].type) || r < ready)) {
+                r += garble_gate_is_free(stream->gates[j].type) ? 0 : 1;
+                ++j;
+            }
+            if (j > gate) {
+                _eval_gates(&view, stream->labels, &key, gate, j,
+                            stream->chunk + row * garble_table_blocks(gc));
+                gate = j;
+                row = r;
+            }
+            if (gate == end)
+                break;
+            res = read(arg, (char *) stream->chunk + have, nrows * tsize - have);
+            if (res <= 0)
+                return GARBLE_ERR;
+            have += res;
+        }
+        start = end;
+    }
+    _eval_finish(&view, stream->labels, output_labels, outputs);
+    return GARBLE_OK;
+}
+
+static ssize_t
+read_fd(void *arg, void *buf, size_t len)
+{
+    ssize_t res;
+
+    do {
+        res = read(*(int *) arg, buf, len);
+    } while (res == -1 && errno == EINTR);
+    return res;
+}
+
+int
+garble_stream_eval_fd(garble_stream *stream, const garble_circuit *gc,
+                      const block *input_labels, block *output_labels,
+                      bool *outputs, int fd)
+{
+    return garble_stream_eval(stream, gc, input_labels, output_labels, outputs,
+                              read_fd, &fd);
+}
@@ -0,0 +1,83 @@
+/*
+ * Resumable garbling and evaluation.
+ *
+ * A garble_task holds everything garble_garble/garble_eval keep on their
+ * stack (key schedule, delta, evaluation labels) plus the position of the next
+ * gate, so that the work can be split into bounded slices and interleaved with
+ * other work, e.g. non-blocking I/O in an event loop.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+
+#include <string.h>
+
+int
+garble_task_garble(garble_task *task, garble_circuit *gc,
+                   const block *input_labels)
+{
+    if (task == NULL || gc == NULL)
+        return GARBLE_ERR;
+    memset(task, '\0', sizeof(garble_task));
+    task->gc = gc;
+    task->garbling = gc;
+    return _garble_init(gc, input_labels, &task->key, &task->delta, true);
+}
+
+int
+garble_task_eval(garble_task *task, const garble_circuit *gc,
+                 const block *input_labels)
+{
+    if (task == NULL || gc == NULL)
+        return GARBLE_ERR;
+    memset(task, '\0', sizeof(garble_task));
+    task->gc = gc;
+    if ((task->labels = garble_allocate_blocks(gc->r)) == NULL)
+        return GARBLE_ERR;
+    _eval_init(gc, input_labels, task->labels, &task->key);
+    return GARBLE_OK;
+}
+
+int
+garble_task_step(garble_task *task, size_t max_gates)
+{
+    const garble_circuit *gc;
+    size_t end;
+
+    if (task == NULL || task->gc == NULL)
+        return GARBLE_ERR;
+    gc = task->gc;
+    end = max_gates < gc->q - task->next ? task->next + max_gates : gc->q;
+    if (task->garbling) {
+        _garble_gates(task->garbling, &task->key, task->delta, task->next, end,
+                      task->garbling->table + task->row * garble_table_blocks(gc));
+    } else {
+        _eval_gates(gc, task->labels, &task->key, task->next, end,
+                    gc->table + task->row * garble_table_blocks(gc));
+    }
+    task->row += garble_rows_in(gc, task->next, end);
+    task->next = end;
+    return GARBLE_OK;
+}
+
+int
+garble_task_finish(garble_task *task, block *output_labels, bool *outputs)
+{
+    if (task == NULL || task->gc == NULL || !garble_task_done(task))
+        return GARBLE_ERR;
+    if (task->garbling)
+        _garble_finish(task->garbling, output_labels);
+    else
+        _eval_finish(task->gc, task->labels, output_labels, outputs);
+    garble_task_delete(task);
+    return GARBLE_OK;
+}
+
+void
+garble_task_delete(garble_task *task)
+{
+    if (task == NULL)
+        return;
+    free(task->labels);
+    memset(task, '\0', sizeof(garble_task));
+}
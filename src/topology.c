@@ -0,0 +1,223 @@
+/*
+ * Compact circuit topology format.
+ *
+ * A magic string, then n, m, q, r and the garbling type as LEB128 varints,
+ * then one record per gate, then the outputs.  Gate records exploit the fact
+ * that circuit builders allocate output wires in order and read wires defined
+ * shortly before:
+ *
+ *   v0 = zigzag(output - input0) << 4 | explicit << 3 | type
+ *   v1 = zigzag(output - input1)
+ *   [zigzag(output - (previous output + 1))]   only if 'explicit'
+ *
+ * Outputs are zigzag deltas against the previous output.  A typical gate
+ * takes 2-4 bytes instead of the 32 of a raw garble_gate.
+ */
+
+#include "garble.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define TOPOLOGY_MAGIC "GARBLET1"
+#define TOPOLOGY_MAGIC_LEN 8
+#define MAX_VARINT 10
+
+static inline uint64_t
+zigzag(int64_t x)
+{
+    return ((uint64_t) x << 1) ^ (uint64_t) (x >> 63);
+}
+
+static inline int64_t
+unzigzag(uint64_t x)
+{
+    return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+}
+
+static inline unsigned char *
+put_varint(unsigned char *p, uint64_t x)
+{
+    while (x >= 0x80) {
+        *p++ = (unsigned char) (x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (unsigned char) x;
+    return p;
+}
+
+static inline int
+get_varint(const unsigned char **p, const unsigned char *end, uint64_t *x)
+{
+    const unsigned char *q = *p;
+    uint64_t v = 0;
+
+    /* Most deltas fit in a single byte */
+    if (q < end && *q < 0x80) {
+        *x = *q;
+        *p = q + 1;
+        return GARBLE_OK;
+    }
+    for (unsigned shift = 0; q < end && shift < 64; shift += 7) {
+        const unsigned char b = *q++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (b < 0x80) {
+            *x = v;
+            *p = q;
+            return GARBLE_OK;
+        }
+    }
+    return GARBLE_ERR;
+}
+
+char *
+garble_topology_to_buffer(const garble_circuit *gc, size_t *size)
+{
+    unsigned char *buf, *p;
+    size_t prev;
+
+    if (gc == NULL || size == NULL)
+        return NULL;
+    buf = malloc(TOPOLOGY_MAGIC_LEN + MAX_VARINT * (5 + 3 * gc->q + gc->m));
+    if (buf == NULL)
+        return NULL;
+    memcpy(buf, TOPOLOGY_MAGIC, TOPOLOGY_MAGIC_LEN);
+    p = buf + TOPOLOGY_MAGIC_LEN;
+    p = put_varint(p, gc->n);
+    p = put_varint(p, gc->m);
+    p = put_varint(p, gc->q);
+    p = put_varint(p, gc->r);
+    p = put_varint(p, gc->type);
+    prev = gc->n + 1;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        const bool explicit = g->output != prev + 1;
+
+        p = put_varint(p, zigzag((int64_t) (g->output - g->input0)) << 4
+                       | (uint64_t) explicit << 3 | g->type);
+        p = put_varint(p, zigzag((int64_t) (g->output - g->input1)));
+        if (explicit)
+            p = put_varint(p, zigzag((int64_t) (g->output - (prev + 1))));
+        prev = g->output;
+    }
+    prev = 0;
+    for (size_t i = 0; i < gc->m; ++i) {
+        p = put_varint(p, zigzag((int64_t) gc->outputs[i] - (int64_t) prev));
+        prev = gc->outputs[i];
+    }
+    *size = p - buf;
+    return (char *) buf;
+}
+
+int
+garble_topology_from_buffer(garble_circuit *gc, const char *buf, size_t size)
+{
+    const unsigned char *p = (const unsigned char *) buf, *end = p + size;
+    uint64_t n, m, q, r, type, prev;
+    int64_t out = 0;
+
+    if (gc == NULL || buf == NULL || size < TOPOLOGY_MAGIC_LEN
+        || memcmp(buf, TOPOLOGY_MAGIC, TOPOLOGY_MAGIC_LEN) != 0)
+        return GARBLE_ERR;
+    p += TOPOLOGY_MAGIC_LEN;
+    if (get_varint(&p, end, &n) || get_varint(&p, end, &m)
+        || get_varint(&p, end, &q) || get_varint(&p, end, &r)
+        || get_varint(&p, end, &type))
+        return GARBLE_ERR;
+    /* Every gate takes at least two bytes and every output one.  Every wire
+       is an input, a fixed wire or a gate output, and wire indices must fit
+       the outputs' int, so 'r' cannot make the caller allocate more labels
+       than the buffer describes. */
+    if (type > GARBLE_TYPE_PRIVACY_FREE || q > size / 2 || m > size
+        || n > SIZE_MAX / 2 || n + 2 > r || r > n + 2 + q
+        || r > (uint64_t) INT_MAX + 1)
+        return GARBLE_ERR;
+
+    memset(gc, '\0', sizeof(garble_circuit));
+    gc->n = n;
+    gc->m = m;
+    gc->q = q;
+    gc->r = r;
+    gc->type = type;
+    gc->gates = malloc(q * sizeof(garble_gate));
+    gc->outputs = malloc(m * sizeof(int));
+    if ((q && gc->gates == NULL) || (m && gc->outputs == NULL))
+        goto error;
+
+    prev = n + 1;
+    for (size_t i = 0; i < q; ++i) {
+        garble_gate *g = &gc->gates[i];
+        uint64_t v0, v1, v2 = 0;
+
+        if (get_varint(&p, end, &v0) || get_varint(&p, end, &v1))
+            goto error;
+        if ((v0 & 0x8) && get_varint(&p, end, &v2))
+            goto error;
+        g->type = v0 & 0x7;
+        g->output = prev + 1 + unzigzag(v2);
+        g->input0 = g->output - unzigzag(v0 >> 4);
+        g->input1 = g->output - unzigzag(v1);
+        if (g->type > GARBLE_GATE_XNOR || g->output >= r || g->input0 >= r
+            || g->input1 >= r)
+            goto error;
+        gc->nxors += garble_gate_is_free(g->type) ? 1 : 0;
+        prev = g->output;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        uint64_t v;
+        if (get_varint(&p, end, &v))
+            goto error;
+        out += unzigzag(v);
+        if (out < 0 || (uint64_t) out >= r)
+            goto error;
+        gc->outputs[i] = out;
+    }
+    if (p != end)
+        goto error;
+    return GARBLE_OK;
+error:
+    garble_delete(gc);
+    return GARBLE_ERR;
+}
+
+int
+garble_topology_save(const garble_circuit *gc, FILE *f)
+{
+    size_t size;
+    char *buf;
+    int res;
+
+    if ((buf = garble_topology_to_buffer(gc, &size)) == NULL)
+        return GARBLE_ERR;
+    res = fwrite(buf, sizeof(char), size, f) == size ? GARBLE_OK : GARBLE_ERR;
+    free(buf);
+    return res;
+}
+
+int
+garble_topology_load(garble_circuit *gc, FILE *f)
+{
+    size_t size = 0, cap = 1 << 16;
+    char *buf = malloc(cap);
+    int res;
+
+    if (buf == NULL)
+        return GARBLE_ERR;
+    for (;;) {
+        size += fread(buf + size, sizeof(char), cap - size, f);
+        if (size < cap)
+            break;
+        {
+            char *tmp = realloc(buf, 2 * cap);
+            if (tmp == NULL) {
+                free(buf);
+                return GARBLE_ERR;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+    }
+    res = ferror(f) ? GARBLE_ERR : garble_topology_from_buffer(gc, buf, size);
+    free(buf);
+    return res;
+}
@@ -0,0 +1,443 @@
+/*
+ * Asynchronous table I/O with io_uring.
+ *
+ * garble_garble_uring garbles into a small set of page-aligned buffers and
+ * hands each full buffer to the kernel as a write while it keeps garbling
+ * into the next one; garble_eval_uring keeps reads of the next chunks in
+ * flight while it evaluates the current one.  Buffers are registered with the
+ * ring when the memlock limit allows it, and every chunk but the last is a
+ * multiple of GARBLE_URING_ALIGN bytes at an aligned offset, so 'fd' may be
+ * opened with O_DIRECT to bypass the page cache.
+ *
+ * The ring is driven with raw system calls.  Without <linux/io_uring.h>, or
+ * if the kernel refuses to set up a ring, the same code path falls back to
+ * synchronous pwrite/pread.
+ */
+
+#include "garble.h"
+#include "garble_internal.h"
+#include "config.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <linux/io_uring.h>
+#endif
+
+typedef struct {
+    void *buf;
+    uint64_t offset;
+    size_t len, need, done;     /* bytes requested, required, and transferred */
+    bool busy;
+    bool failed;                /* the last transfer failed */
+} slot;
+
+typedef struct {
+#ifdef HAVE_LINUX_IO_URING_H
+    int fd;
+    bool fixed;                 /* buffers are registered */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+#endif
+    bool active;                /* false: synchronous fallback */
+    int file;
+    bool writing;
+    size_t chunk_bytes;
+    slot slots[GARBLE_URING_DEPTH];
+} uring;
+
+static inline size_t
+align_up(size_t x)
+{
+    return (x + GARBLE_URING_ALIGN - 1) & ~(size_t) (GARBLE_URING_ALIGN - 1);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+static int
+ring_setup(uring *u)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, '\0', sizeof p);
+    u->fd = syscall(__NR_io_uring_setup, GARBLE_URING_DEPTH, &p);
+    if (u->fd < 0)
+        return GARBLE_ERR;
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_len > u->sq_ring_len)
+            u->sq_ring_len = u->cq_ring_len;
+        u->cq_ring_len = u->sq_ring_len;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED)
+        goto error;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED)
+            goto error_sq;
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto error_cq;
+
+    sq = u->sq_ring;
+    cq = u->cq_ring;
+    u->sq_head = (unsigned *) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) (sq + p.sq_off.array);
+    u->cq_head = (unsigned *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return GARBLE_OK;
+
+error_cq:
+    if (u->cq_ring != u->sq_ring)
+        (void) munmap(u->cq_ring, u->cq_ring_len);
+error_sq:
+    (void) munmap(u->sq_ring, u->sq_ring_len);
+error:
+    (void) close(u->fd);
+    return GARBLE_ERR;
+}
+
+static void
+ring_teardown(uring *u)
+{
+    (void) munmap(u->sqes, u->sqes_len);
+    if (u->cq_ring != u->sq_ring)
+        (void) munmap(u->cq_ring, u->cq_ring_len);
+    (void) munmap(u->sq_ring, u->sq_ring_len);
+    (void) close(u->fd);
+}
+
+/* Queue the remaining bytes of slot 'i' and submit */
+static int
+ring_submit(uring *u, size_t i)
+{
+    slot *s = &u->slots[i];
+    const unsigned tail = *u->sq_tail, idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    memset(sqe, '\0', sizeof *sqe);
+    if (u->fixed)
+        sqe->opcode = u->writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = u->writing ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = u->file;
+    sqe->addr = (uintptr_t) ((char *) s->buf + s->done);
+    sqe->len = s->len - s->done;
+    sqe->off = s->offset + s->done;
+    sqe->buf_index = i;
+    sqe->user_data = i;
+    u->sq_array[idx] = idx;
+    atomic_store_explicit((_Atomic unsigned *) u->sq_tail, tail + 1,
+                          memory_order_release);
+    while (syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            /* Nothing was consumed, so take the entry back */
+            atomic_store_explicit((_Atomic unsigned *) u->sq_tail, tail,
+                                  memory_order_release);
+            s->busy = false;
+            s->failed = true;
+            return GARBLE_ERR;
+        }
+    }
+    return GARBLE_OK;
+}
+
+/* Reap one completion; resubmits short transfers.  A failed transfer leaves
+ * its slot idle and marked as failed. */
+static int
+ring_reap(uring *u)
+{
+    for (;;) {
+        const unsigned head = *u->cq_head;
+        const unsigned tail = atomic_load_explicit((_Atomic unsigned *) u->cq_tail,
+                                                   memory_order_acquire);
+        struct io_uring_cqe *cqe;
+        slot *s;
+
+        if (head == tail) {
+            if (syscall(__NR_io_uring_enter, u->fd, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+                return GARBLE_ERR;
+            continue;
+        }
+        cqe = &u->cqes[head & *u->cq_mask];
+        s = &u->slots[cqe->user_data];
+        atomic_store_explicit((_Atomic unsigned *) u->cq_head, head + 1,
+                              memory_order_release);
+        if (cqe->res <= 0) {
+            s->busy = false;
+            s->failed = true;
+            return GARBLE_ERR;
+        }
+        s->done += cqe->res;
+        if (s->done < s->need)
+            return ring_submit(u, s - u->slots);
+        s->busy = false;
+        return GARBLE_OK;
+    }
+}
+
+#endif
+
+static int
+uring_new(uring *u, int file, bool writing, size_t chunk_bytes)
+{
+    memset(u, '\0', sizeof(uring));
+    u->file = file;
+    u->writing = writing;
+    u->chunk_bytes = chunk_bytes;
+    for (size_t i = 0; i < GARBLE_URING_DEPTH; ++i) {
+        if (posix_memalign(&u->slots[i].buf, GARBLE_URING_ALIGN, chunk_bytes) != 0) {
+            u->slots[i].buf = NULL;
+            goto error;
+        }
+        memset(u->slots[i].buf, '\0', chunk_bytes);
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+    if (ring_setup(u) == GARBLE_OK) {
+        struct iovec iov[GARBLE_URING_DEPTH];
+
+        u->active = true;
+        for (size_t i = 0; i < GARBLE_URING_DEPTH; ++i) {
+            iov[i].iov_base = u->slots[i].buf;
+            iov[i].iov_len = chunk_bytes;
+        }
+        /* Registration pins the buffers, which the memlock limit may forbid */
+        u->fixed = syscall(__NR_io_uring_register, u->fd,
+                           IORING_REGISTER_BUFFERS, iov, GARBLE_URING_DEPTH) == 0;
+    }
+#endif
+    return GARBLE_OK;
+error:
+    for (size_t i = 0; i < GARBLE_URING_DEPTH; ++i)
+        free(u->slots[i].buf);
+    return GARBLE_ERR;
+}
+
+static void
+uring_delete(uring *u)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    if (u->active)
+        ring_teardown(u);
+#endif
+    for (size_t i = 0; i < GARBLE_URING_DEPTH; ++i)
+        free(u->slots[i].buf);
+}
+
+/* Start transferring 'need' bytes of slot 'i' at 'offset'.  The request is
+ * rounded up to GARBLE_URING_ALIGN bytes for O_DIRECT, which reads past the
+ * end of the file simply come up short on. */
+static int
+uring_start(uring *u, size_t i, uint64_t offset, size_t need)
+{
+    slot *s = &u->slots[i];
+
+    s->offset = offset;
+    s->len = align_up(need);
+    s->need = need;
+    s->done = 0;
+    s->busy = true;
+    s->failed = false;
+#ifdef HAVE_LINUX_IO_URING_H
+    if (u->active)
+        return ring_submit(u, i);
+#endif
+    while (s->done < s->need) {
+        ssize_t res = u->writing
+            ? pwrite(u->file, (char *) s->buf + s->done, s->len - s->done,
+                     s->offset + s->done)
+            : pread(u->file, (char *) s->buf + s->done, s->len - s->done,
+                    s->offset + s->done);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            s->busy = false;
+            s->failed = true;
+            return GARBLE_ERR;
+        }
+        s->done += res;
+    }
+    s->busy = false;
+    return GARBLE_OK;
+}
+
+/* Wait until slot 'i' is idle; returns GARBLE_ERR if its transfer, or any
+ * other reaped on the way, failed.  The fallback completes every transfer in
+ * uring_start, so only the ring has anything to reap. */
+static int
+uring_wait(uring *u, size_t i)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    while (u->active && u->slots[i].busy) {
+        if (ring_reap(u) == GARBLE_ERR)
+            return GARBLE_ERR;
+    }
+#endif
+    return u->slots[i].failed ? GARBLE_ERR : GARBLE_OK;
+}
+
+/* Wait for every slot; returns GARBLE_ERR if any transfer failed */
+static int
+uring_drain(uring *u)
+{
+    int res = GARBLE_OK;
+    for (size_t i = 0; i < GARBLE_URING_DEPTH; ++i) {
+        if (uring_wait(u, i) == GARBLE_ERR)
+            res = GARBLE_ERR;
+    }
+    return res;
+}
+
+/* First gate after 'start' such that gates [start, end) fill at most
+ * GARBLE_URING_ROWS rows, absorbing trailing free gates */
+static size_t
+chunk_end(const garble_circuit *gc, size_t start, size_t *nrows)
+{
+    size_t end = start, rows = 0;
+
+    while (end < gc->q && rows < GARBLE_URING_ROWS)
+        rows += garble_gate_is_free(gc->gates[end++].type) ? 0 : 1;
+    while (end < gc->q && garble_gate_is_free(gc->gates[end].type))
+        ++end;
+    *nrows = rows;
+    return end;
+}
+
+int
+garble_garble_uring(garble_circuit *gc, const block *input_labels,
+                    block *output_labels, int fd)
+{
+    uring u;
+    AES_KEY key;
+    block delta;
+    size_t c = 0, rows;
+    const size_t tsize = garble_table_size(gc);
+    int res = GARBLE_ERR;
+
+    if (gc == NULL || fd < 0)
+        return GARBLE_ERR;
+    if (_garble_init(gc, input_labels, &key, &delta, false) == GARBLE_ERR)
+        return GARBLE_ERR;
+    if (uring_new(&u, fd, true, GARBLE_URING_ROWS * tsize) == GARBLE_ERR)
+        return GARBLE_ERR;
+
+    for (size_t start = 0; start < gc->q; ++c) {
+        const size_t i = c % GARBLE_URING_DEPTH;
+        const size_t end = chunk_end(gc, start, &rows);
+
+        if (uring_wait(&u, i) == GARBLE_ERR)
+            goto cleanup;
+        _garble_gates(gc, &key, delta, start, end, u.slots[i].buf);
+        /* Only the last chunk can be short; pad it for O_DIRECT */
+        if (rows > 0
+            && uring_start(&u, i, (uint64_t) c * u.chunk_bytes,
+                           rows * tsize) == GARBLE_ERR)
+            goto cleanup;
+        start = end;
+    }
+    if (uring_drain(&u) == GARBLE_ERR)
+        goto cleanup;
+    /* Drop the padding of the last chunk */
+    if (ftruncate(fd, (gc->q - gc->nxors) * tsize) == -1)
+        goto cleanup;
+    _garble_finish(gc, output_labels);
+    res = GARBLE_OK;
+
+cleanup:
+    (void) uring_drain(&u);
+    uring_delete(&u);
+    return res;
+}
+
+int
+garble_eval_uring(const garble_circuit *gc, const block *input_labels,
+                  block *output_labels, bool *outputs, int fd)
+{
+    uring u;
+    AES_KEY key;
+    block *labels;
+    const size_t tsize = garble_table_size(gc);
+    const size_t total = (gc->q - gc->nxors) * tsize;
+    size_t nchunks, next = 0, rows;
+    int res = GARBLE_ERR;
+
+    if (gc == NULL || fd < 0)
+        return GARBLE_ERR;
+    if ((labels = garble_allocate_blocks(gc->r)) == NULL)
+        return GARBLE_ERR;
+    if (uring_new(&u, fd, false, GARBLE_URING_ROWS * tsize) == GARBLE_ERR) {
+        free(labels);
+        return GARBLE_ERR;
+    }
+    nchunks = (total + u.chunk_bytes - 1) / u.chunk_bytes;
+    _eval_init(gc, input_labels, labels, &key);
+
+    /* Keep reads of the next GARBLE_URING_DEPTH chunks in flight */
+    for (size_t start = 0, c = 0; start < gc->q; ++c) {
+        const size_t end = chunk_end(gc, start, &rows);
+
+        for (; next < nchunks && next < c + GARBLE_URING_DEPTH; ++next) {
+            const uint64_t offset = (uint64_t) next * u.chunk_bytes;
+            const size_t len = total - offset < u.chunk_bytes
+                ? total - offset : u.chunk_bytes;
+            if (uring_start(&u, next % GARBLE_URING_DEPTH, offset, len)
+                == GARBLE_ERR)
+                goto cleanup;
+        }
+        if (rows > 0 && uring_wait(&u, c % GARBLE_URING_DEPTH) == GARBLE_ERR)
+            goto cleanup;
+        _eval_gates(gc, labels, &key, start, end,
+                    u.slots[c % GARBLE_URING_DEPTH].buf);
+        start = end;
+    }
+    if (uring_drain(&u) == GARBLE_ERR)
+        goto cleanup;
+    _eval_finish(gc, labels, output_labels, outputs);
+    res = GARBLE_OK;
+
+cleanup:
+    (void) uring_drain(&u);
+    uring_delete(&u);
+    free(labels);
+    return res;
+}
+
+bool
+garble_uring_available(void)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+    struct io_uring_params p;
+    int fd;
+
+    memset(&p, '\0', sizeof p);
+    if ((fd = syscall(__NR_io_uring_setup, 1, &p)) < 0)
+        return false;
+    (void) close(fd);
+    return true;
+#else
+    return false;
+#endif
+}
@@ -1,62 +1,53 @@
 #include "garble.h"
 #include "garble/block.h"
 #include "circuits.h"
+#include "circuit_cache.h"
 
 #include "utils.h"
 
 #include <assert.h>
+#include <dirent.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <openssl/sha.h>
 
 #define AES_CIRCUIT_FILE_NAME "./aesCircuit"
 
-static const size_t roundLimit = 10;
-static const size_t n = 128 * (10 + 1);
-static const size_t m = 128;
-
+/* Point the first gate of every entry in cache directory 'dir' at a wire far
+ * beyond the circuit; gates start at the first 64-byte boundary after the
+ * 104-byte entry header */
 static void
-build(garble_circuit *gc, garble_type_e type)
+corrupt_cache(const char *dir)
 {
-    garble_context ctxt;
-
-    int addKeyInputs[256];
-    int addKeyOutputs[128];
-    int subBytesOutputs[128];
-    int shiftRowsOutputs[128];
-    int mixColumnOutputs[128];
-
-    garble_new(gc, n, m, type);
-    builder_start_building(gc, &ctxt);
-    builder_init_wires(addKeyInputs, 256);
-    for (size_t round = 0; round < roundLimit; ++round) {
-
-        aescircuit_add_round_key(gc, &ctxt, addKeyInputs, addKeyOutputs);
-
-        for (int i = 0; i < 16; ++i) {
-            aescircuit_sub_bytes(gc, &ctxt, addKeyOutputs + 8 * i,
-                                 subBytesOutputs + 8 * i);
-        }
-
-        aescircuit_shift_rows(subBytesOutputs, shiftRowsOutputs);
-
-        for (size_t i = 0; i < 4; i++) {
-            if (round != roundLimit - 1)
-                aescircuit_mix_columns(gc, &ctxt, shiftRowsOutputs + i * 32,
-                                       mixColumnOutputs + 32 * i);
-        }
-        for (size_t i = 0; i < 128; i++) {
-            addKeyInputs[i] = mixColumnOutputs[i];
-            addKeyInputs[i + 128] = (round + 2) * 128 + i;
-        }
+    const size_t wire = (size_t) 1 << 40;
+    struct dirent *e;
+    DIR *d = opendir(dir);
+
+    assert(d);
+    while ((e = readdir(d)) != NULL) {
+        char path[4096];
+        FILE *f;
+
+        if (strstr(e->d_name, ".gck") == NULL)
+            continue;
+        (void) snprintf(path, sizeof path, "%s/%s", dir, e->d_name);
+        assert((f = fopen(path, "r+b")) != NULL);
+        assert(fseek(f, 128 + offsetof(garble_gate, input0), SEEK_SET) == 0);
+        assert(fwrite(&wire, sizeof wire, 1, f) == 1);
+        fclose(f);
     }
-    builder_finish_building(gc, &ctxt, mixColumnOutputs);
+    closedir(d);
 }
 
+static const size_t n = AES_CIRCUIT_N;
+static const size_t m = AES_CIRCUIT_M;
+
 static int
 run(garble_type_e type)
 {
@@ -85,7 +76,7 @@ run(garble_type_e type)
         break;
     }
 
-    build(&gc, type);
+    build_aes_circuit(&gc, type);
 
     seed = garble_seed(NULL);
 
@@ -114,12 +105,181 @@ run(garble_type_e type)
             garble_circuit gc2;
 
             (void) garble_seed(&seed);
-            build(&gc2, type);
+            build_aes_circuit(&gc2, type);
             garble_garble(&gc2, NULL, NULL);
             assert(garble_check(&gc2, hash) == GARBLE_OK);
             garble_delete(&gc2);
         }
 
+        {
+            garble_circuit gc2;
+            unsigned char hash2[SHA_DIGEST_LENGTH];
+            bool *outputVals3 = calloc(m, sizeof(bool));
+            FILE *f;
+
+            (void) garble_seed(&seed);
+            build_aes_circuit(&gc2, type);
+            f = fopen("aes.gc", "w");
+            assert(garble_garble_pipelined(&gc2, NULL, NULL, fileno(f), true,
+                                           hash2) == GARBLE_OK);
+            fclose(f);
+            assert(memcmp(hash, hash2, SHA_DIGEST_LENGTH) == 0);
+            garble_delete(&gc2);
+
+            build_aes_circuit(&gc2, type);
+            f = fopen("aes.gc", "r");
+            garble_load(&gc2, f, true, false);
+            fclose(f);
+            assert(garble_check(&gc2, hash) == GARBLE_OK);
+            garble_eval(&gc2, extractedLabels, NULL, outputVals3);
+            assert(memcmp(outputVals, outputVals3, m * sizeof(bool)) == 0);
+            garble_delete(&gc2);
+            free(outputVals3);
+        }
+
+        {
+            /* The writev/readv path writes the garble_to_buffer layout */
+            garble_circuit gc2;
+            const size_t size = garble_size(&gc, false, true);
+            char *buf = garble_to_buffer(&gc, NULL, false, true);
+            char *buf2 = malloc(sizeof size + size);
+            FILE *f = tmpfile();
+
+            assert(garble_save_fd(&gc, fileno(f), false, true) == GARBLE_OK);
+            rewind(f);
+            assert(fread(buf2, 1, sizeof size + size, f) == sizeof size + size);
+            assert(memcmp(buf2, &size, sizeof size) == 0);
+            assert(memcmp(buf2 + sizeof size, buf, size) == 0);
+            rewind(f);
+            assert(garble_load_fd(&gc2, fileno(f), false, true) == GARBLE_OK);
+            assert(garble_check(&gc2, hash) == GARBLE_OK);
+            assert(memcmp(gc.wires, gc2.wires, 2 * gc.r * sizeof(block)) == 0);
+            garble_delete(&gc2);
+            fclose(f);
+            free(buf);
+            free(buf2);
+        }
+
+        {
+            /* Evaluate straight from a read-only mapping of the file */
+            garble_circuit gc2;
+            bool *outputVals3 = calloc(m, sizeof(bool));
+            FILE *f = tmpfile();
+
+            assert(garble_save_mmap(&gc, fileno(f)) == GARBLE_OK);
+            assert(garble_load_mmap(&gc2, fileno(f)) == GARBLE_OK);
+            fclose(f);
+            assert((uintptr_t) gc2.table % GARBLE_MAP_ALIGN == 0);
+            assert((uintptr_t) gc2.gates % GARBLE_MAP_ALIGN == 0);
+            assert(garble_check(&gc2, hash) == GARBLE_OK);
+            garble_eval(&gc2, extractedLabels, NULL, outputVals3);
+            assert(memcmp(outputVals, outputVals3, m * sizeof(bool)) == 0);
+            garble_delete(&gc2);
+            free(outputVals3);
+        }
+
+        {
+            /* Compact topology round trip */
+            garble_circuit gc2;
+            size_t size;
+            char *buf = garble_topology_to_buffer(&gc, &size);
+            mytime_t start = current_time_ns();
+
+            assert(buf);
+            assert(garble_topology_from_buffer(&gc2, buf, size) == GARBLE_OK);
+            printf("topology: %lu bytes (%.2f B/gate) vs %lu raw, decoded in %.2f ns/g\n",
+                   size, (double) size / gc.q, gc.q * sizeof(garble_gate),
+                   (double) (current_time_ns() - start) / gc.q);
+            assert(gc2.n == gc.n && gc2.m == gc.m && gc2.q == gc.q
+                   && gc2.r == gc.r && gc2.nxors == gc.nxors
+                   && gc2.type == gc.type);
+            for (size_t i = 0; i < gc.q; ++i) {
+                assert(gc2.gates[i].type == gc.gates[i].type);
+                assert(gc2.gates[i].input0 == gc.gates[i].input0);
+                assert(gc2.gates[i].input1 == gc.gates[i].input1);
+                assert(gc2.gates[i].output == gc.gates[i].output);
+            }
+            assert(memcmp(gc2.outputs, gc.outputs, gc.m * sizeof(int)) == 0);
+            garble_delete(&gc2);
+            assert(garble_topology_from_buffer(&gc2, buf, size - 1) == GARBLE_ERR);
+            free(buf);
+            /* More wires than inputs, fixed wires and gates, and an input
+               count that wraps */
+            {
+                const size_t r = gc.r, n2 = gc.n;
+
+                gc.r = gc.n + 2 + gc.q + 1;
+                buf = garble_topology_to_buffer(&gc, &size);
+                assert(garble_topology_from_buffer(&gc2, buf, size) == GARBLE_ERR);
+                free(buf);
+                gc.r = r;
+                gc.n = SIZE_MAX - 1;
+                buf = garble_topology_to_buffer(&gc, &size);
+                assert(garble_topology_from_buffer(&gc2, buf, size) == GARBLE_ERR);
+                free(buf);
+                gc.n = n2;
+            }
+        }
+
+        {
+            /* Topology cache: a miss builds and stores, a hit maps the entry */
+            garble_circuit gc2, gc3;
+            char dir[] = "./aes-cache-XXXXXX";
+            bool hit;
+            mytime_t start, buildTime, hitTime;
+
+            assert(mkdtemp(dir));
+            start = current_time_ns();
+            assert(builder_cache_build(&gc2, dir, "aes-10", type,
+                                       build_aes_circuit, &hit) == GARBLE_OK);
+            buildTime = current_time_ns() - start;
+            assert(!hit);
+            start = current_time_ns();
+            assert(builder_cache_build(&gc3, dir, "aes-10", type,
+                                       build_aes_circuit, &hit) == GARBLE_OK);
+            hitTime = current_time_ns() - start;
+            assert(hit);
+            printf("cache: build %.2f ms, hit %.3f ms\n", buildTime / 1e6,
+                   hitTime / 1e6);
+            assert(gc3.n == gc.n && gc3.m == gc.m && gc3.q == gc.q
+                   && gc3.r == gc.r && gc3.nxors == gc.nxors);
+            for (size_t i = 0; i < gc.q; ++i) {
+                assert(gc3.gates[i].type == gc.gates[i].type);
+                assert(gc3.gates[i].input0 == gc.gates[i].input0);
+                assert(gc3.gates[i].input1 == gc.gates[i].input1);
+                assert(gc3.gates[i].output == gc.gates[i].output);
+            }
+            assert(memcmp(gc3.outputs, gc.outputs, gc.m * sizeof(int)) == 0);
+            /* A cached topology garbles like a freshly built one */
+            (void) garble_seed(&seed);
+            assert(garble_garble(&gc3, NULL, NULL) == GARBLE_OK);
+            assert(garble_check(&gc3, hash) == GARBLE_OK);
+            garble_delete(&gc2);
+            garble_delete(&gc3);
+            /* An entry with a wire out of range is dropped and rebuilt */
+            corrupt_cache(dir);
+            assert(builder_cache_build(&gc2, dir, "aes-10", type,
+                                       build_aes_circuit, &hit) == GARBLE_OK);
+            assert(!hit);
+            assert(gc2.q == gc.q && gc2.gates[0].input0 == gc.gates[0].input0);
+            garble_delete(&gc2);
+            assert(builder_cache_build(&gc2, dir, "aes-10", type,
+                                       build_aes_circuit, &hit) == GARBLE_OK);
+            assert(hit);
+            garble_delete(&gc2);
+            /* The type is part of the key */
+            assert(builder_cache_build(&gc2, dir, "aes-10",
+                                       (type + 1) % 3, build_aes_circuit,
+                                       &hit) == GARBLE_OK);
+            assert(!hit);
+            garble_delete(&gc2);
+            {
+                char cmd[64];
+                (void) snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+                assert(system(cmd) == 0);
+            }
+        }
+
         {
             FILE *f;
             f = fopen("aes.gc", "w");
@@ -127,7 +287,7 @@ run(garble_type_e type)
             fclose(f);
             garble_delete(&gc);
 
-            build(&gc, type);
+            build_aes_circuit(&gc, type);
             f = fopen("aes.gc", "r");
             garble_load(&gc, f, true, false);
             fclose(f);
@@ -156,7 +316,7 @@ run(garble_type_e type)
         double *timeEvalMedians = calloc(times, sizeof(double));
         bool *outputs = calloc(m, sizeof(bool));
 
-        build(&gc, type);
+        build_aes_circuit(&gc, type);
 
         for (int j = 0; j < times; j++) {
             for (int i = 0; i < times; i++) {
@@ -195,7 +355,7 @@ run(garble_type_e type)
         unsigned long long start, end;
         bool *outputs = calloc(m, sizeof(bool));
 
-        build(&gc, type);
+        build_aes_circuit(&gc, type);
 
         start = current_time_ns();
         for (int i = 0; i < niterations; ++i) {
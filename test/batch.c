@@ -0,0 +1,171 @@
+#include "garble.h"
+#include "circuits.h"
+#include "circuit_builder.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Throughput benchmark for the batch API on many small comparison and
+ * equality circuits, checking every output against the plaintext result */
+
+#define LES_N 20                /* circuit_les only supports n < 22 */
+#define EQU_N 64
+
+static void
+build_les(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[LES_N];
+    int output;
+
+    garble_new(gc, LES_N, 1, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, LES_N);
+    circuit_les(gc, &ctxt, LES_N, inputs, &output);
+    builder_finish_building(gc, &ctxt, &output);
+}
+
+static void
+build_equ(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[EQU_N];
+    int output[1];
+
+    garble_new(gc, EQU_N, 1, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, EQU_N);
+    circuit_equ(gc, &ctxt, EQU_N, inputs, output);
+    builder_finish_building(gc, &ctxt, output);
+}
+
+/* Value of the 'nbits'-bit number at 'bits', least significant bit first */
+static uint64_t
+value(const bool *bits, size_t nbits)
+{
+    uint64_t v = 0;
+
+    for (size_t i = nbits; i-- > 0;)
+        v = (v << 1) | bits[i];
+    return v;
+}
+
+/* circuit_les outputs 1 iff the second half is less than the first, and
+ * circuit_equ 1 iff the halves are equal */
+static bool
+plaintext(const garble_circuit *gc, const bool *inputs)
+{
+    const uint64_t a = value(inputs, gc->n / 2),
+        b = value(inputs + gc->n / 2, gc->n / 2);
+
+    return gc->n == LES_N ? b < a : a == b;
+}
+
+static int
+run(garble_type_e type, size_t count, size_t maxthreads)
+{
+    garble_circuit templates[2];
+    garble_circuit *gcs = calloc(count, sizeof(garble_circuit));
+    const block **inputLabels = calloc(count, sizeof(block *));
+    block **extractedLabels = calloc(count, sizeof(block *));
+    bool **outputs = calloc(count, sizeof(bool *));
+    bool *expected = calloc(count, sizeof(bool));
+    bool *inputs = calloc(EQU_N, sizeof(bool));
+    block *extracted;
+    bool *outputBits = calloc(count, sizeof(bool));
+    garble_batch batch;
+
+    build_les(&templates[0], type);
+    build_equ(&templates[1], type);
+    extracted = garble_allocate_blocks(count * EQU_N);
+    printf("les: q=%lu nxors=%lu  equ: q=%lu nxors=%lu  instances=%lu\n",
+           templates[0].q, templates[0].nxors, templates[1].q,
+           templates[1].nxors, count);
+
+    /* Instances share the gates and outputs of their template */
+    for (size_t i = 0; i < count; ++i) {
+        gcs[i] = templates[i % 2];
+        gcs[i].table = NULL;
+        gcs[i].wires = NULL;
+        gcs[i].output_perms = NULL;
+        extractedLabels[i] = extracted + i * EQU_N;
+        outputs[i] = &outputBits[i];
+    }
+    assert(garble_batch_new(&batch, gcs, count) == GARBLE_OK);
+
+    printf("threads  garble(circuits/s)  eval(circuits/s)\n");
+    for (size_t t = 1; t <= maxthreads; ++t) {
+        mytime_t start, garbleTime, evalTime;
+
+        start = current_time_ns();
+        assert(garble_batch_garble(&batch, NULL, NULL, t) == GARBLE_OK);
+        garbleTime = current_time_ns() - start;
+
+        for (size_t i = 0; i < count; ++i) {
+            const garble_circuit *gc = &gcs[i];
+            for (size_t j = 0; j < gc->n; ++j)
+                inputs[j] = rand() % 2;
+            if (i % 4 == 1) /* make some equality instances hold */
+                memcpy(inputs + EQU_N / 2, inputs, EQU_N / 2 * sizeof(bool));
+            garble_extract_labels(extractedLabels[i], gc->wires, inputs, gc->n);
+            expected[i] = plaintext(gc, inputs);
+            inputLabels[i] = extractedLabels[i];
+        }
+
+        memset(outputBits, '\0', count * sizeof(bool));
+        start = current_time_ns();
+        assert(garble_batch_eval(&batch, inputLabels, NULL, outputs, t)
+               == GARBLE_OK);
+        evalTime = current_time_ns() - start;
+        assert(memcmp(outputBits, expected, count * sizeof(bool)) == 0);
+
+        printf("%7lu  %18.0f  %16.0f\n", t,
+               count / ((double) garbleTime / 1000000000.0),
+               count / ((double) evalTime / 1000000000.0));
+    }
+
+    garble_batch_delete(&batch);
+    for (size_t i = 0; i < count; ++i)
+        assert(gcs[i].wires == NULL && gcs[i].table == NULL);
+    garble_delete(&templates[0]);
+    garble_delete(&templates[1]);
+    free(gcs);
+    free(inputLabels);
+    free(extractedLabels);
+    free(outputs);
+    free(expected);
+    free(inputs);
+    free(extracted);
+    free(outputBits);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = 100000;
+
+    if (argc > 1)
+        maxthreads = atoi(argv[1]);
+    if (argc > 2)
+        count = atoi(argv[2]);
+    if (maxthreads < 4)
+        maxthreads = 4;
+
+    (void) garble_seed(NULL);
+    printf("Type: Standard\n");
+    if (run(GARBLE_TYPE_STANDARD, count, maxthreads))
+        return 1;
+    printf("Type: Half-gates\n");
+    if (run(GARBLE_TYPE_HALFGATES, count, maxthreads))
+        return 1;
+    printf("Type: Privacy free\n");
+    if (run(GARBLE_TYPE_PRIVACY_FREE, count, maxthreads))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Import Bristol Fashion netlists: a small hand-written one covering every
+ * gate kind, checked against its truth table, and the AES circuit exported to
+ * Bristol, checked against the original and timed */
+
+/* Inputs a, b; outputs a AND b, NOT a, 1, (a XOR b) AND b and a AND b AND b
+ * (both via MAND) */
+static const char *small =
+    "8 11\n"
+    "2 1 1\n"
+    "5 1 1 1 1 1\n"
+    "\n"
+    "2 1 0 1 2 XOR\n"
+    "2 1 0 1 3 AND\n"
+    "1 1 0 4 INV\n"
+    "1 1 1 5 EQ\n"
+    "4 2 2 3 1 1 9 10 MAND\n"
+    "1 1 3 6 EQW\n"
+    "1 1 4 7 EQW\n"
+    "1 1 5 8 EQW\n";
+
+static void
+eval_plain(garble_circuit *gc, const bool *inputs, bool *outputs)
+{
+    block *labels = garble_allocate_blocks(gc->n);
+
+    assert(garble_garble(gc, NULL, NULL) == GARBLE_OK);
+    garble_extract_labels(labels, gc->wires, inputs, gc->n);
+    assert(garble_eval(gc, labels, NULL, outputs) == GARBLE_OK);
+    free(labels);
+}
+
+static void
+check_small(garble_type_e type)
+{
+    garble_circuit gc;
+    FILE *f = tmpfile();
+
+    fputs(small, f);
+    rewind(f);
+    assert(garble_load_bristol(&gc, f, type) == GARBLE_OK);
+    fclose(f);
+    assert(gc.n == 2 && gc.m == 5 && gc.q == 9 && gc.r == 13);
+    for (int x = 0; x < 4; ++x) {
+        const bool in[2] = { x & 1, x >> 1 };
+        const bool expect[5] = { in[0] & in[1], !in[0], 1,
+                                 (in[0] ^ in[1]) & in[1], in[0] & in[1] };
+        bool out[5];
+
+        eval_plain(&gc, in, out);
+        assert(memcmp(out, expect, sizeof out) == 0);
+    }
+    garble_delete(&gc);
+}
+
+/* Write 'gc' as a Bristol Fashion netlist.  Wire numbers are kept: the
+ * fixed wires become EQ gates, and the outputs are copied to the last wires
+ * with EQW gates. */
+static void
+write_bristol(const garble_circuit *gc, FILE *f)
+{
+    const size_t r = gc->r + gc->m;
+
+    fprintf(f, "%lu %lu\n1 %lu\n1 %lu\n\n", 2 + gc->q + gc->m, r, gc->n, gc->m);
+    fprintf(f, "1 1 0 %lu EQ\n1 1 1 %lu EQ\n", gc->n, gc->n + 1);
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        switch (g->type) {
+        case GARBLE_GATE_XOR:
+            fprintf(f, "2 1 %lu %lu %lu XOR\n", g->input0, g->input1,
+                    g->output);
+            break;
+        case GARBLE_GATE_AND:
+            fprintf(f, "2 1 %lu %lu %lu AND\n", g->input0, g->input1,
+                    g->output);
+            break;
+        case GARBLE_GATE_NOT:
+            fprintf(f, "1 1 %lu %lu INV\n", g->input0, g->output);
+            break;
+        default:
+            assert(0);
+        }
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        fprintf(f, "1 1 %lu %lu EQW\n", (size_t) gc->outputs[i],
+                r - gc->m + i);
+}
+
+static void
+check_aes(garble_type_e type)
+{
+    garble_circuit gc, gc2;
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+    FILE *f = tmpfile();
+    mytime_t start, loadTime;
+
+    build_aes_circuit(&gc, type);
+    write_bristol(&gc, f);
+    rewind(f);
+    assert(garble_load_bristol(&gc2, f, type) == GARBLE_OK);
+    garble_delete(&gc2);
+    rewind(f);
+    start = current_time_ns();
+    assert(garble_load_bristol(&gc2, f, type) == GARBLE_OK);
+    loadTime = current_time_ns() - start;
+    fclose(f);
+    assert(gc2.n == gc.n && gc2.m == gc.m && gc2.q == 2 + gc.q + gc.m);
+    printf("AES: %lu gates imported in %.2f ns/g\n", gc2.q,
+           (double) loadTime / gc2.q);
+
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    eval_plain(&gc, inputs, outputs);
+    eval_plain(&gc2, inputs, outputs2);
+    assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+
+    garble_delete(&gc);
+    garble_delete(&gc2);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+}
+
+int
+main(void)
+{
+    check_small(GARBLE_TYPE_STANDARD);
+    check_small(GARBLE_TYPE_HALFGATES);
+    check_aes(GARBLE_TYPE_HALFGATES);
+    return 0;
+}
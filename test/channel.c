@@ -0,0 +1,229 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* End-to-end latency and throughput of the AES circuit sent from a garbler
+ * process to an evaluator process over a channel, with the table streamed in
+ * chunks and with the whole table sent as a single chunk */
+
+static int
+cmp_time(const void *a, const void *b)
+{
+    const mytime_t x = *(const mytime_t *) a, y = *(const mytime_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Evaluator process: receive input labels, evaluate, send back outputs */
+static int
+evaluate(garble_channel *ch, size_t chunk_rows, size_t nrounds)
+{
+    garble_circuit gc;
+    garble_stream stream;
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    int res = 0;
+
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    if (garble_stream_new(&stream, &gc, chunk_rows) == GARBLE_ERR)
+        return 1;
+    for (size_t r = 0; r < nrounds; ++r) {
+        if (garble_channel_recv(ch, extractedLabels, gc.n * sizeof(block))
+            == GARBLE_ERR
+            || garble_channel_eval(ch, &stream, &gc, extractedLabels, NULL,
+                                   outputs) == GARBLE_ERR
+            || garble_channel_send(ch, outputs, gc.m * sizeof(bool))
+            == GARBLE_ERR) {
+            res = 1;
+            break;
+        }
+    }
+    garble_stream_delete(&stream);
+    garble_delete(&gc);
+    free(extractedLabels);
+    free(outputs);
+    return res;
+}
+
+/* Garbler process: garble and send 'nrounds' instances, timing each round
+ * until the evaluator's outputs are back; the first round is checked against
+ * garble_eval on the same garbling */
+static int
+run(const char *name, size_t chunk_rows, bool single, size_t nrounds)
+{
+    garble_channel ch, peer;
+    garble_circuit gc;
+    garble_stream stream;
+    block *inputLabels = garble_allocate_blocks(2 * AES_CIRCUIT_N);
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    mytime_t *times = calloc(nrounds, sizeof(mytime_t));
+    mytime_t start, total = 0;
+    pid_t pid;
+    int status;
+
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    if (single)
+        chunk_rows = gc.q;
+    assert(garble_channel_pair(&ch, &peer) == GARBLE_OK);
+    (void) fflush(NULL);
+    if ((pid = fork()) == 0) {
+        garble_channel_close(&ch);
+        _exit(evaluate(&peer, chunk_rows, nrounds));
+    }
+    assert(pid != -1);
+    garble_channel_close(&peer);
+
+    assert(garble_stream_new(&stream, &gc, chunk_rows) == GARBLE_OK);
+    (void) garble_seed(NULL);
+
+    for (size_t r = 0; r < nrounds; ++r) {
+        block seed;
+
+        garble_create_input_labels(inputLabels, gc.n, NULL, false);
+        for (size_t i = 0; i < gc.n; ++i)
+            inputs[i] = rand() % 2;
+        garble_extract_labels(extractedLabels, inputLabels, inputs, gc.n);
+        seed = garble_seed(NULL);
+
+        start = current_time_ns();
+        assert(garble_channel_send(&ch, extractedLabels, gc.n * sizeof(block))
+               == GARBLE_OK);
+        assert(garble_channel_garble(&ch, &stream, &gc, inputLabels, NULL)
+               == GARBLE_OK);
+        assert(garble_channel_recv(&ch, outputs, gc.m * sizeof(bool))
+               == GARBLE_OK);
+        times[r] = current_time_ns() - start;
+        total += times[r];
+
+        if (r == 0) {
+            garble_circuit gc2;
+            bool *outputs2 = calloc(gc.m, sizeof(bool));
+
+            (void) garble_seed(&seed);
+            build_aes_circuit(&gc2, GARBLE_TYPE_HALFGATES);
+            garble_garble(&gc2, inputLabels, NULL);
+            garble_eval(&gc2, extractedLabels, NULL, outputs2);
+            assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+            garble_delete(&gc2);
+            free(outputs2);
+        }
+    }
+
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    qsort(times, nrounds, sizeof(mytime_t), cmp_time);
+    printf("%-8s p50=%8.1f us  p99=%8.1f us  %8.1f rounds/s  %7.1f MB/s\n",
+           name, times[nrounds / 2] / 1e3, times[nrounds * 99 / 100] / 1e3,
+           nrounds / (total / 1e9), ch.sent / 1e6 / (total / 1e9));
+
+    garble_channel_close(&ch);
+    garble_stream_delete(&stream);
+    garble_delete(&gc);
+    free(inputLabels);
+    free(extractedLabels);
+    free(inputs);
+    free(outputs);
+    free(times);
+    return 0;
+}
+
+/* Serve a circuit pre-garbled to disk with sendfile: the whole saved
+ * circuit, then its table section alone, checking both against the
+ * garbling in memory */
+static int
+serve_saved(size_t nrounds)
+{
+    garble_channel ch, peer;
+    garble_circuit gc, gc2;
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+    mytime_t start, total = 0;
+    size_t tsize;
+    block *table;
+    FILE *f = tmpfile();
+    pid_t pid;
+    int status;
+
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    (void) garble_seed(NULL);
+    assert(garble_garble(&gc, NULL, NULL) == GARBLE_OK);
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extractedLabels, gc.wires, inputs, gc.n);
+    assert(garble_eval(&gc, extractedLabels, NULL, outputs) == GARBLE_OK);
+    assert(garble_save(&gc, f, true, false) == GARBLE_OK);
+    tsize = (gc.q - gc.nxors) * garble_table_size(&gc);
+
+    assert(garble_channel_pair(&ch, &peer) == GARBLE_OK);
+    (void) fflush(NULL);
+    if ((pid = fork()) == 0) {
+        int res = 0;
+        garble_channel_close(&peer);
+        for (size_t r = 0; r < nrounds && res == 0; ++r) {
+            if (garble_channel_send_saved(&ch, fileno(f)) == GARBLE_ERR
+                || garble_channel_send_table(&ch, fileno(f)) == GARBLE_ERR)
+                res = 1;
+        }
+        _exit(res);
+    }
+    assert(pid != -1);
+    garble_channel_close(&ch);
+
+    table = garble_allocate_blocks(tsize / sizeof(block));
+    for (size_t r = 0; r < nrounds; ++r) {
+        build_aes_circuit(&gc2, GARBLE_TYPE_HALFGATES);
+        start = current_time_ns();
+        assert(garble_channel_recv_saved(&peer, &gc2, true, false) == GARBLE_OK);
+        assert(garble_channel_recv(&peer, table, tsize) == GARBLE_OK);
+        total += current_time_ns() - start;
+        assert(memcmp(gc2.table, gc.table, tsize) == 0);
+        assert(memcmp(table, gc.table, tsize) == 0);
+        assert(garble_eval(&gc2, extractedLabels, NULL, outputs2) == GARBLE_OK);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        garble_delete(&gc2);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    printf("%-8s %7.1f MB/s\n", "sendfile", peer.received / 1e6 / (total / 1e9));
+
+    garble_channel_close(&peer);
+    garble_delete(&gc);
+    fclose(f);
+    free(table);
+    free(extractedLabels);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t nrounds = 200, chunk_rows = 0;
+
+    if (argc > 1)
+        nrounds = atoi(argv[1]);
+    if (argc > 2)
+        chunk_rows = atoi(argv[2]);
+
+    if (serve_saved(nrounds / 10 + 1))
+        return 1;
+    if (run("stream", chunk_rows, false, nrounds))
+        return 1;
+    /* Garbling completes before the first byte is sent */
+    if (run("single", 0, true, nrounds))
+        return 1;
+    return 0;
+}
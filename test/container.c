@@ -0,0 +1,235 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Save the garbled AES circuit as a sectioned container, fetch its table
+ * segments concurrently from several threads, check that corruption is
+ * detected, and evaluate the fully loaded circuit with its stored schedule;
+ * then check that forged segment sizes and schedules are rejected even when
+ * their checksums are right */
+
+#define NREADERS 4
+/* Size of the container header, and offset of its checksum */
+#define HEADER_SIZE 112
+#define HEADER_CHECKSUM 96
+
+typedef struct {
+    const garble_container *c;
+    const garble_circuit *gc;
+    size_t id;
+    size_t segments;
+} reader;
+
+static void *
+read_segments(void *arg)
+{
+    reader *rd = arg;
+    const size_t tblocks = garble_table_size(rd->gc) / sizeof(block);
+    size_t row = 0, k = 0;
+
+    /* Each reader fetches every NREADERS-th segment, in order */
+    for (size_t i = 0; i < rd->c->nsections; ++i) {
+        const garble_section *s = &rd->c->sections[i];
+        block *buf;
+
+        if (s->kind != GARBLE_SECTION_TABLE)
+            continue;
+        if (k++ % NREADERS == rd->id) {
+            assert(garble_container_find(rd->c, GARBLE_SECTION_TABLE, s->start) == s);
+            buf = garble_allocate_blocks(s->size / sizeof(block) + 1);
+            assert(garble_container_read(rd->c, s, buf) == GARBLE_OK);
+            assert(memcmp(buf, rd->gc->table + row * tblocks, s->size) == 0);
+            free(buf);
+            ++rd->segments;
+        }
+        row += s->size / garble_table_size(rd->gc);
+    }
+    return NULL;
+}
+
+static uint32_t
+crc32c(uint32_t crc, const unsigned char *p, size_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+/* Set the size of section 'i' of the container in 'f' and fix up every
+ * checksum, as a malicious writer would */
+static void
+forge_size(FILE *f, size_t nsections, size_t i, uint64_t size)
+{
+    const size_t len = HEADER_SIZE + nsections * sizeof(garble_section);
+    unsigned char *head = malloc(len), *data = malloc(size);
+    garble_section *dir = (garble_section *) (head + HEADER_SIZE);
+    uint32_t checksum = 0;
+
+    assert(fseek(f, 0, SEEK_SET) == 0 && fread(head, 1, len, f) == len);
+    assert(fseek(f, dir[i].offset, SEEK_SET) == 0
+           && fread(data, 1, size, f) == size);
+    dir[i].size = size;
+    dir[i].checksum = crc32c(0, data, size);
+    memcpy(head + HEADER_CHECKSUM, &checksum, sizeof checksum);
+    checksum = crc32c(0, head, len);
+    memcpy(head + HEADER_CHECKSUM, &checksum, sizeof checksum);
+    assert(fseek(f, 0, SEEK_SET) == 0 && fwrite(head, 1, len, f) == len);
+    assert(fflush(f) == 0);
+    free(head);
+    free(data);
+}
+
+/* Load 'gc' saved with its last table segment 'extra' bytes longer */
+static int
+load_oversized(const garble_circuit *gc, const garble_dag *dag, size_t extra)
+{
+    garble_container c;
+    garble_circuit gc2;
+    FILE *f = tmpfile();
+    size_t last = 0;
+    int res;
+
+    assert(garble_container_save(gc, dag, 0, fileno(f)) == GARBLE_OK);
+    assert(garble_container_open(&c, fileno(f)) == GARBLE_OK);
+    for (size_t i = 0; i < c.nsections; ++i)
+        if (c.sections[i].kind == GARBLE_SECTION_TABLE)
+            last = i;
+    forge_size(f, c.nsections, last, c.sections[last].size + extra);
+    garble_container_close(&c);
+    assert(garble_container_open(&c, fileno(f)) == GARBLE_OK);
+    if ((res = garble_container_load(&c, &gc2)) == GARBLE_OK)
+        garble_delete(&gc2);
+    garble_container_close(&c);
+    fclose(f);
+    return res;
+}
+
+/* Load the schedule of 'gc' saved with a forged 'dag' */
+static int
+load_forged_schedule(const garble_circuit *gc, const garble_dag *dag)
+{
+    garble_container c;
+    garble_dag dag2;
+    FILE *f = tmpfile();
+    int res;
+
+    assert(garble_container_save(gc, dag, 0, fileno(f)) == GARBLE_OK);
+    assert(garble_container_open(&c, fileno(f)) == GARBLE_OK);
+    if ((res = garble_container_load_schedule(&c, &dag2)) == GARBLE_OK)
+        garble_dag_delete(&dag2);
+    garble_container_close(&c);
+    fclose(f);
+    return res;
+}
+
+int
+main(void)
+{
+    garble_circuit gc, gc2;
+    garble_container c;
+    garble_dag dag, dag2;
+    pthread_t threads[NREADERS];
+    reader readers[NREADERS];
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+    size_t nsegments = 0;
+    FILE *f = tmpfile();
+
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    assert(garble_dag_new(&dag, &gc, 1024) == GARBLE_OK);
+    garble_garble(&gc, NULL, NULL);
+    garble_hash(&gc, hash);
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extractedLabels, gc.wires, inputs, gc.n);
+    garble_eval(&gc, extractedLabels, NULL, outputs);
+
+    assert(garble_container_save(&gc, &dag, 0, fileno(f)) == GARBLE_OK);
+    assert(garble_container_open(&c, fileno(f)) == GARBLE_OK);
+    assert(c.gc.q == gc.q && c.gc.nxors == gc.nxors);
+    for (size_t i = 0; i < c.nsections; ++i) {
+        assert(c.sections[i].offset % GARBLE_CONTAINER_ALIGN == 0);
+        nsegments += c.sections[i].kind == GARBLE_SECTION_TABLE;
+    }
+    assert(nsegments == dag.nchunks);
+
+    for (size_t t = 0; t < NREADERS; ++t) {
+        readers[t] = (reader) { &c, &gc, t, 0 };
+        assert(pthread_create(&threads[t], NULL, read_segments, &readers[t]) == 0);
+    }
+    for (size_t t = 0; t < NREADERS; ++t) {
+        assert(pthread_join(threads[t], NULL) == 0);
+        nsegments -= readers[t].segments;
+    }
+    assert(nsegments == 0);
+    printf("%lu sections, %lu table segments read by %d threads\n",
+           c.nsections, dag.nchunks, NREADERS);
+
+    assert(garble_container_load(&c, &gc2) == GARBLE_OK);
+    assert(garble_check(&gc2, hash) == GARBLE_OK);
+    assert(garble_container_load_schedule(&c, &dag2) == GARBLE_OK);
+    assert(dag2.nchunks == dag.nchunks);
+    assert(memcmp(dag2.succs, dag.succs,
+                  dag.succ_start[dag.nchunks] * sizeof(size_t)) == 0);
+    assert(garble_eval_parallel(&gc2, &dag2, extractedLabels, NULL, outputs2, 2)
+           == GARBLE_OK);
+    assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+    garble_delete(&gc2);
+    garble_dag_delete(&dag2);
+
+    /* Flip a byte in the middle of a table segment */
+    {
+        const garble_section *s = garble_container_find(&c, GARBLE_SECTION_TABLE,
+                                                        gc.q / 2);
+        block *buf = garble_allocate_blocks(s->size / sizeof(block) + 1);
+        unsigned char byte;
+
+        assert(fseek(f, s->offset + s->size / 2, SEEK_SET) == 0);
+        assert(fread(&byte, 1, 1, f) == 1);
+        byte ^= 1;
+        assert(fseek(f, s->offset + s->size / 2, SEEK_SET) == 0);
+        assert(fwrite(&byte, 1, 1, f) == 1);
+        assert(fflush(f) == 0);
+        assert(garble_container_read(&c, s, buf) == GARBLE_ERR);
+        assert(garble_container_load(&c, &gc2) == GARBLE_ERR);
+        free(buf);
+    }
+
+    garble_container_close(&c);
+    fclose(f);
+
+    /* A last segment longer than its rows, by a partial or a whole row */
+    assert(load_oversized(&gc, &dag, 0) == GARBLE_OK);
+    assert(load_oversized(&gc, &dag, 47) == GARBLE_ERR);
+    assert(load_oversized(&gc, &dag, garble_table_size(&gc)) == GARBLE_ERR);
+
+    /* A chunk row past the table, and a dependency that never retires */
+    dag.rows[dag.nchunks - 1] += (size_t) 1 << 40;
+    assert(load_forged_schedule(&gc, &dag) == GARBLE_ERR);
+    dag.rows[dag.nchunks - 1] -= (size_t) 1 << 40;
+    dag.ndeps[0]++;
+    assert(load_forged_schedule(&gc, &dag) == GARBLE_ERR);
+    dag.ndeps[0]--;
+    assert(load_forged_schedule(&gc, &dag) == GARBLE_OK);
+
+    garble_dag_delete(&dag);
+    garble_delete(&gc);
+    free(extractedLabels);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Scaling benchmark for the work-stealing garbler/evaluator on the AES
+ * circuit, from 1 to 'maxthreads' threads */
+
+static int
+run(garble_type_e type, size_t maxthreads, size_t chunk_size, int ntimes)
+{
+    garble_circuit gc;
+    garble_dag dag;
+    block seed;
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    block *inputLabels = garble_allocate_blocks(2 * AES_CIRCUIT_N);
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    block *outputMap = garble_allocate_blocks(2 * AES_CIRCUIT_M);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+    mytime_t *timeGarble = calloc(ntimes, sizeof(mytime_t));
+    mytime_t *timeEval = calloc(ntimes, sizeof(mytime_t));
+    double base_garble = 0.0, base_eval = 0.0;
+
+    build_aes_circuit(&gc, type);
+    if (garble_dag_new(&dag, &gc, chunk_size) == GARBLE_ERR) {
+        fprintf(stderr, "dag construction failed\n");
+        return 1;
+    }
+    printf("q=%lu chunks=%lu edges=%lu\n", gc.q, dag.nchunks,
+           dag.succ_start[dag.nchunks]);
+
+    /* Reference garbling and evaluation */
+    seed = garble_seed(NULL);
+    garble_garble(&gc, NULL, outputMap);
+    garble_hash(&gc, hash);
+    memcpy(inputLabels, gc.wires, 2 * gc.n * sizeof(block));
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extractedLabels, inputLabels, inputs, gc.n);
+    garble_eval(&gc, extractedLabels, NULL, outputs);
+
+    printf("threads  garble(ns/g)  eval(ns/g)  speedup\n");
+    for (size_t t = 1; t <= maxthreads; ++t) {
+        double garbleTime, evalTime;
+
+        (void) garble_seed(&seed);
+        garble_garble_parallel(&gc, &dag, NULL, NULL, t);
+        assert(garble_check(&gc, hash) == GARBLE_OK);
+        garble_eval_parallel(&gc, &dag, extractedLabels, NULL, outputs2, t);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+
+        for (int i = 0; i < ntimes; ++i) {
+            mytime_t start, end;
+
+            start = current_time_ns();
+            garble_garble_parallel(&gc, &dag, inputLabels, NULL, t);
+            end = current_time_ns();
+            timeGarble[i] = end - start;
+
+            start = current_time_ns();
+            garble_eval_parallel(&gc, &dag, extractedLabels, NULL, outputs2, t);
+            end = current_time_ns();
+            timeEval[i] = end - start;
+        }
+        garbleTime = (double) median(timeGarble, ntimes);
+        evalTime = (double) median(timeEval, ntimes);
+        if (t == 1) {
+            base_garble = garbleTime;
+            base_eval = evalTime;
+        }
+        printf("%7lu  %12.2f  %10.2f  %.2fx/%.2fx\n", t,
+               garbleTime / gc.q, evalTime / gc.q,
+               base_garble / garbleTime, base_eval / evalTime);
+    }
+
+    {
+        garble_numa_stats stats;
+        cpu_set_t before, after;
+
+        /* Placement only happens on fresh memory */
+        free(gc.table);
+        free(gc.wires);
+        gc.table = NULL;
+        gc.wires = NULL;
+        (void) garble_seed(&seed);
+        assert(sched_getaffinity(0, sizeof before, &before) == 0);
+        garble_garble_numa(&gc, &dag, NULL, NULL, maxthreads, &stats);
+        assert(garble_check(&gc, hash) == GARBLE_OK);
+        /* The calling thread, which ran as worker 0, is not left pinned */
+        assert(sched_getaffinity(0, sizeof after, &after) == 0);
+        assert(CPU_EQUAL(&before, &after));
+        printf("numa: nodes=%lu chunks local/remote=%lu/%lu "
+               "pages local/remote=%lu/%lu\n", stats.nnodes,
+               stats.local_chunks, stats.remote_chunks,
+               stats.local_pages, stats.remote_pages);
+    }
+
+    garble_dag_delete(&dag);
+    garble_delete(&gc);
+    free(inputLabels);
+    free(extractedLabels);
+    free(outputMap);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    free(timeGarble);
+    free(timeEval);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t chunk_size = 0;
+    int ntimes = 5;
+
+    if (argc > 1)
+        maxthreads = atoi(argv[1]);
+    if (argc > 2)
+        chunk_size = atoi(argv[2]);
+    if (argc > 3)
+        ntimes = atoi(argv[3]);
+    /* Always exercise real stealing, even on a single core */
+    if (maxthreads < 4)
+        maxthreads = 4;
+
+    printf("Type: Standard\n");
+    if (run(GARBLE_TYPE_STANDARD, maxthreads, chunk_size, ntimes))
+        return 1;
+    printf("Type: Half-gates\n");
+    if (run(GARBLE_TYPE_HALFGATES, maxthreads, chunk_size, ntimes))
+        return 1;
+    printf("Type: Privacy free\n");
+    if (run(GARBLE_TYPE_PRIVACY_FREE, maxthreads, chunk_size, ntimes))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "garble.h"
+#include "circuits.h"
+#include "circuit_optimize.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Reuse-distance histograms of the label accesses before and after
+ * builder_localize, on the builder's multiplier and AES circuits or on a
+ * Bristol Fashion netlist given on the command line, with the evaluation
+ * time of both orders */
+
+#define MUL_BITS 64
+
+static void
+build_mul_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[2 * MUL_BITS], outputs[2 * MUL_BITS];
+
+    garble_new(gc, 2 * MUL_BITS, 2 * MUL_BITS, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, 2 * MUL_BITS);
+    circuit_mul(gc, &ctxt, 2 * MUL_BITS, inputs, outputs);
+    builder_finish_building(gc, &ctxt, outputs);
+}
+
+/* A cache line holds four evaluator labels */
+#define WIRES_PER_LINE (64 / sizeof(block))
+
+static void
+histogram(const garble_circuit *gc, size_t hist[BUILDER_REUSE_BINS],
+          double *mean)
+{
+    size_t total = 0;
+    double sum = 0.0;
+
+    assert(builder_reuse_histogram(gc, WIRES_PER_LINE, hist) == GARBLE_OK);
+    for (size_t k = 0; k < BUILDER_REUSE_BINS; ++k) {
+        total += hist[k];
+        /* Bins stand for their lower bound */
+        sum += (double) hist[k] * (k ? (double) ((size_t) 1 << (k - 1)) : 0.0);
+    }
+    *mean = total ? sum / total : 0.0;
+}
+
+static mytime_t
+time_eval(garble_circuit *gc, const bool *inputs, bool *outputs, int ntimes)
+{
+    block *labels = garble_allocate_blocks(gc->n);
+    mytime_t *times = calloc(ntimes, sizeof(mytime_t)), res;
+
+    assert(garble_garble(gc, NULL, NULL) == GARBLE_OK);
+    garble_extract_labels(labels, gc->wires, inputs, gc->n);
+    for (int i = 0; i < ntimes; ++i) {
+        mytime_t start = current_time_ns();
+        assert(garble_eval(gc, labels, NULL, outputs) == GARBLE_OK);
+        times[i] = current_time_ns() - start;
+    }
+    res = median(times, ntimes);
+    free(labels);
+    free(times);
+    return res;
+}
+
+static int
+report(const char *name, garble_circuit *gc, int ntimes)
+{
+    garble_circuit loc;
+    size_t before[BUILDER_REUSE_BINS], after[BUILDER_REUSE_BINS], last = 0;
+    double meanBefore, meanAfter;
+    bool *inputs = calloc(gc->n, sizeof(bool));
+    bool *outputs = calloc(gc->m, sizeof(bool));
+    bool *outputs2 = calloc(gc->m, sizeof(bool));
+    mytime_t evalBefore, evalAfter;
+
+    /* Work on a copy of the topology */
+    loc = *gc;
+    loc.gates = malloc(gc->q * sizeof(garble_gate));
+    loc.outputs = malloc(gc->m * sizeof(int));
+    loc.mapping = NULL;
+    memcpy(loc.gates, gc->gates, gc->q * sizeof(garble_gate));
+    memcpy(loc.outputs, gc->outputs, gc->m * sizeof(int));
+    assert(builder_localize(&loc) == GARBLE_OK);
+    assert(loc.q == gc->q && loc.nxors == gc->nxors);
+    assert(loc.r == loc.n + 2 + loc.q);
+    for (size_t i = 0; i < loc.q; ++i) {
+        assert(loc.gates[i].output == loc.n + 2 + i);
+        assert(loc.gates[i].input0 < loc.gates[i].output);
+        assert(loc.gates[i].input1 < loc.gates[i].output);
+    }
+
+    histogram(gc, before, &meanBefore);
+    histogram(&loc, after, &meanAfter);
+    for (size_t k = 0; k < BUILDER_REUSE_BINS; ++k)
+        if (before[k] || after[k])
+            last = k;
+    printf("%s: %lu gates, reuse distance in %lu-label lines\n", name, gc->q,
+           (size_t) WIRES_PER_LINE);
+    printf("  %-14s %10s %10s\n", "distance", "before", "after");
+    for (size_t k = 0; k <= last; ++k) {
+        char range[32];
+        if (k == 0)
+            (void) snprintf(range, sizeof range, "0");
+        else
+            (void) snprintf(range, sizeof range, "[%lu, %lu)",
+                            (size_t) 1 << (k - 1), (size_t) 1 << k);
+        printf("  %-14s %10lu %10lu\n", range, before[k], after[k]);
+    }
+    printf("  %-14s %10.1f %10.1f\n", "mean", meanBefore, meanAfter);
+
+    for (size_t i = 0; i < gc->n; ++i)
+        inputs[i] = rand() % 2;
+    (void) garble_seed(NULL);
+    evalBefore = time_eval(gc, inputs, outputs, ntimes);
+    evalAfter = time_eval(&loc, inputs, outputs2, ntimes);
+    assert(memcmp(outputs, outputs2, gc->m * sizeof(bool)) == 0);
+    printf("  eval %.2f -> %.2f ns/gate\n", (double) evalBefore / gc->q,
+           (double) evalAfter / gc->q);
+
+    garble_delete(&loc);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    garble_circuit gc;
+    const int ntimes = 5;
+
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "r");
+        if (f == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+        if (garble_load_bristol(&gc, f, GARBLE_TYPE_HALFGATES) == GARBLE_ERR) {
+            fprintf(stderr, "%s: not a Bristol Fashion circuit\n", argv[1]);
+            fclose(f);
+            return 1;
+        }
+        fclose(f);
+        report(argv[1], &gc, ntimes);
+        garble_delete(&gc);
+        return 0;
+    }
+
+    build_mul_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    report("mul", &gc, ntimes);
+    garble_delete(&gc);
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    report("aes", &gc, ntimes);
+    garble_delete(&gc);
+    return 0;
+}
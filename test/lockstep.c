@@ -0,0 +1,190 @@
+#include "garble.h"
+#include "circuits.h"
+#include "circuit_builder.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Compare lockstep garbling of K AES instances against K sequential
+ * garblings, checking that every instance's table matches */
+
+static void
+reset_instances(garble_circuit *gcs, const garble_circuit *tmpl, size_t k)
+{
+    for (size_t j = 0; j < k; ++j) {
+        free(gcs[j].table);
+        free(gcs[j].wires);
+        free(gcs[j].output_perms);
+        gcs[j] = *tmpl;
+    }
+}
+
+static int
+run(garble_type_e type, int ntimes)
+{
+    garble_circuit tmpl;
+    garble_circuit gcs[GARBLE_LOCKSTEP_MAX];
+    unsigned char hashes[GARBLE_LOCKSTEP_MAX][SHA_DIGEST_LENGTH];
+    mytime_t *timeSeq = calloc(ntimes, sizeof(mytime_t));
+    mytime_t *timeLock = calloc(ntimes, sizeof(mytime_t));
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+
+    build_aes_circuit(&tmpl, type);
+    memset(gcs, '\0', sizeof gcs);
+    for (size_t i = 0; i < AES_CIRCUIT_N; ++i)
+        inputs[i] = rand() % 2;
+
+    printf("    k  sequential(ns/g)  lockstep(ns/g)  speedup\n");
+    for (size_t k = 1; k <= GARBLE_LOCKSTEP_MAX; k *= 2) {
+        garble_lockstep ls;
+        block seed;
+        double seqTime, lockTime;
+
+        /* Reference: k sequential garblings */
+        reset_instances(gcs, &tmpl, k);
+        seed = garble_seed(NULL);
+        for (size_t j = 0; j < k; ++j) {
+            garble_garble(&gcs[j], NULL, NULL);
+            garble_hash(&gcs[j], hashes[j]);
+        }
+        garble_extract_labels(extractedLabels, gcs[k - 1].wires, inputs,
+                              AES_CIRCUIT_N);
+        garble_eval(&gcs[k - 1], extractedLabels, NULL, outputs);
+
+        reset_instances(gcs, &tmpl, k);
+        (void) garble_seed(&seed);
+        assert(garble_lockstep_new(&ls, gcs, k) == GARBLE_OK);
+        assert(garble_lockstep_garble(&ls, NULL, NULL) == GARBLE_OK);
+        for (size_t j = 0; j < k; ++j)
+            assert(garble_check(&gcs[j], hashes[j]) == GARBLE_OK);
+        garble_extract_labels(extractedLabels, gcs[k - 1].wires, inputs,
+                              AES_CIRCUIT_N);
+        garble_eval(&gcs[k - 1], extractedLabels, NULL, outputs2);
+        assert(memcmp(outputs, outputs2, AES_CIRCUIT_M * sizeof(bool)) == 0);
+
+        for (int i = 0; i < ntimes; ++i) {
+            mytime_t start;
+
+            start = current_time_ns();
+            for (size_t j = 0; j < k; ++j)
+                garble_garble(&gcs[j], NULL, NULL);
+            timeSeq[i] = current_time_ns() - start;
+
+            start = current_time_ns();
+            garble_lockstep_garble(&ls, NULL, NULL);
+            timeLock[i] = current_time_ns() - start;
+        }
+        seqTime = (double) median(timeSeq, ntimes) / (tmpl.q * k);
+        lockTime = (double) median(timeLock, ntimes) / (tmpl.q * k);
+        printf("%5lu  %16.2f  %14.2f  %.2fx\n", k, seqTime, lockTime,
+               seqTime / lockTime);
+        garble_lockstep_delete(&ls);
+    }
+
+    reset_instances(gcs, &tmpl, GARBLE_LOCKSTEP_MAX);
+    garble_delete(&tmpl);
+    free(timeSeq);
+    free(timeLock);
+    free(extractedLabels);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
+
+#define LES_N 20
+
+/* OR gates, garbled by complementing an AND, match the sequential garbler
+ * and compute OR */
+static void
+check_or(garble_type_e type)
+{
+    garble_circuit tmpl, gcs[4];
+    garble_context ctxt;
+    garble_lockstep ls;
+    unsigned char hashes[4][SHA_DIGEST_LENGTH];
+    int wires[LES_N], output;
+    block *labels = garble_allocate_blocks(LES_N);
+    block seed;
+
+    garble_new(&tmpl, LES_N, 1, type);
+    builder_start_building(&tmpl, &ctxt);
+    builder_init_wires(wires, LES_N);
+    circuit_les(&tmpl, &ctxt, LES_N, wires, &output);
+    builder_finish_building(&tmpl, &ctxt, &output);
+
+    memset(gcs, '\0', sizeof gcs);
+    reset_instances(gcs, &tmpl, 4);
+    seed = garble_seed(NULL);
+    for (size_t j = 0; j < 4; ++j) {
+        garble_garble(&gcs[j], NULL, NULL);
+        garble_hash(&gcs[j], hashes[j]);
+    }
+    reset_instances(gcs, &tmpl, 4);
+    (void) garble_seed(&seed);
+    assert(garble_lockstep_new(&ls, gcs, 4) == GARBLE_OK);
+    assert(garble_lockstep_garble(&ls, NULL, NULL) == GARBLE_OK);
+    for (size_t j = 0; j < 4; ++j)
+        assert(garble_check(&gcs[j], hashes[j]) == GARBLE_OK);
+    for (int t = 0; t < 64; ++t) {
+        bool inputs[LES_N], out;
+        unsigned a = 0, b = 0;
+
+        for (int i = LES_N / 2; i-- > 0;) {
+            inputs[i] = rand() % 2;
+            inputs[LES_N / 2 + i] = rand() % 2;
+            a = (a << 1) | inputs[i];
+            b = (b << 1) | inputs[LES_N / 2 + i];
+        }
+        garble_extract_labels(labels, gcs[t % 4].wires, inputs, LES_N);
+        garble_eval(&gcs[t % 4], labels, NULL, &out);
+        assert(out == (b < a));
+    }
+    garble_lockstep_delete(&ls);
+    reset_instances(gcs, &tmpl, 4);
+
+    /* Same counts but different gates are refused */
+    {
+        garble_gate *gates = malloc(tmpl.q * sizeof(garble_gate));
+        memcpy(gates, tmpl.gates, tmpl.q * sizeof(garble_gate));
+        gates[tmpl.q - 1].type =
+            gates[tmpl.q - 1].type == GARBLE_GATE_AND ? GARBLE_GATE_XOR
+                                                      : GARBLE_GATE_AND;
+        gcs[1].gates = gates;
+        assert(garble_lockstep_new(&ls, gcs, 4) == GARBLE_ERR);
+        gcs[1].gates = tmpl.gates;
+        free(gates);
+    }
+    garble_delete(&tmpl);
+    free(labels);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ntimes = 5;
+
+    if (argc > 1)
+        ntimes = atoi(argv[1]);
+
+    check_or(GARBLE_TYPE_STANDARD);
+    check_or(GARBLE_TYPE_HALFGATES);
+    check_or(GARBLE_TYPE_PRIVACY_FREE);
+
+    printf("Type: Standard\n");
+    if (run(GARBLE_TYPE_STANDARD, ntimes))
+        return 1;
+    printf("Type: Half-gates\n");
+    if (run(GARBLE_TYPE_HALFGATES, ntimes))
+        return 1;
+    printf("Type: Privacy free\n");
+    if (run(GARBLE_TYPE_PRIVACY_FREE, ntimes))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,508 @@
+#include "garble.h"
+#include "circuits.h"
+#include "circuit_optimize.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Optimize builder circuits and check that they still compute the same
+ * function, reporting how many gates and table rows were saved */
+
+typedef void (*build_fn)(garble_circuit *gc, garble_type_e type);
+
+#define MUL_BITS 32
+
+static void
+build_mul_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[2 * MUL_BITS], outputs[2 * MUL_BITS];
+
+    garble_new(gc, 2 * MUL_BITS, 2 * MUL_BITS, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, 2 * MUL_BITS);
+    circuit_mul(gc, &ctxt, 2 * MUL_BITS, inputs, outputs);
+    builder_finish_building(gc, &ctxt, outputs);
+}
+
+/* Folding, merging and dead gates on a hand-written circuit */
+static void
+build_small_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int outputs[3];
+    int a, b, c, d, e, f, g;
+
+    garble_new(gc, 2, 3, type);
+    builder_start_building(gc, &ctxt);
+    a = builder_next_wire(&ctxt);
+    gate_XOR(gc, &ctxt, 0, wire_zero(gc), a);      /* a = x0 */
+    b = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, a, 1, b);                  /* b = x0 & x1 */
+    c = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, 1, 0, c);                  /* c = b */
+    d = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, b, wire_one(gc), d);       /* d = b */
+    e = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, 0, wire_zero(gc), e);      /* e = 0 */
+    f = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, 0, 1, f);                  /* dead */
+    g = builder_next_wire(&ctxt);
+    gate_NOT(gc, &ctxt, c, g);
+    (void) f;
+    outputs[0] = d;
+    outputs[1] = e;
+    outputs[2] = g;
+    builder_finish_building(gc, &ctxt, outputs);
+}
+
+static void
+eval_plain(garble_circuit *gc, const bool *inputs, bool *outputs)
+{
+    block *inputLabels = garble_allocate_blocks(2 * gc->n);
+    block *extractedLabels = garble_allocate_blocks(gc->n);
+
+    garble_create_input_labels(inputLabels, gc->n, NULL,
+                               gc->type == GARBLE_TYPE_PRIVACY_FREE);
+    assert(garble_garble(gc, inputLabels, NULL) == GARBLE_OK);
+    garble_extract_labels(extractedLabels, inputLabels, inputs, gc->n);
+    assert(garble_eval(gc, extractedLabels, NULL, outputs) == GARBLE_OK);
+    free(inputLabels);
+    free(extractedLabels);
+}
+
+/* Reference evaluation in the clear */
+static void
+eval_clear(const garble_circuit *gc, const bool *inputs, bool *outputs)
+{
+    bool *w = calloc(gc->r, sizeof(bool));
+
+    memcpy(w, inputs, gc->n * sizeof(bool));
+    w[gc->n + 1] = true;
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        const bool a = w[g->input0], b = w[g->input1];
+        switch (g->type) {
+        case GARBLE_GATE_ZERO: w[g->output] = false; break;
+        case GARBLE_GATE_ONE: w[g->output] = true; break;
+        case GARBLE_GATE_AND: w[g->output] = a && b; break;
+        case GARBLE_GATE_OR: w[g->output] = a || b; break;
+        case GARBLE_GATE_XOR: w[g->output] = a != b; break;
+        case GARBLE_GATE_XNOR: w[g->output] = a == b; break;
+        case GARBLE_GATE_NOT: w[g->output] = !a; break;
+        default: assert(0);
+        }
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        outputs[i] = w[gc->outputs[i]];
+    free(w);
+}
+
+static size_t
+rows(const garble_circuit *gc)
+{
+    return gc->q - gc->nxors;
+}
+
+static int
+run(const char *name, build_fn build, garble_type_e type, size_t ntrials)
+{
+    garble_circuit gc, opt;
+    mytime_t start, optTime;
+
+    build(&gc, type);
+    build(&opt, type);
+    start = current_time_ns();
+    assert(builder_optimize(&opt) == GARBLE_OK);
+    optTime = current_time_ns() - start;
+    assert(opt.n == gc.n && opt.m == gc.m && opt.q <= gc.q);
+    assert(opt.r == opt.n + 2 + opt.q);
+    for (size_t i = 0; i < opt.q; ++i)
+        assert(opt.gates[i].output == opt.n + 2 + i);
+
+    (void) garble_seed(NULL);
+    for (size_t t = 0; t < ntrials; ++t) {
+        bool *inputs = calloc(gc.n, sizeof(bool));
+        bool *outputs = calloc(gc.m, sizeof(bool));
+        bool *outputs2 = calloc(gc.m, sizeof(bool));
+
+        for (size_t i = 0; i < gc.n; ++i)
+            inputs[i] = rand() % 2;
+        eval_clear(&gc, inputs, outputs);
+        eval_plain(&gc, inputs, outputs2);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        eval_plain(&opt, inputs, outputs2);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        free(gc.table);
+        free(opt.table);
+        gc.table = opt.table = NULL;
+        free(inputs);
+        free(outputs);
+        free(outputs2);
+    }
+    printf("%-6s gates %7lu -> %7lu  rows %7lu -> %7lu  (%.2f ms)\n", name,
+           gc.q, opt.q, rows(&gc), rows(&opt), optTime / 1e6);
+    garble_delete(&gc);
+    garble_delete(&opt);
+    return 0;
+}
+
+/* NOT and XNOR gates take no table row and compute the right values */
+static void
+check_free_gates(garble_type_e type)
+{
+    garble_circuit gc;
+    garble_context ctxt;
+    int outputs[3];
+
+    garble_new(&gc, 2, 3, type);
+    builder_start_building(&gc, &ctxt);
+    outputs[0] = builder_next_wire(&ctxt);
+    gate_NOT(&gc, &ctxt, 0, outputs[0]);
+    outputs[1] = builder_next_wire(&ctxt);
+    gate_XNOR(&gc, &ctxt, 0, 1, outputs[1]);
+    outputs[2] = builder_next_wire(&ctxt);
+    gate_AND(&gc, &ctxt, outputs[0], outputs[1], outputs[2]);
+    builder_finish_building(&gc, &ctxt, outputs);
+    assert(gc.q == 3 && gc.nxors == 2);
+
+    (void) garble_seed(NULL);
+    for (int x = 0; x < 4; ++x) {
+        const bool inputs[2] = { x & 1, x >> 1 };
+        bool out[3];
+
+        eval_plain(&gc, inputs, out);
+        assert(out[0] == !inputs[0]);
+        assert(out[1] == (inputs[0] == inputs[1]));
+        assert(out[2] == (!inputs[0] && inputs[0] == inputs[1]));
+        free(gc.table);
+        gc.table = NULL;
+    }
+    garble_delete(&gc);
+}
+
+#define LES_BITS 10
+
+static void
+build_les_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[2 * LES_BITS], output;
+
+    garble_new(gc, 2 * LES_BITS, 1, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, 2 * LES_BITS);
+    circuit_les(gc, &ctxt, 2 * LES_BITS, inputs, &output);
+    builder_finish_building(gc, &ctxt, &output);
+}
+
+/* Majority of three as the OR of all pairs: five non-free gates for a
+ * function that needs one */
+static void
+build_maj_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int ab, ac, bc, t, output;
+
+    garble_new(gc, 3, 1, type);
+    builder_start_building(gc, &ctxt);
+    ab = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, 0, 1, ab);
+    ac = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, 0, 2, ac);
+    bc = builder_next_wire(&ctxt);
+    gate_AND(gc, &ctxt, 1, 2, bc);
+    t = builder_next_wire(&ctxt);
+    gate_OR(gc, &ctxt, ab, ac, t);
+    output = builder_next_wire(&ctxt);
+    gate_OR(gc, &ctxt, t, bc, output);
+    builder_finish_building(gc, &ctxt, &output);
+}
+
+#define EQU_BITS 16
+
+static void
+build_equ_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[2 * EQU_BITS], output;
+
+    garble_new(gc, 2 * EQU_BITS, 1, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, 2 * EQU_BITS);
+    circuit_equ(gc, &ctxt, 2 * EQU_BITS, inputs, &output);
+    builder_finish_building(gc, &ctxt, &output);
+}
+
+static int
+minimize(const char *name, build_fn build, garble_type_e type, size_t ntrials)
+{
+    garble_circuit gc, opt;
+    builder_and_stats stats;
+    mytime_t start, optTime;
+
+    build(&gc, type);
+    build(&opt, type);
+    start = current_time_ns();
+    assert(builder_minimize_ands(&opt, &stats) == GARBLE_OK);
+    optTime = current_time_ns() - start;
+    assert(stats.ands_before == rows(&gc) && stats.ands_after == rows(&opt));
+    assert(stats.ands_after <= stats.ands_before);
+    assert(stats.table_after == rows(&opt) * garble_table_size(&opt));
+    assert(opt.r == opt.n + 2 + opt.q);
+
+    (void) garble_seed(NULL);
+    for (size_t t = 0; t < ntrials; ++t) {
+        bool *inputs = calloc(gc.n, sizeof(bool));
+        bool *outputs = calloc(gc.m, sizeof(bool));
+        bool *outputs2 = calloc(gc.m, sizeof(bool));
+
+        for (size_t i = 0; i < gc.n; ++i)
+            inputs[i] = rand() % 2;
+        eval_clear(&gc, inputs, outputs);
+        eval_clear(&opt, inputs, outputs2);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        eval_plain(&opt, inputs, outputs2);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        free(opt.table);
+        opt.table = NULL;
+        free(inputs);
+        free(outputs);
+        free(outputs2);
+    }
+    printf("%-6s ANDs %7lu -> %7lu  table %9lu -> %9lu bytes  (%.2f ms)\n",
+           name, stats.ands_before, stats.ands_after, stats.table_before,
+           stats.table_after, optTime / 1e6);
+    garble_delete(&gc);
+    garble_delete(&opt);
+    return 0;
+}
+
+#define AND_BITS 64
+
+static void
+build_and_circuit(garble_circuit *gc, garble_type_e type)
+{
+    garble_context ctxt;
+    int inputs[AND_BITS], output;
+
+    garble_new(gc, AND_BITS, 1, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(inputs, AND_BITS);
+    circuit_and(gc, &ctxt, AND_BITS, inputs, &output);
+    builder_finish_building(gc, &ctxt, &output);
+}
+
+#define RANDOM_N 5
+#define RANDOM_M 3
+#define RANDOM_Q 24
+
+/* Random AND/OR/XOR/XNOR/NOT gates over every earlier wire, the fixed ones
+ * included; 'seed' picks the circuit */
+static void
+build_random_circuit(garble_circuit *gc, unsigned int seed)
+{
+    garble_context ctxt;
+    int outputs[RANDOM_M];
+
+    srand(seed);
+    garble_new(gc, RANDOM_N, RANDOM_M, GARBLE_TYPE_HALFGATES);
+    builder_start_building(gc, &ctxt);
+    for (size_t i = 0; i < RANDOM_Q; ++i) {
+        const int a = rand() % ctxt.wire_index, b = rand() % ctxt.wire_index;
+        const int out = builder_next_wire(&ctxt);
+
+        switch (rand() % 5) {
+        case 0: gate_AND(gc, &ctxt, a, b, out); break;
+        case 1: gate_OR(gc, &ctxt, a, b, out); break;
+        case 2: gate_XOR(gc, &ctxt, a, b, out); break;
+        case 3: gate_XNOR(gc, &ctxt, a, b, out); break;
+        default: gate_NOT(gc, &ctxt, a, out); break;
+        }
+    }
+    for (size_t i = 0; i < RANDOM_M; ++i)
+        outputs[i] = ctxt.wire_index - 1 - rand() % (RANDOM_Q / 2);
+    builder_finish_building(gc, &ctxt, outputs);
+}
+
+/* Longest path to an output, in gates */
+static size_t
+depth(const garble_circuit *gc)
+{
+    size_t *d = calloc(gc->r, sizeof(size_t)), max = 0;
+
+    for (size_t i = 0; i < gc->q; ++i) {
+        const garble_gate *g = &gc->gates[i];
+        d[g->output] = (d[g->input0] > d[g->input1]
+                        ? d[g->input0] : d[g->input1]) + 1;
+    }
+    for (size_t i = 0; i < gc->m; ++i)
+        if (d[gc->outputs[i]] > max)
+            max = d[gc->outputs[i]];
+    free(d);
+    return max;
+}
+
+/* Neither builder_optimize nor builder_balance lengthens the critical path of
+ * random circuits, whose complements have to be materialized */
+static void
+check_random_depths(unsigned int ntrials)
+{
+    for (unsigned int t = 0; t < ntrials; ++t) {
+        garble_circuit gc, opt, bal;
+        builder_depth_stats stats;
+
+        build_random_circuit(&gc, t);
+        build_random_circuit(&opt, t);
+        build_random_circuit(&bal, t);
+        assert(builder_optimize(&opt) == GARBLE_OK);
+        assert(builder_balance(&bal, &stats) == GARBLE_OK);
+        assert(depth(&opt) <= depth(&gc));
+        assert(stats.depth_before == depth(&gc));
+        assert(stats.depth_after == depth(&bal));
+        assert(stats.depth_after <= stats.depth_before);
+        assert(rows(&bal) <= rows(&gc));
+
+        for (unsigned int x = 0; x < 1 << RANDOM_N; ++x) {
+            bool inputs[RANDOM_N], outputs[RANDOM_M], outputs2[RANDOM_M];
+
+            for (size_t i = 0; i < RANDOM_N; ++i)
+                inputs[i] = (x >> i) & 1;
+            eval_clear(&gc, inputs, outputs);
+            eval_clear(&opt, inputs, outputs2);
+            assert(memcmp(outputs, outputs2, sizeof outputs) == 0);
+            eval_clear(&bal, inputs, outputs2);
+            assert(memcmp(outputs, outputs2, sizeof outputs) == 0);
+        }
+        garble_delete(&gc);
+        garble_delete(&opt);
+        garble_delete(&bal);
+    }
+}
+
+static int
+balance(const char *name, build_fn build, garble_type_e type, size_t ntrials)
+{
+    garble_circuit gc, opt, ref;
+    builder_depth_stats stats;
+    mytime_t start, optTime;
+
+    build(&gc, type);
+    build(&opt, type);
+    build(&ref, type);
+    start = current_time_ns();
+    assert(builder_balance(&opt, &stats) == GARBLE_OK);
+    optTime = current_time_ns() - start;
+    assert(builder_optimize(&ref) == GARBLE_OK);
+    assert(rows(&opt) <= rows(&ref) && opt.q <= ref.q);
+    assert(stats.depth_after <= stats.depth_before);
+    assert(stats.and_depth_after <= stats.and_depth_before);
+    assert(opt.r == opt.n + 2 + opt.q);
+
+    for (size_t t = 0; t < ntrials; ++t) {
+        bool *inputs = calloc(gc.n, sizeof(bool));
+        bool *outputs = calloc(gc.m, sizeof(bool));
+        bool *outputs2 = calloc(gc.m, sizeof(bool));
+
+        /* Mostly ones, so that AND chains are exercised */
+        for (size_t i = 0; i < gc.n; ++i)
+            inputs[i] = t == 0 || rand() % 8;
+        eval_clear(&gc, inputs, outputs);
+        eval_plain(&opt, inputs, outputs2);
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        free(opt.table);
+        opt.table = NULL;
+        free(inputs);
+        free(outputs);
+        free(outputs2);
+    }
+    printf("%-6s depth %5lu -> %5lu  AND depth %5lu -> %5lu  (%.2f ms)\n",
+           name, stats.depth_before, stats.depth_after,
+           stats.and_depth_before, stats.and_depth_after, optTime / 1e6);
+    garble_delete(&gc);
+    garble_delete(&opt);
+    garble_delete(&ref);
+    return 0;
+}
+
+int
+main(void)
+{
+    garble_circuit gc;
+
+    build_small_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    assert(builder_optimize(&gc) == GARBLE_OK);
+    /* Left: x0 & x1 and its complement; the zero output is the fixed wire */
+    assert(gc.q == 2 && gc.nxors == 1);
+    assert(gc.gates[0].type == GARBLE_GATE_AND);
+    assert(gc.gates[1].type == GARBLE_GATE_NOT);
+    assert(gc.outputs[0] == 4 && gc.outputs[1] == 2 && gc.outputs[2] == 5);
+    garble_delete(&gc);
+
+    check_free_gates(GARBLE_TYPE_STANDARD);
+    check_free_gates(GARBLE_TYPE_HALFGATES);
+    check_free_gates(GARBLE_TYPE_PRIVACY_FREE);
+
+    if (run("small", build_small_circuit, GARBLE_TYPE_STANDARD, 8))
+        return 1;
+    /* OR gates fold as OR and garble as OR */
+    if (run("maj", build_maj_circuit, GARBLE_TYPE_STANDARD, 8))
+        return 1;
+    if (run("equ", build_equ_circuit, GARBLE_TYPE_PRIVACY_FREE, 8))
+        return 1;
+    if (run("les", build_les_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (run("mul", build_mul_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (run("aes", build_aes_circuit, GARBLE_TYPE_HALFGATES, 4))
+        return 1;
+    if (run("aes", build_aes_circuit, GARBLE_TYPE_STANDARD, 4))
+        return 1;
+
+    build_maj_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    assert(builder_minimize_ands(&gc, NULL) == GARBLE_OK);
+    assert(rows(&gc) == 1);
+    garble_delete(&gc);
+
+    if (minimize("maj", build_maj_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (minimize("equ", build_equ_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (minimize("les", build_les_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (minimize("mul", build_mul_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (minimize("aes", build_aes_circuit, GARBLE_TYPE_PRIVACY_FREE, 4))
+        return 1;
+    if (minimize("aes", build_aes_circuit, GARBLE_TYPE_STANDARD, 4))
+        return 1;
+
+    {
+        builder_depth_stats stats;
+
+        /* 64 operands make a tree of depth 6 with the same 63 gates */
+        build_and_circuit(&gc, GARBLE_TYPE_HALFGATES);
+        assert(builder_balance(&gc, &stats) == GARBLE_OK);
+        assert(rows(&gc) == AND_BITS - 1);
+        assert(stats.depth_before == AND_BITS - 1);
+        assert(stats.depth_after == 6 && stats.and_depth_after == 6);
+        garble_delete(&gc);
+    }
+
+    check_random_depths(6000);
+
+    if (balance("and", build_and_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (balance("equ", build_equ_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (balance("les", build_les_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (balance("mul", build_mul_circuit, GARBLE_TYPE_HALFGATES, 8))
+        return 1;
+    if (balance("aes", build_aes_circuit, GARBLE_TYPE_HALFGATES, 4))
+        return 1;
+    return 0;
+}
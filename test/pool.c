@@ -0,0 +1,130 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Online latency of evaluating the AES circuit with instances taken from a
+ * pre-garbled pool, compared to garbling on the request path */
+
+static int
+cmp_time(const void *a, const void *b)
+{
+    const mytime_t x = *(const mytime_t *) a, y = *(const mytime_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+report(const char *name, mytime_t *times, size_t n)
+{
+    qsort(times, n, sizeof(mytime_t), cmp_time);
+    printf("%-8s p50=%8.1f us  p99=%8.1f us  max=%8.1f us\n", name,
+           times[n / 2] / 1e3, times[n * 99 / 100] / 1e3, times[n - 1] / 1e3);
+}
+
+/* A pool whose refill threads all fail to garble makes a waiting take fail
+ * rather than block forever */
+static void
+check_failing_pool(void)
+{
+    garble_circuit gc;
+    garble_pool *pool;
+    garble_pool_instance inst;
+
+    memset(&gc, '\0', sizeof gc);
+    gc.n = 1;
+    gc.m = 1;
+    gc.r = SIZE_MAX / 64;       /* no room for the wire labels */
+    gc.type = GARBLE_TYPE_HALFGATES;
+    assert((pool = garble_pool_new(&gc, 4, 2)) != NULL);
+    assert(garble_pool_take(pool, &inst, true) == GARBLE_ERR);
+    assert(garble_pool_ready(pool) == 0);
+    garble_pool_delete(pool);
+}
+
+int
+main(int argc, char *argv[])
+{
+    garble_circuit tmpl, gc;
+    garble_pool *pool;
+    size_t nrequests = 200, capacity = 16;
+    useconds_t gap = 1000;
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    block *outputMap = garble_allocate_blocks(2 * AES_CIRCUIT_M);
+    block *computedOutputMap = garble_allocate_blocks(AES_CIRCUIT_M);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+    mytime_t *timeInline, *timePool;
+
+    if (argc > 1)
+        nrequests = atoi(argv[1]);
+    if (argc > 2)
+        capacity = atoi(argv[2]);
+    if (argc > 3)
+        gap = atoi(argv[3]);
+    timeInline = calloc(nrequests, sizeof(mytime_t));
+    timePool = calloc(nrequests, sizeof(mytime_t));
+
+    build_aes_circuit(&tmpl, GARBLE_TYPE_HALFGATES);
+    (void) garble_seed(NULL);
+    check_failing_pool();
+
+    /* Garbling on the request path */
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    for (size_t r = 0; r < nrequests; ++r) {
+        mytime_t start = current_time_ns();
+        garble_garble(&gc, NULL, outputMap);
+        for (size_t i = 0; i < gc.n; ++i)
+            inputs[i] = rand() % 2;
+        garble_extract_labels(extractedLabels, gc.wires, inputs, gc.n);
+        garble_eval(&gc, extractedLabels, computedOutputMap, outputs);
+        timeInline[r] = current_time_ns() - start;
+        (void) usleep(gap);
+    }
+    garble_delete(&gc);
+
+    /* Pre-garbled instances; the gap between requests is the idle time the
+     * refill thread uses */
+    pool = garble_pool_new(&tmpl, capacity, 1);
+    assert(pool);
+    while (garble_pool_ready(pool) < capacity)
+        (void) usleep(1000);
+    for (size_t r = 0; r < nrequests; ++r) {
+        garble_pool_instance inst;
+        mytime_t start = current_time_ns();
+
+        assert(garble_pool_take(pool, &inst, true) == GARBLE_OK);
+        for (size_t i = 0; i < inst.gc.n; ++i)
+            inputs[i] = rand() % 2;
+        garble_extract_labels(extractedLabels, inst.gc.wires, inputs, inst.gc.n);
+        garble_eval(&inst.gc, extractedLabels, computedOutputMap, outputs);
+        timePool[r] = current_time_ns() - start;
+
+        assert(garble_map_outputs(inst.output_map, computedOutputMap, outputs2,
+                                  inst.gc.m) == GARBLE_OK);
+        assert(memcmp(outputs, outputs2, inst.gc.m * sizeof(bool)) == 0);
+        garble_pool_recycle(pool, &inst);
+        (void) usleep(gap);
+    }
+    garble_pool_delete(pool);
+
+    printf("requests=%lu capacity=%lu gap=%u us\n", nrequests, capacity, gap);
+    report("inline", timeInline, nrequests);
+    report("pool", timePool, nrequests);
+
+    garble_delete(&tmpl);
+    free(extractedLabels);
+    free(outputMap);
+    free(computedOutputMap);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    free(timeInline);
+    free(timePool);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Round-trip the AES circuit through an SCD v2 file, check that corrupted
+ * files are rejected, and time saving and loading */
+
+#define SCD_FILE "./aes.scd"
+
+/* Overwrite 'len' bytes at 'offset' of 'fname' */
+static void
+patch(const char *fname, long offset, const void *buf, size_t len)
+{
+    FILE *f = fopen(fname, "r+b");
+    assert(f);
+    assert(fseek(f, offset, SEEK_SET) == 0);
+    assert(fwrite(buf, 1, len, f) == len);
+    fclose(f);
+}
+
+int
+main(void)
+{
+    garble_circuit gc, gc2;
+    const long header = 8 + 4 * sizeof(uint64_t);
+    const uint8_t badType = GARBLE_GATE_XNOR + 1;
+    const uint32_t badWire = UINT32_MAX;
+    mytime_t start, saveTime, loadTime;
+    FILE *f;
+    long size;
+
+    build_aes_circuit(&gc, GARBLE_TYPE_HALFGATES);
+    garble_garble(&gc, NULL, NULL);
+    start = current_time_ns();
+    assert(garble_circuit_to_file(&gc, SCD_FILE) == GARBLE_OK);
+    saveTime = current_time_ns() - start;
+
+    f = fopen(SCD_FILE, "rb");
+    assert(f && fseek(f, 0, SEEK_END) == 0);
+    size = ftell(f);
+    fclose(f);
+
+    start = current_time_ns();
+    assert(garble_circuit_from_file(&gc2, SCD_FILE) == GARBLE_OK);
+    loadTime = current_time_ns() - start;
+    printf("AES: %lu gates, %ld bytes, saved in %.2f ns/g, loaded in %.2f ns/g\n",
+           gc2.q, size, (double) saveTime / gc2.q, (double) loadTime / gc2.q);
+
+    assert(gc2.n == gc.n && gc2.m == gc.m && gc2.q == gc.q && gc2.r == gc.r
+           && gc2.nxors == gc.nxors && gc2.type == gc.type);
+    for (size_t i = 0; i < gc.q; ++i) {
+        assert(gc2.gates[i].type == gc.gates[i].type);
+        assert(gc2.gates[i].input0 == gc.gates[i].input0);
+        assert(gc2.gates[i].input1 == gc.gates[i].input1);
+        assert(gc2.gates[i].output == gc.gates[i].output);
+    }
+    assert(memcmp(gc2.outputs, gc.outputs, gc.m * sizeof(int)) == 0);
+    assert(memcmp(gc2.output_perms, gc.output_perms, gc.m * sizeof(bool)) == 0);
+    garble_delete(&gc2);
+
+    /* An unknown gate type */
+    patch(SCD_FILE, header + (3 * gc.q + gc.m) * sizeof(uint32_t) + 3, &badType,
+          sizeof badType);
+    assert(garble_circuit_from_file(&gc2, SCD_FILE) == GARBLE_ERR);
+
+    /* An output wire beyond every gate's output */
+    assert(garble_circuit_to_file(&gc, SCD_FILE) == GARBLE_OK);
+    patch(SCD_FILE, header + 3 * gc.q * sizeof(uint32_t), &badWire,
+          sizeof badWire);
+    assert(garble_circuit_from_file(&gc2, SCD_FILE) == GARBLE_ERR);
+
+    (void) remove(SCD_FILE);
+    garble_delete(&gc);
+    return 0;
+}
@@ -0,0 +1,505 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Reference event-loop server: a server thread garbles the AES circuit for
+ * many concurrent sessions and a client thread evaluates, both over
+ * non-blocking local sockets.  Each side runs one epoll loop and interleaves
+ * bounded garble_task slices of every busy session with its socket I/O.
+ *
+ * Per round, the client sends a one-byte request, the server garbles a fresh
+ * circuit and replies with the table, the input labels (chosen locally, as a
+ * stand-in for oblivious transfer), the fixed label, the global key and the
+ * output permutation bits, and the client evaluates.  The client reports
+ * rounds per second and request-to-result latency percentiles. */
+
+#define MAX_EVENTS 64
+
+typedef struct session session;
+
+/* Intrusive FIFO of sessions with a task in progress */
+typedef struct {
+    session *head, *tail;
+    size_t len;
+} run_queue;
+
+typedef enum {
+    S_WAIT_REQUEST,
+    S_GARBLE,
+    S_SEND,
+    C_SEND_REQUEST,
+    C_RECEIVE,
+    C_EVAL,
+    DONE,
+} session_state;
+
+struct session {
+    int fd;
+    bool garbler;
+    session_state state;
+    garble_circuit gc;
+    garble_task task;
+    /* Reply being sent or received */
+    struct iovec iov[3];
+    size_t niov;
+    size_t rounds;
+    mytime_t start;
+    session *next;
+};
+
+typedef struct {
+    const garble_circuit *tmpl;
+    size_t nsessions, nrounds, slice;
+    int *fds;
+    /* client only */
+    mytime_t *latencies;
+    size_t nlatencies;
+} loop_args;
+
+static void
+enqueue(run_queue *q, session *s)
+{
+    s->next = NULL;
+    if (q->tail)
+        q->tail->next = s;
+    else
+        q->head = s;
+    q->tail = s;
+    q->len++;
+}
+
+static session *
+dequeue(run_queue *q)
+{
+    session *s = q->head;
+    q->head = s->next;
+    if (q->head == NULL)
+        q->tail = NULL;
+    q->len--;
+    return s;
+}
+
+/* Size of the server's reply */
+static size_t
+reply_size(const garble_circuit *gc)
+{
+    return (gc->q - gc->nxors) * garble_table_size(gc)
+        + (gc->n + 2) * sizeof(block) + gc->m * sizeof(bool);
+}
+
+static void
+watch(int ep, session *s, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = s;
+    if (epoll_ctl(ep, EPOLL_CTL_MOD, s->fd, &ev) == -1)
+        abort();
+}
+
+/* Transfer as much of 's->iov' as the socket accepts; returns 1 when done, 0
+ * when it would block, -1 on error or end of stream */
+static int
+transfer(session *s, bool sending)
+{
+    while (s->niov > 0) {
+        ssize_t res = sending
+            ? writev(s->fd, s->iov, s->niov)
+            : readv(s->fd, s->iov, s->niov);
+        if (res == -1)
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        if (res == 0)
+            return -1;
+        while (res > 0) {
+            size_t n = (size_t) res < s->iov[0].iov_len
+                ? (size_t) res : s->iov[0].iov_len;
+            s->iov[0].iov_base = (char *) s->iov[0].iov_base + n;
+            s->iov[0].iov_len -= n;
+            res -= n;
+            if (s->iov[0].iov_len == 0) {
+                memmove(&s->iov[0], &s->iov[1], --s->niov * sizeof(struct iovec));
+                if (s->niov == 0)
+                    break;
+            }
+        }
+    }
+    return 1;
+}
+
+static void
+session_delete(session *s)
+{
+    garble_task_delete(&s->task);
+    free(s->gc.table);
+    free(s->gc.wires);
+    /* The client's permutation bits point into its reply buffer */
+    if (s->garbler)
+        free(s->gc.output_perms);
+    if (s->fd != -1)
+        (void) close(s->fd);
+    s->fd = -1;
+    s->state = DONE;
+}
+
+/* Server side */
+
+static block *
+server_labels(const garble_circuit *gc)
+{
+    /* The garbler keeps one buffer per session for the extracted labels,
+     * followed by the fixed label and the global key */
+    return (block *) ((char *) gc->wires + 2 * gc->r * sizeof(block));
+}
+
+static void
+server_send(int ep, session *s)
+{
+    switch (transfer(s, true)) {
+    case 1:
+        s->state = S_WAIT_REQUEST;
+        watch(ep, s, EPOLLIN);
+        break;
+    case 0:
+        watch(ep, s, EPOLLOUT);
+        break;
+    default:
+        session_delete(s);
+    }
+}
+
+static void
+server_garbled(int ep, session *s)
+{
+    garble_circuit *gc = &s->gc;
+    block *labels = server_labels(gc);
+    bool *inputs = calloc(gc->n, sizeof(bool));
+
+    assert(garble_task_finish(&s->task, NULL, NULL) == GARBLE_OK);
+    for (size_t i = 0; i < gc->n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(labels, gc->wires, inputs, gc->n);
+    labels[gc->n] = gc->fixed_label;
+    labels[gc->n + 1] = gc->global_key;
+    free(inputs);
+
+    s->iov[0].iov_base = gc->table;
+    s->iov[0].iov_len = (gc->q - gc->nxors) * garble_table_size(gc);
+    s->iov[1].iov_base = labels;
+    s->iov[1].iov_len = (gc->n + 2) * sizeof(block);
+    s->iov[2].iov_base = gc->output_perms;
+    s->iov[2].iov_len = gc->m * sizeof(bool);
+    s->niov = 3;
+    s->state = S_SEND;
+    server_send(ep, s);
+}
+
+static void
+server_io(int ep, session *s, run_queue *q)
+{
+    char req;
+
+    if (s->state == S_SEND) {
+        server_send(ep, s);
+        return;
+    }
+    switch (read(s->fd, &req, 1)) {
+    case 1:
+        assert(garble_task_garble(&s->task, &s->gc, NULL) == GARBLE_OK);
+        s->state = S_GARBLE;
+        watch(ep, s, 0);
+        enqueue(q, s);
+        break;
+    case -1:
+        if (errno == EAGAIN || errno == EINTR)
+            break;
+        /* fall through */
+    default:
+        session_delete(s);
+    }
+}
+
+/* Client side */
+
+static void
+client_request(int ep, session *s)
+{
+    const char req = 1;
+    ssize_t res;
+
+    s->start = current_time_ns();
+    res = write(s->fd, &req, 1);
+    if (res == 1) {
+        const garble_circuit *gc = &s->gc;
+        char *buf = (char *) gc->table;
+        s->iov[0].iov_base = buf;
+        s->iov[0].iov_len = reply_size(gc);
+        s->niov = 1;
+        s->state = C_RECEIVE;
+        watch(ep, s, EPOLLIN);
+    } else if (res == -1 && (errno == EAGAIN || errno == EINTR)) {
+        s->state = C_SEND_REQUEST;
+        watch(ep, s, EPOLLOUT);
+    } else {
+        session_delete(s);
+    }
+}
+
+static void
+client_io(int ep, session *s, run_queue *q)
+{
+    garble_circuit *gc = &s->gc;
+    block *labels;
+    int res;
+
+    if (s->state == C_SEND_REQUEST) {
+        client_request(ep, s);
+        return;
+    }
+    if ((res = transfer(s, false)) == 0)
+        return;
+    if (res == -1) {
+        session_delete(s);
+        return;
+    }
+    /* The reply was read straight into the table; the labels, fixed label and
+     * key follow it */
+    labels = (block *) ((char *) gc->table
+                        + (gc->q - gc->nxors) * garble_table_size(gc));
+    gc->fixed_label = labels[gc->n];
+    gc->global_key = labels[gc->n + 1];
+    gc->output_perms = (bool *) (labels + gc->n + 2);
+    assert(garble_task_eval(&s->task, gc, labels) == GARBLE_OK);
+    s->state = C_EVAL;
+    watch(ep, s, 0);
+    enqueue(q, s);
+}
+
+static int
+cmp_time(const void *a, const void *b)
+{
+    const mytime_t x = *(const mytime_t *) a, y = *(const mytime_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Run one slice of every queued task, in order; returns the number of
+ * sessions that ended */
+static size_t
+run_slices(int ep, run_queue *q, loop_args *args)
+{
+    size_t finished = 0;
+
+    for (size_t n = q->len; n > 0; --n) {
+        session *s = dequeue(q);
+        assert(garble_task_step(&s->task, args->slice) == GARBLE_OK);
+        if (!garble_task_done(&s->task)) {
+            enqueue(q, s);
+            continue;
+        }
+        if (s->state == S_GARBLE) {
+            server_garbled(ep, s);
+            finished += s->state == DONE ? 1 : 0;
+            continue;
+        }
+        /* Client finished evaluating */
+        {
+            bool *outputs = calloc(s->gc.m, sizeof(bool));
+            assert(garble_task_finish(&s->task, NULL, outputs) == GARBLE_OK);
+            free(outputs);
+        }
+        args->latencies[args->nlatencies++] = current_time_ns() - s->start;
+        if (++s->rounds < args->nrounds) {
+            client_request(ep, s);
+            finished += s->state == DONE ? 1 : 0;
+        } else {
+            ++finished;
+            session_delete(s);
+        }
+    }
+    return finished;
+}
+
+static void *
+event_loop(loop_args *args, bool server)
+{
+    const garble_circuit *tmpl = args->tmpl;
+    session *sessions = calloc(args->nsessions, sizeof(session));
+    struct epoll_event events[MAX_EVENTS];
+    run_queue q = { NULL, NULL, 0 };
+    size_t live = args->nsessions;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+
+    assert(ep != -1);
+    for (size_t i = 0; i < args->nsessions; ++i) {
+        session *s = &sessions[i];
+        struct epoll_event ev;
+
+        s->fd = args->fds[i];
+        s->garbler = server;
+        s->gc = *tmpl;
+        if (server) {
+            /* Room for the wires plus the extracted labels, fixed label and
+             * key sent to the client */
+            s->gc.wires = garble_allocate_blocks(2 * tmpl->r + tmpl->n + 2);
+            s->state = S_WAIT_REQUEST;
+        } else {
+            s->gc.table = garble_allocate_blocks(
+                (reply_size(tmpl) + sizeof(block) - 1) / sizeof(block));
+            s->state = C_SEND_REQUEST;
+        }
+        ev.events = server ? EPOLLIN : EPOLLOUT;
+        ev.data.ptr = s;
+        assert(epoll_ctl(ep, EPOLL_CTL_ADD, s->fd, &ev) == 0);
+    }
+
+    while (live > 0) {
+        const int n = epoll_wait(ep, events, MAX_EVENTS, q.len ? 0 : 100);
+        for (int i = 0; i < n; ++i) {
+            session *s = events[i].data.ptr;
+            /* Sessions with a task in the run queue are not watched */
+            if (s->state == DONE || s->state == S_GARBLE || s->state == C_EVAL)
+                continue;
+            if (server)
+                server_io(ep, s, &q);
+            else
+                client_io(ep, s, &q);
+            if (s->state == DONE)
+                --live;
+        }
+        live -= run_slices(ep, &q, args);
+    }
+
+    (void) close(ep);
+    free(sessions);
+    return NULL;
+}
+
+static void *
+server_main(void *arg)
+{
+    return event_loop(arg, true);
+}
+
+/* Check that slicing a task produces the same table and outputs as the
+ * monolithic calls */
+static void
+check_slices(const garble_circuit *tmpl, size_t slice)
+{
+    garble_circuit gc = *tmpl, gc2 = *tmpl;
+    garble_task task;
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    block *extracted = garble_allocate_blocks(tmpl->n);
+    bool *inputs = calloc(tmpl->n, sizeof(bool));
+    bool *outputs = calloc(tmpl->m, sizeof(bool));
+    bool *outputs2 = calloc(tmpl->m, sizeof(bool));
+    block seed;
+
+    gc.table = gc.wires = gc2.table = gc2.wires = NULL;
+    gc.output_perms = gc2.output_perms = NULL;
+    seed = garble_seed(NULL);
+    garble_garble(&gc, NULL, NULL);
+    garble_hash(&gc, hash);
+    (void) garble_seed(&seed);
+    assert(garble_task_garble(&task, &gc2, NULL) == GARBLE_OK);
+    while (!garble_task_done(&task))
+        assert(garble_task_step(&task, slice) == GARBLE_OK);
+    assert(garble_task_finish(&task, NULL, NULL) == GARBLE_OK);
+    assert(garble_check(&gc2, hash) == GARBLE_OK);
+
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extracted, gc.wires, inputs, gc.n);
+    garble_eval(&gc, extracted, NULL, outputs);
+    assert(garble_task_eval(&task, &gc, extracted) == GARBLE_OK);
+    while (!garble_task_done(&task))
+        assert(garble_task_step(&task, slice) == GARBLE_OK);
+    assert(garble_task_finish(&task, NULL, outputs2) == GARBLE_OK);
+    assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+
+    free(gc.table);
+    free(gc.wires);
+    free(gc.output_perms);
+    free(gc2.table);
+    free(gc2.wires);
+    free(gc2.output_perms);
+    free(extracted);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    garble_circuit tmpl;
+    loop_args server, client;
+    pthread_t thread;
+    size_t nsessions = 256, nrounds = 4, slice = 4096, total;
+    int *fds;
+    mytime_t start, elapsed;
+
+    if (argc > 1)
+        nsessions = atoi(argv[1]);
+    if (argc > 2)
+        nrounds = atoi(argv[2]);
+    if (argc > 3)
+        slice = atoi(argv[3]);
+
+    build_aes_circuit(&tmpl, GARBLE_TYPE_HALFGATES);
+    check_slices(&tmpl, slice);
+
+    fds = calloc(2 * nsessions, sizeof(int));
+    for (size_t i = 0; i < nsessions; ++i) {
+        int sv[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0, sv) == 0);
+        fds[i] = sv[0];
+        fds[nsessions + i] = sv[1];
+    }
+    memset(&server, '\0', sizeof server);
+    server.tmpl = &tmpl;
+    server.nsessions = nsessions;
+    server.nrounds = nrounds;
+    server.slice = slice;
+    server.fds = fds;
+    client = server;
+    client.fds = fds + nsessions;
+    client.latencies = calloc(nsessions * nrounds, sizeof(mytime_t));
+
+    start = current_time_ns();
+    assert(pthread_create(&thread, NULL, server_main, &server) == 0);
+    (void) event_loop(&client, false);
+    (void) pthread_join(thread, NULL);
+    elapsed = current_time_ns() - start;
+
+    total = client.nlatencies;
+    assert(total == nsessions * nrounds);
+    qsort(client.latencies, total, sizeof(mytime_t), cmp_time);
+    printf("sessions=%lu rounds=%lu slice=%lu gates=%lu\n", nsessions, nrounds,
+           slice, tmpl.q);
+    printf("throughput: %.0f rounds/s (%.2f ns/gate garble+eval)\n",
+           total / ((double) elapsed / 1000000000.0),
+           (double) elapsed / (total * tmpl.q));
+    printf("latency (ms): p50=%.2f p90=%.2f p99=%.2f p99.9=%.2f max=%.2f\n",
+           client.latencies[total / 2] / 1e6,
+           client.latencies[total * 9 / 10] / 1e6,
+           client.latencies[total * 99 / 100] / 1e6,
+           client.latencies[total * 999 / 1000] / 1e6,
+           client.latencies[total - 1] / 1e6);
+
+    garble_delete(&tmpl);
+    free(fds);
+    free(client.latencies);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Garble and evaluate the AES circuit with forked shard workers on a single
+ * host, checking the stitched table and the outputs against the sequential
+ * garbler/evaluator */
+
+static int
+run(garble_type_e type, size_t maxshards)
+{
+    garble_circuit gc;
+    block seed;
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    block *inputLabels = garble_allocate_blocks(2 * AES_CIRCUIT_N);
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    block *outputMap = garble_allocate_blocks(2 * AES_CIRCUIT_M);
+    block *outputMap2 = garble_allocate_blocks(2 * AES_CIRCUIT_M);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+
+    build_aes_circuit(&gc, type);
+    seed = garble_seed(NULL);
+    garble_garble(&gc, NULL, outputMap);
+    garble_hash(&gc, hash);
+    memcpy(inputLabels, gc.wires, 2 * gc.n * sizeof(block));
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extractedLabels, inputLabels, inputs, gc.n);
+    garble_eval(&gc, extractedLabels, NULL, outputs);
+
+    printf("shards  garble(ns/g)  eval(ns/g)\n");
+    for (size_t k = 1; k <= maxshards; ++k) {
+        mytime_t start, garbleTime, evalTime;
+
+        (void) garble_seed(&seed);
+        start = current_time_ns();
+        if (garble_garble_sharded(&gc, NULL, outputMap2, k) == GARBLE_ERR) {
+            fprintf(stderr, "sharded garbling failed\n");
+            return 1;
+        }
+        garbleTime = current_time_ns() - start;
+        assert(garble_check(&gc, hash) == GARBLE_OK);
+        assert(memcmp(outputMap, outputMap2,
+                      2 * gc.m * sizeof(block)) == 0);
+
+        memset(outputs2, '\0', gc.m * sizeof(bool));
+        start = current_time_ns();
+        if (garble_eval_sharded(&gc, extractedLabels, NULL, outputs2, k)
+            == GARBLE_ERR) {
+            fprintf(stderr, "sharded evaluation failed\n");
+            return 1;
+        }
+        evalTime = current_time_ns() - start;
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        printf("%6lu  %12.2f  %10.2f\n", k, (double) garbleTime / gc.q,
+               (double) evalTime / gc.q);
+    }
+
+    garble_delete(&gc);
+    free(inputLabels);
+    free(extractedLabels);
+    free(outputMap);
+    free(outputMap2);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t maxshards = 4;
+
+    if (argc > 1)
+        maxshards = atoi(argv[1]);
+
+    printf("Type: Standard\n");
+    if (run(GARBLE_TYPE_STANDARD, maxshards))
+        return 1;
+    printf("Type: Half-gates\n");
+    if (run(GARBLE_TYPE_HALFGATES, maxshards))
+        return 1;
+    printf("Type: Privacy free\n");
+    if (run(GARBLE_TYPE_PRIVACY_FREE, maxshards))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "garble.h"
+#include "circuits.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+/* Stream the garbled AES circuit to a callback and to a file, checking the
+ * streamed table against garble_garble and reporting resident memory, then
+ * evaluate it back from the streamed table */
+
+typedef struct {
+    SHA_CTX sha;
+    size_t nbytes, max_chunk;
+} sink;
+
+static int
+hash_chunk(void *arg, const void *buf, size_t len)
+{
+    sink *s = arg;
+    (void) SHA1_Update(&s->sha, buf, len);
+    s->nbytes += len;
+    if (len > s->max_chunk)
+        s->max_chunk = len;
+    return GARBLE_OK;
+}
+
+typedef struct {
+    const char *buf;
+    size_t len, pos;
+} source;
+
+/* Hand out the table in short pieces, so rows arrive split across reads */
+static ssize_t
+read_piece(void *arg, void *buf, size_t len)
+{
+    source *s = arg;
+    size_t n = 1 + rand() % 97;
+
+    if (n > len)
+        n = len;
+    if (n > s->len - s->pos)
+        n = s->len - s->pos;
+    memcpy(buf, s->buf + s->pos, n);
+    s->pos += n;
+    return n;
+}
+
+static int
+run(garble_type_e type, size_t chunk_rows)
+{
+    garble_circuit gc, gc2;
+    garble_stream stream;
+    block seed;
+    sink s;
+    unsigned char hash[SHA_DIGEST_LENGTH], hash2[SHA_DIGEST_LENGTH];
+    block *outputMap = garble_allocate_blocks(2 * AES_CIRCUIT_M);
+    block *outputMap2 = garble_allocate_blocks(2 * AES_CIRCUIT_M);
+    block *extractedLabels = garble_allocate_blocks(AES_CIRCUIT_N);
+    bool *inputs = calloc(AES_CIRCUIT_N, sizeof(bool));
+    bool *outputs = calloc(AES_CIRCUIT_M, sizeof(bool));
+    bool *outputs2 = calloc(AES_CIRCUIT_M, sizeof(bool));
+    mytime_t start, garbleTime, streamTime, evalTime, streamEvalTime;
+    size_t tableSize;
+
+    build_aes_circuit(&gc, type);
+    build_aes_circuit(&gc2, type);
+    assert(garble_stream_new(&stream, &gc2, chunk_rows) == GARBLE_OK);
+
+    seed = garble_seed(NULL);
+    start = current_time_ns();
+    garble_garble(&gc, NULL, outputMap);
+    garbleTime = current_time_ns() - start;
+    garble_hash(&gc, hash);
+    tableSize = (gc.q - gc.nxors) * garble_table_size(&gc);
+    for (size_t i = 0; i < gc.n; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extractedLabels, gc.wires, inputs, gc.n);
+    start = current_time_ns();
+    garble_eval(&gc, extractedLabels, NULL, outputs);
+    evalTime = current_time_ns() - start;
+
+    /* Callback */
+    (void) garble_seed(&seed);
+    memset(&s, '\0', sizeof s);
+    (void) SHA1_Init(&s.sha);
+    start = current_time_ns();
+    assert(garble_stream_garble(&stream, &gc2, NULL, outputMap2, hash_chunk, &s)
+           == GARBLE_OK);
+    streamTime = current_time_ns() - start;
+    (void) SHA1_Final(hash2, &s.sha);
+    assert(s.nbytes == tableSize);
+    assert(memcmp(hash, hash2, SHA_DIGEST_LENGTH) == 0);
+    assert(memcmp(outputMap, outputMap2, 2 * gc.m * sizeof(block)) == 0);
+    assert(memcmp(gc.output_perms, gc2.output_perms, gc.m * sizeof(bool)) == 0);
+    assert(memcmp(gc.wires, stream.labels, 2 * gc.n * sizeof(block)) == 0);
+
+    /* File descriptor */
+    {
+        FILE *f = tmpfile();
+        char *buf = malloc(tableSize);
+        SHA_CTX c;
+
+        (void) garble_seed(&seed);
+        assert(garble_stream_garble_fd(&stream, &gc2, NULL, NULL, fileno(f))
+               == GARBLE_OK);
+        rewind(f);
+        assert(fread(buf, 1, tableSize, f) == tableSize);
+        (void) SHA1_Init(&c);
+        (void) SHA1_Update(&c, buf, tableSize);
+        (void) SHA1_Final(hash2, &c);
+        assert(memcmp(hash, hash2, SHA_DIGEST_LENGTH) == 0);
+
+        /* Evaluate from the file, and from a reader returning short pieces */
+        rewind(f);
+        start = current_time_ns();
+        assert(garble_stream_eval_fd(&stream, &gc2, extractedLabels, NULL,
+                                     outputs2, fileno(f)) == GARBLE_OK);
+        streamEvalTime = current_time_ns() - start;
+        assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+        {
+            source src = { buf, tableSize, 0 };
+            memset(outputs2, '\0', gc.m * sizeof(bool));
+            assert(garble_stream_eval(&stream, &gc2, extractedLabels, NULL,
+                                      outputs2, read_piece, &src) == GARBLE_OK);
+            assert(src.pos == tableSize);
+            assert(memcmp(outputs, outputs2, gc.m * sizeof(bool)) == 0);
+            /* A truncated table is an error */
+            src.pos = 0;
+            src.len = tableSize - 1;
+            assert(garble_stream_eval(&stream, &gc2, extractedLabels, NULL,
+                                      outputs2, read_piece, &src) == GARBLE_ERR);
+        }
+        free(buf);
+        fclose(f);
+    }
+
+    printf("wires: %lu -> %lu label slots, largest chunk %lu bytes\n",
+           gc.r, stream.nslots, s.max_chunk);
+    printf("resident: %lu bytes (garble_garble) vs %lu bytes (stream)\n",
+           2 * gc.r * sizeof(block) + tableSize,
+           2 * stream.nslots * sizeof(block)
+           + stream.chunk_rows * garble_table_size(&gc));
+    printf("time: %.2f ns/g (garble_garble) vs %.2f ns/g (stream)\n",
+           (double) garbleTime / gc.q, (double) streamTime / gc.q);
+    printf("eval: %.2f ns/g (garble_eval) vs %.2f ns/g (stream from file)\n",
+           (double) evalTime / gc.q, (double) streamEvalTime / gc.q);
+
+    garble_stream_delete(&stream);
+    garble_delete(&gc);
+    garble_delete(&gc2);
+    free(outputMap);
+    free(outputMap2);
+    free(extractedLabels);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t chunk_rows = 0;
+
+    if (argc > 1)
+        chunk_rows = atoi(argv[1]);
+
+    printf("Type: Standard\n");
+    if (run(GARBLE_TYPE_STANDARD, chunk_rows))
+        return 1;
+    printf("Type: Half-gates\n");
+    if (run(GARBLE_TYPE_HALFGATES, chunk_rows))
+        return 1;
+    printf("Type: Privacy free\n");
+    if (run(GARBLE_TYPE_PRIVACY_FREE, chunk_rows))
+        return 1;
+    return 0;
+}
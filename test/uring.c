@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+
+#include "garble.h"
+#include "circuit_builder.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+/* Garble a large synthetic circuit to a file and evaluate it back, once
+ * through garble_save/garble_load and once through the io_uring backend,
+ * checking that both produce the same table and outputs; then check that
+ * unwritable and truncated table files fail instead of hanging */
+
+#define TABLE_FILE_NAME "./uring.tbl"
+#define N 128
+#define M 128
+#define WINDOW 1024
+
+/* Random AND/XOR gates over a window of recent wires */
+static void
+build_random_circuit(garble_circuit *gc, garble_type_e type, size_t q)
+{
+    garble_context ctxt;
+    int *outputs = calloc(M, sizeof(int));
+
+    garble_new(gc, N, M, type);
+    builder_start_building(gc, &ctxt);
+    for (size_t i = 0; i < q; ++i) {
+        const size_t lo = ctxt.wire_index > WINDOW ? ctxt.wire_index - WINDOW : 0;
+        const size_t span = ctxt.wire_index - lo;
+        int in0 = lo + rand() % span, in1 = lo + rand() % span;
+        int out = builder_next_wire(&ctxt);
+
+        if (rand() % 2)
+            gate_AND(gc, &ctxt, in0, in1, out);
+        else
+            gate_XOR(gc, &ctxt, in0, in1, out);
+    }
+    for (size_t i = 0; i < M; ++i)
+        outputs[i] = ctxt.wire_index - M + i;
+    builder_finish_building(gc, &ctxt, outputs);
+    free(outputs);
+}
+
+static void
+hash_file(int fd, unsigned char *hash)
+{
+    SHA_CTX c;
+    char *buf = malloc(1 << 20);
+    ssize_t n;
+
+    (void) SHA1_Init(&c);
+    (void) lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, 1 << 20)) > 0)
+        (void) SHA1_Update(&c, buf, n);
+    (void) SHA1_Final(hash, &c);
+    free(buf);
+}
+
+/* Prefer O_DIRECT, which tmpfs and some other filesystems refuse */
+static int
+open_table(int flags, bool *direct)
+{
+    int fd = open(TABLE_FILE_NAME, flags | O_DIRECT, 0644);
+    *direct = fd != -1;
+    if (fd == -1)
+        fd = open(TABLE_FILE_NAME, flags, 0644);
+    return fd;
+}
+
+static double
+gbps(size_t bytes, mytime_t ns)
+{
+    return (double) bytes / ns;
+}
+
+static int
+run(garble_type_e type, size_t q)
+{
+    garble_circuit gc;
+    block seed;
+    unsigned char hash[SHA_DIGEST_LENGTH], hash2[SHA_DIGEST_LENGTH];
+    block *outputMap = garble_allocate_blocks(2 * M);
+    block *outputMap2 = garble_allocate_blocks(2 * M);
+    block *inputLabels = garble_allocate_blocks(2 * N);
+    block *extractedLabels = garble_allocate_blocks(N);
+    bool *inputs = calloc(N, sizeof(bool));
+    bool *outputs = calloc(M, sizeof(bool));
+    bool *outputs2 = calloc(M, sizeof(bool));
+    mytime_t start, stdioGarble, stdioEval, uringGarble, uringEval;
+    size_t tableSize;
+    bool direct;
+    FILE *f;
+    int fd;
+
+    build_random_circuit(&gc, type, q);
+    tableSize = (gc.q - gc.nxors) * garble_table_size(&gc);
+    seed = garble_seed(NULL);
+
+    /* stdio */
+    start = current_time_ns();
+    assert(garble_garble(&gc, NULL, outputMap) == GARBLE_OK);
+    f = fopen(TABLE_FILE_NAME, "w");
+    assert(fwrite(gc.table, 1, tableSize, f) == tableSize);
+    fclose(f);
+    stdioGarble = current_time_ns() - start;
+    memcpy(inputLabels, gc.wires, 2 * N * sizeof(block));
+    for (size_t i = 0; i < N; ++i)
+        inputs[i] = rand() % 2;
+    garble_extract_labels(extractedLabels, inputLabels, inputs, N);
+    free(gc.table);
+    gc.table = NULL;
+
+    start = current_time_ns();
+    gc.table = malloc(tableSize);
+    f = fopen(TABLE_FILE_NAME, "r");
+    assert(fread(gc.table, 1, tableSize, f) == tableSize);
+    fclose(f);
+    assert(garble_eval(&gc, extractedLabels, NULL, outputs) == GARBLE_OK);
+    stdioEval = current_time_ns() - start;
+    {
+        SHA_CTX c;
+        (void) SHA1_Init(&c);
+        (void) SHA1_Update(&c, gc.table, tableSize);
+        (void) SHA1_Final(hash, &c);
+    }
+    free(gc.table);
+    gc.table = NULL;
+
+    /* io_uring */
+    (void) garble_seed(&seed);
+    fd = open_table(O_RDWR | O_CREAT | O_TRUNC, &direct);
+    assert(fd != -1);
+    start = current_time_ns();
+    assert(garble_garble_uring(&gc, NULL, outputMap2, fd) == GARBLE_OK);
+    uringGarble = current_time_ns() - start;
+    assert(gc.table == NULL);
+    assert(memcmp(outputMap, outputMap2, 2 * M * sizeof(block)) == 0);
+    assert(lseek(fd, 0, SEEK_END) == (off_t) tableSize);
+    (void) close(fd);
+
+    fd = open_table(O_RDONLY, &direct);
+    assert(fd != -1);
+    start = current_time_ns();
+    assert(garble_eval_uring(&gc, extractedLabels, NULL, outputs2, fd) == GARBLE_OK);
+    uringEval = current_time_ns() - start;
+    assert(memcmp(outputs, outputs2, M * sizeof(bool)) == 0);
+    (void) close(fd);
+    fd = open(TABLE_FILE_NAME, O_RDONLY);
+    hash_file(fd, hash2);
+    (void) close(fd);
+    assert(memcmp(hash, hash2, SHA_DIGEST_LENGTH) == 0);
+
+    printf("%lu gates, %.2f GB table, %s, %s\n", gc.q, tableSize / 1e9,
+           garble_uring_available() ? "io_uring" : "pwrite/pread fallback",
+           direct ? "O_DIRECT" : "buffered");
+    printf("         garble(GB/s)  eval(GB/s)\n");
+    printf("stdio    %12.2f  %10.2f\n", gbps(tableSize, stdioGarble),
+           gbps(tableSize, stdioEval));
+    printf("io_uring %12.2f  %10.2f\n", gbps(tableSize, uringGarble),
+           gbps(tableSize, uringEval));
+
+    (void) unlink(TABLE_FILE_NAME);
+    garble_delete(&gc);
+    free(outputMap);
+    free(outputMap2);
+    free(inputLabels);
+    free(extractedLabels);
+    free(inputs);
+    free(outputs);
+    free(outputs2);
+    return 0;
+}
+
+/* Garbling to a read-only fd and evaluating a truncated table must fail */
+static void
+check_errors(garble_type_e type)
+{
+    garble_circuit gc;
+    block *extractedLabels = garble_allocate_blocks(N);
+    bool *outputs = calloc(M, sizeof(bool));
+    size_t tableSize;
+    bool direct;
+    int fd;
+
+    build_random_circuit(&gc, type, 4 * GARBLE_URING_ROWS);
+    tableSize = (gc.q - gc.nxors) * garble_table_size(&gc);
+
+    fd = open_table(O_RDWR | O_CREAT | O_TRUNC, &direct);
+    assert(fd != -1);
+    assert(garble_garble_uring(&gc, NULL, NULL, fd) == GARBLE_OK);
+    (void) close(fd);
+    memcpy(extractedLabels, gc.wires, N * sizeof(block));
+
+    fd = open_table(O_RDONLY, &direct);
+    assert(fd != -1);
+    assert(garble_garble_uring(&gc, NULL, NULL, fd) == GARBLE_ERR);
+    (void) close(fd);
+
+    assert(truncate(TABLE_FILE_NAME, tableSize / 2) == 0);
+    fd = open_table(O_RDONLY, &direct);
+    assert(fd != -1);
+    assert(garble_eval_uring(&gc, extractedLabels, NULL, outputs, fd)
+           == GARBLE_ERR);
+    (void) close(fd);
+
+    (void) unlink(TABLE_FILE_NAME);
+    garble_delete(&gc);
+    free(extractedLabels);
+    free(outputs);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t q = 1 << 20;
+
+    if (argc > 1)
+        q = strtoul(argv[1], NULL, 10);
+
+    printf("Type: Standard\n");
+    if (run(GARBLE_TYPE_STANDARD, q))
+        return 1;
+    printf("Type: Half-gates\n");
+    if (run(GARBLE_TYPE_HALFGATES, q))
+        return 1;
+    printf("Type: Privacy free\n");
+    if (run(GARBLE_TYPE_PRIVACY_FREE, q))
+        return 1;
+    check_errors(GARBLE_TYPE_STANDARD);
+    check_errors(GARBLE_TYPE_HALFGATES);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "circuits.h"
 #include <garble/block.h>
 
 #include <ctype.h>
@@ -49,3 +50,42 @@ doubleMean(double *values, int n)
         total += values[i];
     return total / n;
 }
+
+void
+build_aes_circuit(garble_circuit *gc, garble_type_e type)
+{
+    const size_t roundLimit = 10;
+    garble_context ctxt;
+
+    int addKeyInputs[256];
+    int addKeyOutputs[128];
+    int subBytesOutputs[128];
+    int shiftRowsOutputs[128];
+    int mixColumnOutputs[128];
+
+    garble_new(gc, AES_CIRCUIT_N, AES_CIRCUIT_M, type);
+    builder_start_building(gc, &ctxt);
+    builder_init_wires(addKeyInputs, 256);
+    for (size_t round = 0; round < roundLimit; ++round) {
+
+        aescircuit_add_round_key(gc, &ctxt, addKeyInputs, addKeyOutputs);
+
+        for (int i = 0; i < 16; ++i) {
+            aescircuit_sub_bytes(gc, &ctxt, addKeyOutputs + 8 * i,
+                                 subBytesOutputs + 8 * i);
+        }
+
+        aescircuit_shift_rows(subBytesOutputs, shiftRowsOutputs);
+
+        for (size_t i = 0; i < 4; i++) {
+            if (round != roundLimit - 1)
+                aescircuit_mix_columns(gc, &ctxt, shiftRowsOutputs + i * 32,
+                                       mixColumnOutputs + 32 * i);
+        }
+        for (size_t i = 0; i < 128; i++) {
+            addKeyInputs[i] = mixColumnOutputs[i];
+            addKeyInputs[i + 128] = (round + 2) * 128 + i;
+        }
+    }
+    builder_finish_building(gc, &ctxt, mixColumnOutputs);
+}
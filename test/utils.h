@@ -1,6 +1,8 @@
 #ifndef LIBGARBLE_TEST_UTILS_H
 #define LIBGARBLE_TEST_UTILS_H
 
+#include "garble.h"
+
 #include <stdint.h>
 
 typedef unsigned long long mytime_t;
@@ -16,4 +18,13 @@ median(mytime_t *values, int n);
 double
 doubleMean(double A[], int n);
 
+/* Number of inputs/outputs of the circuit built by build_aes_circuit */
+#define AES_CIRCUIT_N (128 * (10 + 1))
+#define AES_CIRCUIT_M 128
+
+/* Build a 10-round AES circuit taking the plaintext and all round keys as
+ * input */
+void
+build_aes_circuit(garble_circuit *gc, garble_type_e type);
+
 #endif